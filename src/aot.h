@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include "chip8.h"
+
+// Entry points of the C++ code tools/chip8_aot generates for a ROM. Link exactly one generated file.
+
+// Hash and quirk profile of the ROM the code was generated from. The machine must run with AOT_PROFILE.
+extern const uint64_t AOT_ROM_HASH;
+extern const QuirkProfile AOT_PROFILE;
+
+// Same contract as Chip8::run_instructions(). Compiled blocks run while they fit in the budget and the memory
+// they were compiled from is unchanged, everything else runs through Chip8::emulate_cycle().
+int aot_run(Chip8 &chip8, int budget);
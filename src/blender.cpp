@@ -0,0 +1,122 @@
+#include "blender.h"
+#include <cstring>
+
+FrameBlender::FrameBlender(BlendMode mode) : mode(mode), frame_width(0), frame_height(0), pending_rows(0),
+                                             shades_palette(nullptr) {
+    memset(level_bits, 0, sizeof(level_bits));
+    memset(previous, 0, sizeof(previous));
+}
+
+void FrameBlender::reset(const Display &display) {
+    frame_width = display.width;
+    frame_height = display.height;
+    pending_rows = 0;
+    memset(level_bits, 0, sizeof(level_bits));
+    memset(previous, 0, sizeof(previous));
+}
+
+uint64_t FrameBlender::update(Display &display) {
+    uint64_t changed_rows = display.take_dirty_rows();
+    if (display.width != frame_width || display.height != frame_height) {
+        reset(display);
+        changed_rows = ~0ull;
+    }
+
+    uint64_t rows_to_update = changed_rows | pending_rows;
+    uint64_t output_rows = 0;
+    pending_rows = 0;
+
+    const int words = frame_width / 64;
+    for (int y = 0; y < frame_height; ++y) {
+        if (!((rows_to_update >> y) & 1u)) {
+            continue;
+        }
+
+        uint64_t row_changed = 0;
+        uint64_t row_pending = 0;
+        for (int plane = 0; plane < Display::PLANES; ++plane) {
+            for (int w = 0; w < words; ++w) {
+                uint64_t current = display.rows[plane][y][w];
+                uint64_t low = level_bits[0][plane][y][w];
+                uint64_t high = level_bits[1][plane][y][w];
+                uint64_t new_low;
+                uint64_t new_high;
+
+                switch (mode) {
+                    case BlendMode::OrLastTwo: {
+                        uint64_t lit = current | previous[plane][y][w];
+                        // The previous frame drops out of the OR next frame
+                        row_pending |= current ^ previous[plane][y][w];
+                        previous[plane][y][w] = current;
+                        new_low = lit;
+                        new_high = lit;
+                    } break;
+
+                    case BlendMode::Phosphor: {
+                        // Saturating decrement of 64 two-bit levels at once, then lit pixels go back to full
+                        uint64_t nonzero = low | high;
+                        new_low = (~low & nonzero) | current;
+                        new_high = (high & low) | current;
+                        row_pending |= (new_low | new_high) & ~current;
+                    } break;
+
+                    default: {
+                        new_low = current;
+                        new_high = current;
+                    } break;
+                }
+
+                row_changed |= (low ^ new_low) | (high ^ new_high);
+                level_bits[0][plane][y][w] = new_low;
+                level_bits[1][plane][y][w] = new_high;
+            }
+        }
+
+        if (row_changed) {
+            output_rows |= 1ull << y;
+        }
+        if (row_pending) {
+            pending_rows |= 1ull << y;
+        }
+    }
+    return output_rows;
+}
+
+// Mixes each palette colour towards the background colour, level 3 is the full colour
+void FrameBlender::build_shades(const uint32_t palette[Display::COLORS]) {
+    const uint32_t background = palette[0];
+    for (int level0 = 0; level0 < LEVELS; ++level0) {
+        for (int level1 = 0; level1 < LEVELS; ++level1) {
+            int color = (level0 != 0) | (level1 != 0) << 1;
+            int level = level0 > level1 ? level0 : level1;
+
+            uint32_t mixed = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                int from = (background >> shift) & 0xFF;
+                int to = (palette[color] >> shift) & 0xFF;
+                mixed |= static_cast<uint32_t>(from + (to - from) * level / (LEVELS - 1)) << shift;
+            }
+            shades[level0 + LEVELS * level1] = mixed;
+        }
+    }
+    shades_palette = palette;
+}
+
+void FrameBlender::to_rgba_row(uint32_t *out, int y, const uint32_t palette[Display::COLORS]) {
+    if (palette != shades_palette) {
+        build_shades(palette);
+    }
+
+    const int words = frame_width / 64;
+    for (int w = 0; w < words; ++w) {
+        uint64_t low0 = level_bits[0][0][y][w];
+        uint64_t high0 = level_bits[1][0][y][w];
+        uint64_t low1 = level_bits[0][1][y][w];
+        uint64_t high1 = level_bits[1][1][y][w];
+        for (int bit = 63; bit >= 0; --bit) {
+            int key = ((low0 >> bit) & 1u) | ((high0 >> bit) & 1u) << 1 |
+                      ((low1 >> bit) & 1u) << 2 | ((high1 >> bit) & 1u) << 3;
+            *out++ = shades[key];
+        }
+    }
+}
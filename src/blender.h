@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include "display.h"
+
+// Flicker reduction for games that erase and redraw sprites with XOR every frame.
+enum class BlendMode {
+    Off,        // Present the display as is
+    OrLastTwo,  // A pixel is lit if it was on in this frame or the previous one
+    Phosphor    // Lit pixels fade out over a few frames instead of switching off
+};
+
+// Presentation stage between the Display and the frontend.
+// Every pixel has a brightness level from 0 to 3 per plane, stored bit-sliced: level_bits[0] holds bit 0 of
+// 64 pixels per word and level_bits[1] holds bit 1. Updating a frame is a handful of bitwise operations per
+// word (SWAR), done only for rows that changed or are still fading, and the per-pixel work is one table lookup.
+class FrameBlender {
+    public:
+        static constexpr int LEVELS = 4;
+
+        BlendMode mode;
+
+        explicit FrameBlender(BlendMode mode = BlendMode::Off);
+
+        // Folds the current frame into the blended output, consuming the display's dirty rows.
+        // Call once per frame. Returns the rows whose blended output changed.
+        uint64_t update(Display &display);
+
+        // Expands one blended row into 32-bit pixels
+        void to_rgba_row(uint32_t *out, int y, const uint32_t palette[Display::COLORS]);
+
+        int width() const { return frame_width; }
+        int height() const { return frame_height; }
+
+    private:
+        uint64_t level_bits[2][Display::PLANES][Display::MAX_HEIGHT][Display::WORDS_PER_ROW];
+        uint64_t previous[Display::PLANES][Display::MAX_HEIGHT][Display::WORDS_PER_ROW];
+        int frame_width;
+        int frame_height;
+
+        // Rows whose output changes next frame even if the display doesn't (fading or OR with the previous frame)
+        uint64_t pending_rows;
+
+        // Output colour for every combination of plane 0 and plane 1 levels (plane 0 level + 4 * plane 1 level),
+        // rebuilt when the palette changes
+        uint32_t shades[LEVELS * LEVELS];
+        const uint32_t *shades_palette;
+
+        void reset(const Display &display);
+        void build_shades(const uint32_t palette[Display::COLORS]);
+};
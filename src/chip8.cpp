@@ -1,38 +1,26 @@
 #include "chip8.h"
-#include <cstring>   
+#include "rom_db.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <chrono>
 #include <random>
 
-constexpr uint32_t START_ADDRESS = 0x200; // 0x000 to 0x1FF is reserved for system.
-constexpr uint32_t FONTSET_START_ADDRESS = 0x50;
-constexpr uint32_t FONTSET_SIZE = 80;
-
 Chip8::Chip8() : randGen(std::chrono::system_clock::now().time_since_epoch().count()) {
-    // Notice that only the upper half (high nibble) has value
-    uint8_t fontset[FONTSET_SIZE] = {
-	    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-	    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-	    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-	    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-	    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-	    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-	    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-	    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-	    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-	    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-	    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-	    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-	    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-	    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-	    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-	    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
+    rom_hash = 0;
 
-    // Load the font into memory
-    for (int i = 0; i < FONTSET_SIZE; ++i)  {
-        memory[FONTSET_START_ADDRESS + i] = fontset[i];
-    }
+    // RPL flags survive a reset, like the HP48 calculator's user flags
+    memset(rpl_flags, 0, sizeof(rpl_flags));
+
+    quirks = QuirkProfile::Chip8;
+    interpreter = DEFAULT_INTERPRETER;
+    cycles_per_frame = DEFAULT_ROM_INFO.cycles_per_frame;
+    profiling = false;
+    memset(opcode_counts, 0, sizeof(opcode_counts));
+    memset(fusion_counts, 0, sizeof(fusion_counts));
+    watch_address = 0;
+    watch_was_write = false;
+    coverage_enabled = false;
 
     randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
 }
@@ -42,53 +30,523 @@ void Chip8::init() {
     opcode = 0;
     index = 0;
     sp = 0;
+    memset(registers, 0, sizeof(registers));
+    memset(stack, 0, sizeof(stack));
+    memset(keypad, 0, sizeof(keypad));
+    delay_timer = 0;
+    sound_timer = 0;
+    exited = false;
+    illegal_opcode = false;
+    idle = false;
+    waiting_for_key = false;
+    key_register = 0;
+    breakpoint_hit = false;
+    watchpoint_hit = false;
+    frame_instructions = 0;
+    // Keeps the profile chosen with set_quirks(), only the memory and decoded state are rebuilt for it
+    set_quirks(quirks);
+    memory.reset();
+    predecoded.reset();
+    jit.reset();
+    display.plane_mask = 1;
+    display.set_hires(false);
 }
 
-void Chip8::load_rom(char const *file_path) {
-    std::ifstream file(file_path, std::ios::binary);
+uint32_t Chip8::max_rom_size() const {
+    return quirk_memory_size(quirks) - START_ADDRESS;
+}
 
-    if (file.is_open()) {
-        // Get size of ROM file
-        file.seekg(0, file.end);
-        auto rom_size = file.tellg();
-        char *buffer = new char[rom_size];
+bool Chip8::load_rom(char const *file_path) {
+    std::shared_ptr<const RomImage> image = RomImage::from_file(file_path);
+    return image != nullptr && load_rom(image);
+}
 
-        // Fill the buffer with ROM data
-        file.seekg(0, file.beg);
-        file.read(buffer, rom_size);
-        file.close();
+bool Chip8::load_rom(const uint8_t *data, size_t size) {
+    std::shared_ptr<const RomImage> image = RomImage::from_buffer(data, size);
+    return image != nullptr && load_rom(image);
+}
 
-        // Load ROM content into Chip8 memory, starting from 0x200
-        for (long i = 0; i < rom_size; ++i) {
-            // std::cout << std::hex << (int)buffer[i] << std::endl;
-            memory[START_ADDRESS + i] = buffer[i];
-        }
+// Maps a ROM image without copying it, so any number of instances can run the same image
+bool Chip8::load_rom(std::shared_ptr<const RomImage> image) {
+    if (image->rom_size > max_rom_size()) {
+        return false;
+    }
 
-        delete[] buffer;
+    memory.attach(image, quirk_memory_size(quirks));
+    predecoded.reset();
+    jit.reset();
+    rom_hash = image->hash;
+    return true;
+}
+
+// Handler for every OpKind, defined with the predecoder below
+template <typename Quirks>
+struct HandlerTable {
+    static const OpHandler handlers[OP_KIND_COUNT];
+};
+
+// Changing to a profile with a different memory size remaps the ROM image, dropping writes to memory
+void Chip8::set_quirks(QuirkProfile profile) {
+    quirks = profile;
+    if (memory.size() != quirk_memory_size(profile)) {
+        memory.attach(memory.image_ptr(), quirk_memory_size(profile));
+    }
+    // Decoded instructions hold the handlers of the old profile, compiled blocks its quirks
+    predecoded.reset();
+    jit.reset();
+    switch (profile) {
+        case QuirkProfile::Chip8:
+            execute_handler = &Chip8::execute<Chip8Quirks>;
+            decode_handler = &Predecoder::decode<Chip8Quirks>;
+            threaded_handler = &Chip8::run_threaded<Chip8Quirks>;
+            handler_table = HandlerTable<Chip8Quirks>::handlers;
+            break;
+
+        case QuirkProfile::SuperChip:
+            execute_handler = &Chip8::execute<SuperChipQuirks>;
+            decode_handler = &Predecoder::decode<SuperChipQuirks>;
+            threaded_handler = &Chip8::run_threaded<SuperChipQuirks>;
+            handler_table = HandlerTable<SuperChipQuirks>::handlers;
+            break;
+
+        case QuirkProfile::XoChip:
+            execute_handler = &Chip8::execute<XoChipQuirks>;
+            decode_handler = &Predecoder::decode<XoChipQuirks>;
+            threaded_handler = &Chip8::run_threaded<XoChipQuirks>;
+            handler_table = HandlerTable<XoChipQuirks>::handlers;
+            break;
+
+        case QuirkProfile::CosmacVip:
+            execute_handler = &Chip8::execute<CosmacVipQuirks>;
+            decode_handler = &Predecoder::decode<CosmacVipQuirks>;
+            threaded_handler = &Chip8::run_threaded<CosmacVipQuirks>;
+            handler_table = HandlerTable<CosmacVipQuirks>::handlers;
+            break;
+    }
+}
+
+void Chip8::tick_timers() {
+    if (delay_timer > 0) {
+        --delay_timer;
+    }
+    if (sound_timer > 0) {
+        --sound_timer;
     }
 }
 
+void Chip8::key_event(uint8_t key, bool pressed) {
+    if (key > 0xF) {
+        return;
+    }
+    bool was_pressed = keypad[key] != 0;
+    keypad[key] = pressed ? 1 : 0;
+
+    if (waiting_for_key && was_pressed && !pressed) {
+        registers[key_register] = key;
+        waiting_for_key = false;
+    }
+}
+
+// The profile is resolved once in set_quirks(), so there is no quirk check left on this path
 void Chip8::emulate_cycle() {
+    (this->*execute_handler)();
+}
+
+int Chip8::run_instructions(int budget) {
+    idle = waiting_for_key;
+    watchpoint_hit = false;
+
+    if (breakpoint_hit) {
+        if (budget == 0 || idle) {
+            return 0;
+        }
+        // Continuing from a breakpoint: its predecoded slot holds the breakpoint, so run the instruction itself
+        breakpoint_hit = false;
+        if (coverage_enabled) {
+            cover_code(pc);
+        }
+        emulate_cycle();
+        return 1 + (exited || idle ? 0 : dispatch(budget - 1));
+    }
+    return dispatch(budget);
+}
+
+int Chip8::dispatch(int budget) {
+    if (interpreter == Interpreter::Switch && !profiling) {
+        int executed = 0;
+        for (; executed < budget && !exited && !idle; ++executed) {
+            if (!breakpoints.empty() && breakpoints.test(pc)) {
+                breakpoint_hit = true;
+                break;
+            }
+            if (coverage_enabled) {
+                cover_code(pc);
+            }
+            emulate_cycle();
+        }
+        return executed;
+    }
+
+    if (!predecoded.fits(memory.size())) {
+        predecoded.allocate(memory.size());
+    }
+    if (profiling) {
+        return run_predecoded<true>(budget);
+    }
+    if (interpreter == Interpreter::Threaded) {
+        return (this->*threaded_handler)(budget);
+    }
+    if (interpreter == Interpreter::Jit && !debugging() && !coverage_enabled) {
+        if (!jit.fits(memory.size())) {
+            jit.allocate(memory.size());
+        }
+        // Blocks only run whole, the predecoded interpreter finishes the budget
+        int executed = jit.run(*this, budget);
+        if (executed < budget && !exited && !idle) {
+            executed += run_predecoded<false>(budget - executed);
+        }
+        return executed;
+    }
+    return run_predecoded<false>(budget);
+}
+
+StopReason Chip8::stop_reason() const {
+    if (illegal_opcode) {
+        return StopReason::IllegalOpcode;
+    }
+    if (exited) {
+        return StopReason::Exited;
+    }
+    if (breakpoint_hit) {
+        return StopReason::Breakpoint;
+    }
+    if (watchpoint_hit) {
+        return StopReason::Watchpoint;
+    }
+    if (waiting_for_key) {
+        return StopReason::WaitingForKey;
+    }
+    return StopReason::TimerWait;
+}
+
+RunResult Chip8::run_cycles(uint64_t cycles) {
+    const int MAX_BUDGET = 1 << 30;
+    RunResult result = { StopReason::BudgetExhausted, 0, 0 };
+
+    while (result.instructions < cycles) {
+        int budget = static_cast<int>(std::min<uint64_t>(cycles - result.instructions, MAX_BUDGET));
+        int executed = run_instructions(budget);
+        result.instructions += executed;
+        if (executed < budget || watchpoint_hit) {
+            result.reason = stop_reason();
+            break;
+        }
+    }
+    return result;
+}
+
+RunResult Chip8::run_frames(uint64_t frames) {
+    RunResult result = { StopReason::FrameCompleted, 0, 0 };
+
+    while (result.frames < frames) {
+        int executed = run_instructions(cycles_per_frame - frame_instructions);
+        result.instructions += executed;
+        if (breakpoint_hit || watchpoint_hit) {
+            frame_instructions += executed;
+            result.reason = stop_reason();
+            break;
+        }
+        frame_instructions = 0;
+        tick_timers();
+        ++result.frames;
+
+        if (exited || waiting_for_key) {
+            result.reason = stop_reason();
+            break;
+        }
+    }
+    return result;
+}
+
+void Chip8::save(Snapshot &snapshot) const {
+    memcpy(snapshot.registers, registers, sizeof(registers));
+    snapshot.index = index;
+    snapshot.pc = pc;
+    memcpy(snapshot.stack, stack, sizeof(stack));
+    snapshot.sp = sp;
+    snapshot.delay_timer = delay_timer;
+    snapshot.sound_timer = sound_timer;
+    memcpy(snapshot.keypad, keypad, sizeof(keypad));
+    memcpy(snapshot.rpl_flags, rpl_flags, sizeof(rpl_flags));
+    snapshot.display = display;
+    snapshot.exited = exited;
+    snapshot.illegal_opcode = illegal_opcode;
+    snapshot.waiting_for_key = waiting_for_key;
+    snapshot.key_register = key_register;
+    snapshot.frame_instructions = frame_instructions;
+    snapshot.random = randGen;
+    snapshot.random_byte = randByte;
+
+    snapshot.pages.clear();
+    snapshot.bytes.clear();
+    for (uint32_t page = 0; page < memory.size() >> Memory::PAGE_SHIFT; ++page) {
+        uint32_t start = page << Memory::PAGE_SHIFT;
+        if (memory.modified(start)) {
+            snapshot.pages.push_back(static_cast<uint16_t>(page));
+            for (uint32_t i = 0; i < Memory::PAGE_SIZE; ++i) {
+                snapshot.bytes.push_back(memory.read(start + i));
+            }
+        }
+    }
+}
+
+void Chip8::restore(const Snapshot &snapshot) {
+    memcpy(registers, snapshot.registers, sizeof(registers));
+    index = snapshot.index;
+    pc = snapshot.pc;
+    memcpy(stack, snapshot.stack, sizeof(stack));
+    sp = snapshot.sp;
+    delay_timer = snapshot.delay_timer;
+    sound_timer = snapshot.sound_timer;
+    memcpy(keypad, snapshot.keypad, sizeof(keypad));
+    memcpy(rpl_flags, snapshot.rpl_flags, sizeof(rpl_flags));
+    // Marks the rows that differ, so a frontend redraws them
+    display.copy_from(snapshot.display);
+    exited = snapshot.exited;
+    illegal_opcode = snapshot.illegal_opcode;
+    waiting_for_key = snapshot.waiting_for_key;
+    key_register = snapshot.key_register;
+    frame_instructions = snapshot.frame_instructions;
+    randGen = snapshot.random;
+    randByte = snapshot.random_byte;
+    idle = false;
+    breakpoint_hit = false;
+    watchpoint_hit = false;
+
+    memory.reset();
+    for (size_t i = 0; i < snapshot.pages.size(); ++i) {
+        uint32_t start = static_cast<uint32_t>(snapshot.pages[i]) << Memory::PAGE_SHIFT;
+        for (uint32_t j = 0; j < Memory::PAGE_SIZE; ++j) {
+            memory.write(start + j, snapshot.bytes[i * Memory::PAGE_SIZE + j]);
+        }
+    }
+    predecoded.reset();
+    jit.reset();
+}
+
+void Chip8::set_breakpoint(uint16_t address) {
+    if (breakpoints.set(address)) {
+        // Drops the entry at address and the superinstruction that may cover it from address - 2
+        predecoded.invalidate(address);
+    }
+}
+
+void Chip8::clear_breakpoint(uint16_t address) {
+    if (breakpoints.clear(address)) {
+        predecoded.invalidate(address);
+    }
+}
+
+void Chip8::set_watchpoint(uint32_t address, uint32_t length, int kinds) {
+    change_watchpoints(address, length, kinds, true);
+}
+
+void Chip8::clear_watchpoint(uint32_t address, uint32_t length, int kinds) {
+    change_watchpoints(address, length, kinds, false);
+}
+
+void Chip8::change_watchpoints(uint32_t address, uint32_t length, int kinds, bool set) {
+    for (uint32_t i = 0; i < length; ++i) {
+        if (kinds & WATCH_READ) {
+            set ? read_watches.set(address + i) : read_watches.clear(address + i);
+        }
+        if (kinds & WATCH_WRITE) {
+            set ? write_watches.set(address + i) : write_watches.clear(address + i);
+        }
+    }
+}
+
+void Chip8::clear_debug_points() {
+    breakpoints.clear_all();
+    read_watches.clear_all();
+    write_watches.clear_all();
+    predecoded.reset();
+}
+
+// Handler of OpKind::Breakpoint. pc is already past the instruction, so it is put back.
+void Chip8::hit_breakpoint() {
+    pc -= 2;
+    breakpoint_hit = true;
+    idle = true;
+}
+
+// Addresses wrap around memory like the accesses themselves
+void Chip8::check_watchpoints(const AddressBitmap &watches, uint32_t address, uint32_t length, bool write) {
+    uint32_t mask = memory.size() - 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        if (watches.test((address + i) & mask)) {
+            watchpoint_hit = true;
+            watch_address = (address + i) & mask;
+            watch_was_write = write;
+            idle = true;
+            return;
+        }
+    }
+}
+
+void Chip8::set_coverage(bool enabled) {
+    if (enabled && !coverage_enabled) {
+        predecoded.reset();
+        jit.reset();
+    }
+    coverage_enabled = enabled;
+}
+
+// Marks every byte of the instruction, 4 for F000 NNNN
+void Chip8::cover_code(uint32_t address) {
+    uint32_t mask = memory.size() - 1;
+    bool long_load = memory.read(address) == 0xF0 && memory.read(address + 1) == 0x00;
+    for (uint32_t i = 0; i < (long_load ? 4u : 2u); ++i) {
+        code_coverage.set((address + i) & mask);
+    }
+}
+
+void Chip8::cover_data(uint32_t address, uint32_t length) {
+    uint32_t mask = memory.size() - 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        data_coverage.set((address + i) & mask);
+    }
+}
+
+// Profiling counts the accesses of every byte, so the heatmap shows the size of what is read and written
+void Chip8::count_accesses(std::vector<uint32_t> &counts, uint32_t address, uint32_t length) {
+    if (access_counts.empty()) {
+        access_counts.allocate();
+    }
+    uint32_t mask = memory.size() - 1;
+    for (uint32_t i = 0; i < length; ++i) {
+        ++counts[(address + i) & mask];
+    }
+}
 
-    opcode = memory[pc] << 8 | memory[pc + 1];
+void Chip8::count_fetch(uint32_t address) {
+    bool long_load = memory.read(address) == 0xF0 && memory.read(address + 1) == 0x00;
+    count_accesses(access_counts.fetches, address, long_load ? 4 : 2);
+}
+
+// Decodes the instruction at address for the active quirk profile, then patches in the breakpoints: the entry
+// at a breakpoint stops the run, and a superinstruction is split when its second half has one. Instructions are
+// decoded right before they first run, which is when coverage marks them.
+DecodedOp &Chip8::decode(uint32_t address) {
+    DecodedOp &op = predecoded.writable(address);
+    decode_handler(memory, address, op);
+    if (coverage_enabled) {
+        cover_code(address);
+        if (op.fusion != Fusion::None) {
+            cover_code(address + 2);
+        }
+    }
+    if (breakpoints.empty()) {
+        return op;
+    }
+    if (breakpoints.test(address)) {
+        op.handler = handler(OpKind::Breakpoint);
+        op.kind = OpKind::Breakpoint;
+        op.fusion = Fusion::None;
+    } else if (op.fusion != Fusion::None && breakpoints.test(address + 2)) {
+        op.handler = handler(op.kind);
+        op.fusion = Fusion::None;
+        op.next_opcode = 0;
+    }
+    return op;
+}
 
-    std::cout << "Memory[pc] " << std::hex << +memory[pc] << std::endl;
-    std::cout << "Memory[pc + 1] " << std::hex <<+memory[pc+1] << std::endl;
-    std::cout << "Opcode: " << std::hex << +opcode << std::endl;
-    std::cout << std::dec;
+template <bool Profiling>
+int Chip8::run_predecoded(int budget) {
+    int executed = 0;
+
+    while (executed < budget && !exited && !idle) {
+        const DecodedOp *entry = &predecoded.entry(pc);
+        if (entry->handler == nullptr) {
+            entry = &decode(pc);
+        }
+        const DecodedOp &op = *entry;
+
+        Fusion fusion = op.fusion;
+        if (fusion != Fusion::None && executed + 1 == budget) {
+            // Only room for the first half of the pair
+            emulate_cycle();
+            ++executed;
+            continue;
+        }
+
+        if (Profiling) {
+            ++opcode_counts[op.opcode >> 12];
+            count_fetch(pc);
+            if (fusion != Fusion::None) {
+                ++opcode_counts[op.next_opcode >> 12];
+                ++fusion_counts[static_cast<int>(fusion)];
+                count_fetch(pc + 2);
+            }
+        }
+
+        opcode = op.opcode;
+        pc += 2;
+        op.handler(*this, op);
+        executed += fusion == Fusion::None ? 1 : 2;
+    }
+    // A breakpoint's handler doesn't run an instruction
+    return breakpoint_hit ? executed - 1 : executed;
+}
+
+template <typename Quirks>
+void Chip8::execute() {
+
+    opcode = memory.read(pc) << 8 | memory.read(pc + 1);
 
     pc += 2;
 
     switch (opcode & 0xF000) {
+        // The whole opcode is matched: 0NNN with a non-zero N in bits 8-11 (0x02C3) is a machine code call
         case 0x0000:
-            switch (opcode & 0x000F) {
-                case 0x0000: 
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                OP_00CN();
+                break;
+            }
+            if ((opcode & 0xFFF0) == 0x00D0) {
+                OP_00DN();
+                break;
+            }
+            switch (opcode) {
+                case 0x00E0: 
                     OP_OOE0(); 
                     break;
 
-                case 0x000E:
+                case 0x00EE:
                     OP_00EE(); 
                     break;
+
+                case 0x00FB:
+                    OP_00FB();
+                    break;
+
+                case 0x00FC:
+                    OP_00FC();
+                    break;
+
+                case 0x00FD:
+                    OP_00FD();
+                    break;
+
+                case 0x00FE:
+                    OP_00FE();
+                    break;
+
+                case 0x00FF:
+                    OP_00FF();
+                    break;
+
+                // Anything else is 0NNN, a machine code call on the original hardware, and is ignored
             }
         break;
 
@@ -109,7 +567,23 @@ void Chip8::emulate_cycle() {
             break;
 
         case 0x5000:
-            OP_5XY0();
+            switch (opcode & 0x000F) {
+                case 0x0000:
+                    OP_5XY0();
+                    break;
+
+                case 0x0002:
+                    OP_5XY2();
+                    break;
+
+                case 0x0003:
+                    OP_5XY3();
+                    break;
+
+                default:
+                    OP_illegal();
+                    break;
+            }
             break;
 
         case 0x6000:
@@ -127,15 +601,15 @@ void Chip8::emulate_cycle() {
                     break;
                 
                 case 0x0001:
-                    OP_8XY1();
+                    OP_8XY1<Quirks>();
                     break;
 
                 case 0x0002:
-                    OP_8XY2();
+                    OP_8XY2<Quirks>();
                     break;
 
                 case 0x0003:
-                    OP_8XY3();
+                    OP_8XY3<Quirks>();
                     break;
 
                 case 0x0004:
@@ -147,7 +621,7 @@ void Chip8::emulate_cycle() {
                     break; 
 
                 case 0x0006:
-                    OP_8XY6();
+                    OP_8XY6<Quirks>();
                     break;    
 
                 case 0x0007:
@@ -155,8 +629,12 @@ void Chip8::emulate_cycle() {
                     break;    
 
                 case 0x000E:
-                    OP_8XYE();
-                    break;                       
+                    OP_8XYE<Quirks>();
+                    break;
+
+                default:
+                    OP_illegal();
+                    break;
             }
             break;
 
@@ -169,7 +647,7 @@ void Chip8::emulate_cycle() {
                 break;
 
             case 0xB000:
-                OP_BNNN();
+                OP_BNNN<Quirks>();
                 break;
             
             case 0xC000:
@@ -177,7 +655,7 @@ void Chip8::emulate_cycle() {
                 break;
 
             case 0xD000:
-                OP_DXYN();
+                OP_DXYN<Quirks>();
                 break;
             
             case 0xE000:
@@ -189,11 +667,27 @@ void Chip8::emulate_cycle() {
                     case 0x0A1:
                         OP_EXA1();
                         break;
+
+                    default:
+                        OP_illegal();
+                        break;
                 }
             break;
 
             case 0xF000:
                 switch (opcode & 0x00FF) {
+                    case 0x0000:
+                        if (opcode == 0xF000) {
+                            OP_F000();
+                        } else {
+                            OP_illegal();
+                        }
+                        break;
+
+                    case 0x0001:
+                        OP_FN01();
+                        break;
+
                     case 0x0007:
                         OP_FX07();
                         break;
@@ -218,17 +712,38 @@ void Chip8::emulate_cycle() {
                         OP_FX29();
                         break;
 
+                    case 0x0030:
+                        OP_FX30();
+                        break;
+
                     case 0x0033:
                         OP_FX33();
                         break;
 
                     case 0x0055:
-                        OP_FX55();
+                        OP_FX55<Quirks>();
                         break;    
 
                     case 0x0065:
-                        OP_FX65();
+                        OP_FX65<Quirks>();
                         break;                                                                   
+
+                    case 0x0075:
+                        OP_FX75();
+                        break;
+
+                    case 0x0085:
+                        OP_FX85();
+                        break;
+
+                    // XO-CHIP audio (F002, FX3A) is accepted but not played
+                    case 0x0002:
+                    case 0x003A:
+                        break;
+
+                    default:
+                        OP_illegal();
+                        break;
                 }
             break;
 
@@ -237,28 +752,45 @@ void Chip8::emulate_cycle() {
     }
 }
 
+// Skips the next instruction. F000 NNNN is 4 bytes long, so it is skipped as a whole (XO-CHIP).
+void Chip8::skip_next_instruction() {
+    uint16_t next = memory.read(pc) << 8 | memory.read(pc + 1);
+    pc += (next == 0xF000) ? 4 : 2;
+}
+
 // Returns from a subroutine. 
 void Chip8::OP_00EE() {
-    --sp;
+    sp = (sp - 1) & 0xFu;
     pc = stack[sp];
 }
 
 // Clears the screen.
 void Chip8::OP_OOE0() {
-    memset(display, 0, sizeof(display));
+    display.clear();
 }
 
 // Jumps to address NNN.
 void Chip8::OP_1NNN() {
     uint16_t address = opcode & 0x0FFFu; // Unsigned 0xFFF
+    // Jumping to itself, or back over "FX07; 3XNN", loops until the delay timer changes
+    if (address == pc - 2 || (address == pc - 6 && is_timer_wait(address))) {
+        idle = true;
+    }
     pc = address;
 }
 
+// True if the two instructions at address are "FX07; 3XNN", which only depend on the delay timer
+bool Chip8::is_timer_wait(uint16_t address) const {
+    uint16_t load = memory.read(address) << 8 | memory.read(address + 1);
+    uint16_t test = memory.read(address + 2) << 8 | memory.read(address + 3);
+    return (load & 0xF0FFu) == 0xF007u && (test & 0xF000u) == 0x3000u && ((load ^ test) & 0x0F00u) == 0;
+}
+
 // Calls subroutine at NNN.
 void Chip8::OP_2NNN() {
-    uint16_t subroutine_address = pc & 0x0FFFu;
+    uint16_t subroutine_address = opcode & 0x0FFFu;
     stack[sp] = pc;
-    ++sp;
+    sp = (sp + 1) & 0xFu;
     pc = subroutine_address;
 }
 
@@ -267,7 +799,7 @@ void Chip8::OP_3XNN() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u; // Left shift (Example: 0xF00 => 0x00F)
     uint8_t NN = opcode & 0x00FFu;
     if (registers[VX] == NN) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
@@ -276,7 +808,7 @@ void Chip8::OP_4XNN() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t NN = opcode & 0x00FFu;
     if (registers[VX] != NN) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
@@ -285,7 +817,7 @@ void Chip8::OP_5XY0() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t VY = (opcode & 0x00F0u) >> 4u;
     if (registers[VX] == registers[VY]) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
@@ -311,24 +843,36 @@ void Chip8::OP_8XY0() {
 }
 
 // Sets VX to VX or VY. (Bitwise OR operation);
+template <typename Quirks>
 void Chip8::OP_8XY1() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t VY = (opcode & 0x00F0u) >> 4u;
     registers[VX] |= registers[VY];
+    if (Quirks::logic_resets_vf) {
+        registers[0xF] = 0;
+    }
 }
 
 // Sets VX to VX and VY. (Bitwise AND operation);
+template <typename Quirks>
 void Chip8::OP_8XY2() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t VY = (opcode & 0x00F0u) >> 4u;
     registers[VX] &= registers[VY];
+    if (Quirks::logic_resets_vf) {
+        registers[0xF] = 0;
+    }
 }
 
 // Sets VX to VX xor VY.
+template <typename Quirks>
 void Chip8::OP_8XY3() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t VY = (opcode & 0x00F0u) >> 4u;
     registers[VX] ^= registers[VY];
+    if (Quirks::logic_resets_vf) {
+        registers[0xF] = 0;
+    }
 }
 
 // Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there is not.
@@ -360,13 +904,17 @@ void Chip8::OP_8XY5() {
     registers[VX] -= registers[VY];
 }
 
-// Stores the least significant bit of VX in VF and then shifts VX to the right by 1
+// Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
+// With the shift_uses_vy quirk VY is shifted into VX instead (COSMAC VIP).
+template <typename Quirks>
 void Chip8::OP_8XY6() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    uint8_t VY = (opcode & 0x00F0u) >> 4u;
+    uint8_t value = Quirks::shift_uses_vy ? registers[VY] : registers[VX];
 
     // Example: 0000 1101 & 0000 0001 = 0000 0001
-    registers[0xF] = registers[VX] & 0x1u;
-    registers[VX] >>= 1;
+    registers[VX] = value >> 1;
+    registers[0xF] = value & 0x1u;
 }
 
 // Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there is not.
@@ -383,12 +931,16 @@ void Chip8::OP_8XY7() {
 }
 
 // Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-// todo: Write unit test for this
+// With the shift_uses_vy quirk VY is shifted into VX instead (COSMAC VIP).
+// Both variants are covered by test_shift_quirks in tests/assertions.cpp.
+template <typename Quirks>
 void Chip8::OP_8XYE() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    uint8_t VY = (opcode & 0x00F0u) >> 4u;
+    uint8_t value = Quirks::shift_uses_vy ? registers[VY] : registers[VX];
 
-    registers[0xF] = (registers[VX] & 0x80) >> 7u;
-    registers[VX] <<= 1;
+    registers[VX] = value << 1;
+    registers[0xF] = (value & 0x80) >> 7u;
 }
 
 // Skips the next instruction if VX does not equal VY. (Usually the next instruction is a jump to skip a code block);
@@ -397,7 +949,7 @@ void Chip8::OP_9XY0() {
     uint8_t VY = (opcode & 0x00F0u) >> 4u;
 
     if (registers[VX] != registers[VY]) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
@@ -407,10 +959,12 @@ void Chip8::OP_ANNN() {
     index = address;
 }
 
-// Jumps to the address NNN plus V0.
+// Jumps to the address NNN plus V0. With the jump_uses_vx quirk it jumps to XNN plus VX (SUPER-CHIP).
+template <typename Quirks>
 void Chip8::OP_BNNN() {
     uint16_t address = opcode & 0x0FFFu;
-    pc = registers[0] + address;
+    uint8_t offset_register = Quirks::jump_uses_vx ? (opcode & 0x0F00u) >> 8u : 0;
+    pc = registers[offset_register] + address;
 }
 
 // Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
@@ -420,50 +974,74 @@ void Chip8::OP_CXNN() {
 	registers[Vx] = randByte(randGen) & byte;
 }
 
-// Draw(Vx, Vy, N)	
+// Draw(Vx, Vy, N). DXY0 draws a 16x16 sprite (SUPER-CHIP), stored as two bytes per row, or nothing without
+// large_sprites.
+// Each selected plane is drawn in turn, the sprite data for plane 1 follows the data for plane 0 (XO-CHIP).
+// VF is set to 1 if any screen pixel is switched off (collision).
+// The start position always wraps, the sprite itself wraps or is clipped at the edges depending on clip_sprites.
+template <typename Quirks>
 void Chip8::OP_DXYN() {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-	uint8_t height = opcode & 0x000Fu;
-	// Wrap if going beyond screen boundaries
-	uint8_t x_pos = registers[Vx] % 64;
-	uint8_t y_pos = registers[Vy] % 32;
-	registers[0xF] = 0;
-	for (unsigned int row = 0; row < height; ++row) {
-		uint8_t sprite_byte = memory[index + row];
-		for (unsigned int col = 0; col < 8; ++col) {
-			uint8_t sprite_pixel = sprite_byte & (0x80u >> col);
-			uint32_t* screen_pixel = &display[(y_pos + row) * 64 + (x_pos + col)];
-			// Sprite pixel is on
-			if (sprite_pixel) {
-				// Screen pixel also on - collision
-				if (*screen_pixel == 0xFFFFFFFF) {
-					registers[0xF] = 1;
-				}
-				// Effectively XOR with the sprite pixel
-				*screen_pixel ^= 0xFFFFFFFF;
-			}
-		}
-	}
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    uint8_t height = opcode & 0x000Fu;
+    // Wrap if going beyond screen boundaries
+    int x_pos = registers[Vx] % display.width;
+    int y_pos = registers[Vy] % display.height;
+    registers[0xF] = 0;
+
+    int sprite_width = 8;
+    if (height == 0) {
+        if (!Quirks::large_sprites) {
+            return;
+        }
+        sprite_width = 16;
+        height = 16;
+    }
+    int planes = (display.plane_mask & 1) + (display.plane_mask >> 1 & 1);
+    watch_read(index, planes * height * sprite_width / 8);
+
+    uint16_t address = index;
+    for (int plane = 0; plane < Display::PLANES; ++plane) {
+        if (!(display.plane_mask & (1u << plane))) {
+            continue;
+        }
+        for (unsigned int row = 0; row < height; ++row) {
+            // XOR the whole sprite row into the packed row at once
+            uint16_t sprite_bits = memory.read(address++);
+            if (sprite_width == 16) {
+                sprite_bits = sprite_bits << 8 | memory.read(address++);
+            }
+            int y = y_pos + row;
+            if (y >= display.height) {
+                if (Quirks::clip_sprites) {
+                    continue;
+                }
+                y -= display.height;
+            }
+            if (display.draw_sprite_row(plane, x_pos, y, sprite_bits, sprite_width, !Quirks::clip_sprites)) {
+                registers[0xF] = 1;
+            }
+        }
+    }
 }
 
 // Skips the next instruction if the key stored in VX is pressed. (Usually the next instruction is a jump to skip a code block);
 void Chip8::OP_EX9E() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
-    uint8_t key = registers[VX];
+    uint8_t key = registers[VX] & 0xFu;  // Only the low nibble selects a key, like the JIT and the COSMAC VIP
 
     if (keypad[key] == 1) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
 // Skips the next instruction if the key stored in VX is not pressed. (Usually the next instruction is a jump to skip a code block);
 void Chip8::OP_EXA1() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
-    uint8_t key = registers[VX];
+    uint8_t key = registers[VX] & 0xFu;
 
     if (keypad[key] != 1) {
-        pc += 2;
+        skip_next_instruction();
     }
 }
 
@@ -474,15 +1052,11 @@ void Chip8::OP_FX07() {
 }
 
 // A key press is awaited, and then stored in VX. (Blocking Operation. All instruction halted until next key event);
+// Like the COSMAC VIP the key is taken when it is released. key_event() ends the wait.
 void Chip8::OP_FX0A() {
-    uint8_t VX = (opcode & 0x0F00u) >> 8u;
-
-    for (int i = 0; i < 16; ++i) {
-        if (keypad[i] == 1) {
-            registers[VX] = keypad[i];
-            pc += 2;
-        }
-    }
+    key_register = (opcode & 0x0F00u) >> 8u;
+    waiting_for_key = true;
+    idle = true;
 }
 
 // Sets the delay timer to VX.
@@ -504,10 +1078,9 @@ void Chip8::OP_FX1E() {
 }
 
 // Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-// todo: check whether to use VX or registers[VX]
 void Chip8::OP_FX29() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
-    index = memory[FONTSET_START_ADDRESS + 5 * VX];
+    index = FONTSET_START_ADDRESS + 5 * (registers[VX] & 0xFu);
 }
 
 // Stores the binary-coded decimal representation of VX, with the most significant of three digits 
@@ -517,41 +1090,336 @@ void Chip8::OP_FX29() {
 void Chip8::OP_FX33() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     uint8_t value = registers[VX];
-
+    watch_write(index, 3);
 
     // Least-significant bit
-    memory[index + 2] = value % 10;
+    write_memory(index + 2, value % 10);
     value /= 10;
 
     // Middle
-    memory[index + 1] = value % 10;
+    write_memory(index + 1, value % 10);
     value /= 10;
 
     // Most-significant-bit
-    memory[index] = value; 
+    write_memory(index, value);
 }
 
 // Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 
-// for each value written, but I itself is left unmodified.
+// for each value written, but I itself is left unmodified (unless load_store_increments_i, then I ends at I + X + 1).
+template <typename Quirks>
 void Chip8::OP_FX55() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    watch_write(index, VX + 1);
     for (uint8_t i = 0; i <= VX; ++i) {
-        memory[index + i] = registers[i];
+        write_memory(index + i, registers[i]);
+    }
+    if (Quirks::load_store_increments_i) {
+        index += VX + 1;
     }
 }
 
 // Fills V0 to VX (including VX) with values from memory starting at address I. 
 // The offset from I is increased by 1 for each value written, but I itself is left unmodified
+// (unless load_store_increments_i, then I ends at I + X + 1).
+template <typename Quirks>
 void Chip8::OP_FX65() {
+    uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    watch_read(index, VX + 1);
+    for (uint8_t i = 0; i <= VX; ++i) {
+        registers[i] = memory.read(index + i);
+    }
+    if (Quirks::load_store_increments_i) {
+        index += VX + 1;
+    }
+}
+
+// Scrolls the display down by N pixels. (SUPER-CHIP);
+void Chip8::OP_00CN() {
+    uint8_t N = opcode & 0x000Fu;
+    display.scroll_down(N);
+}
+
+// Scrolls the display right by 4 pixels. (SUPER-CHIP);
+void Chip8::OP_00FB() {
+    display.scroll_right(4);
+}
+
+// Scrolls the display left by 4 pixels. (SUPER-CHIP);
+void Chip8::OP_00FC() {
+    display.scroll_left(4);
+}
+
+// Exits the interpreter. (SUPER-CHIP);
+void Chip8::OP_00FD() {
+    exited = true;
+    pc -= 2;
+}
+
+// Not an instruction of any CHIP-8 variant. Stops the machine with pc on the opcode.
+void Chip8::OP_illegal() {
+    exited = true;
+    illegal_opcode = true;
+    pc -= 2;
+}
+
+// Switches to lo-res 64x32 mode. (SUPER-CHIP);
+void Chip8::OP_00FE() {
+    display.set_hires(false);
+}
+
+// Switches to hi-res 128x64 mode. (SUPER-CHIP);
+void Chip8::OP_00FF() {
+    display.set_hires(true);
+}
+
+// Sets I to the location of the 8x10 sprite for the digit in VX. (SUPER-CHIP);
+void Chip8::OP_FX30() {
+    uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    index = BIG_FONTSET_START_ADDRESS + 10 * (registers[VX] & 0xFu);
+}
+
+// Stores V0 to VX (including VX) in the RPL user flags. (SUPER-CHIP);
+void Chip8::OP_FX75() {
+    uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    for (uint8_t i = 0; i <= VX; ++i) {
+        rpl_flags[i] = registers[i];
+    }
+}
+
+// Fills V0 to VX (including VX) from the RPL user flags. (SUPER-CHIP);
+void Chip8::OP_FX85() {
     uint8_t VX = (opcode & 0x0F00u) >> 8u;
     for (uint8_t i = 0; i <= VX; ++i) {
-        registers[i] = memory[index + 1];
+        registers[i] = rpl_flags[i];
     }
 }
 
+// Scrolls the selected planes up by N pixels. (XO-CHIP);
+void Chip8::OP_00DN() {
+    uint8_t N = opcode & 0x000Fu;
+    display.scroll_up(N);
+}
 
+// Stores VX to VY (in either order) in memory starting at address I. I is left unmodified. (XO-CHIP);
+void Chip8::OP_5XY2() {
+    uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    uint8_t VY = (opcode & 0x00F0u) >> 4u;
+    int step = VX <= VY ? 1 : -1;
+    watch_write(index, (VX <= VY ? VY - VX : VX - VY) + 1);
+    uint16_t address = index;
+    for (int i = VX; ; i += step) {
+        write_memory(address++, registers[i]);
+        if (i == VY) {
+            break;
+        }
+    }
+}
 
+// Fills VX to VY (in either order) with values from memory starting at address I. I is left unmodified. (XO-CHIP);
+void Chip8::OP_5XY3() {
+    uint8_t VX = (opcode & 0x0F00u) >> 8u;
+    uint8_t VY = (opcode & 0x00F0u) >> 4u;
+    int step = VX <= VY ? 1 : -1;
+    watch_read(index, (VX <= VY ? VY - VX : VX - VY) + 1);
+    uint16_t address = index;
+    for (int i = VX; ; i += step) {
+        registers[i] = memory.read(address++);
+        if (i == VY) {
+            break;
+        }
+    }
+}
 
+// Sets I to the 16-bit address NNNN stored in the next two bytes. (XO-CHIP);
+void Chip8::OP_F000() {
+    index = memory.read(pc) << 8 | memory.read(pc + 1);
+    pc += 2;
+}
 
+// Selects the bit planes (N = 0 to 3) used by drawing, clearing and scrolling. (XO-CHIP);
+void Chip8::OP_FN01() {
+    uint8_t N = (opcode & 0x0F00u) >> 8u;
+    display.plane_mask = N & 0x3u;
+}
 
+// Predecoder. Kept in this file so the handlers can be inlined into the dispatch functions.
 
+// Handlers are plain functions, each one calls the opcode's member function directly so it can be inlined
+template <void (Chip8::*Handler)()>
+static void single(Chip8 &chip8, const DecodedOp &) {
+    (chip8.*Handler)();
+}
+
+// Runs both instructions of a superinstruction. pc is already past the first one.
+template <void (Chip8::*First)(), void (Chip8::*Second)()>
+static void fused(Chip8 &chip8, const DecodedOp &op) {
+    (chip8.*First)();
+    chip8.opcode = op.next_opcode;
+    chip8.pc += 2;
+    (chip8.*Second)();
+}
+
+// 0NNN and XO-CHIP audio are skipped, like in Chip8::execute()
+static void nop(Chip8 &, const DecodedOp &) {
+}
+
+// Handler for every OpKind, in the same order
+template <typename Quirks>
+const OpHandler HandlerTable<Quirks>::handlers[OP_KIND_COUNT] = {
+    nop, single<&Chip8::OP_illegal>,
+    single<&Chip8::OP_OOE0>, single<&Chip8::OP_00EE>, single<&Chip8::OP_00CN>, single<&Chip8::OP_00DN>,
+    single<&Chip8::OP_00FB>, single<&Chip8::OP_00FC>, single<&Chip8::OP_00FD>, single<&Chip8::OP_00FE>,
+    single<&Chip8::OP_00FF>,
+    single<&Chip8::OP_1NNN>, single<&Chip8::OP_2NNN>, single<&Chip8::OP_3XNN>, single<&Chip8::OP_4XNN>,
+    single<&Chip8::OP_5XY0>, single<&Chip8::OP_5XY2>, single<&Chip8::OP_5XY3>,
+    single<&Chip8::OP_6XNN>, single<&Chip8::OP_7XNN>,
+    single<&Chip8::OP_8XY0>, single<&Chip8::OP_8XY1<Quirks> >, single<&Chip8::OP_8XY2<Quirks> >,
+    single<&Chip8::OP_8XY3<Quirks> >, single<&Chip8::OP_8XY4>, single<&Chip8::OP_8XY5>,
+    single<&Chip8::OP_8XY6<Quirks> >, single<&Chip8::OP_8XY7>, single<&Chip8::OP_8XYE<Quirks> >,
+    single<&Chip8::OP_9XY0>, single<&Chip8::OP_ANNN>, single<&Chip8::OP_BNNN<Quirks> >, single<&Chip8::OP_CXNN>,
+    single<&Chip8::OP_DXYN<Quirks> >, single<&Chip8::OP_EX9E>, single<&Chip8::OP_EXA1>,
+    single<&Chip8::OP_F000>, single<&Chip8::OP_FN01>, single<&Chip8::OP_FX07>, single<&Chip8::OP_FX0A>,
+    single<&Chip8::OP_FX15>, single<&Chip8::OP_FX18>, single<&Chip8::OP_FX1E>, single<&Chip8::OP_FX29>,
+    single<&Chip8::OP_FX30>, single<&Chip8::OP_FX33>, single<&Chip8::OP_FX55<Quirks> >,
+    single<&Chip8::OP_FX65<Quirks> >, single<&Chip8::OP_FX75>, single<&Chip8::OP_FX85>,
+    single<&Chip8::hit_breakpoint>,
+};
+
+// Only first instructions that can't jump, wait or write memory are fused, so the second one always runs
+// right after and its cached opcode can't go stale in between
+template <typename Quirks>
+static Fusion find_fusion(uint16_t first, uint16_t second, OpHandler &handler) {
+    if ((first & 0xF000) == 0xA000 && (second & 0xF000) == 0xD000) {
+        handler = fused<&Chip8::OP_ANNN, &Chip8::OP_DXYN<Quirks> >;
+        return Fusion::LoadIndexDraw;
+    }
+    if ((first & 0xF000) == 0x6000 && (second & 0xF000) == 0x6000) {
+        handler = fused<&Chip8::OP_6XNN, &Chip8::OP_6XNN>;
+        return Fusion::LoadLoad;
+    }
+    if ((first & 0xF000) == 0x7000 && (second & 0xF000) == 0x3000) {
+        handler = fused<&Chip8::OP_7XNN, &Chip8::OP_3XNN>;
+        return Fusion::AddSkip;
+    }
+    if ((first & 0xF0FF) == 0xF007 && (second & 0xF000) == 0x3000) {
+        handler = fused<&Chip8::OP_FX07, &Chip8::OP_3XNN>;
+        return Fusion::TimerSkip;
+    }
+    return Fusion::None;
+}
+
+template <typename Quirks>
+void Predecoder::decode(const Memory &memory, uint32_t address, DecodedOp &op) {
+    op.opcode = memory.read(address) << 8 | memory.read(address + 1);
+    op.next_opcode = 0;
+    op.kind = classify_opcode(op.opcode);
+    op.fusion = Fusion::None;
+    op.handler = HandlerTable<Quirks>::handlers[static_cast<int>(op.kind)];
+
+#if CHIP8_SUPERINSTRUCTIONS
+    uint16_t next = memory.read(address + 2) << 8 | memory.read(address + 3);
+    OpHandler handler;
+    Fusion fusion = find_fusion<Quirks>(op.opcode, next, handler);
+    if (fusion != Fusion::None) {
+        op.handler = handler;
+        op.next_opcode = next;
+        op.fusion = fusion;
+    }
+#endif
+}
+
+// Direct-threaded interpreter over the predecoded instructions. Every handler ends with its own copy of the
+// dispatch (an indirect jump through the label table), so the branch predictor learns which instruction
+// usually follows which instead of sharing one jump for all of them. Superinstructions are not used here,
+// each instruction is one dispatch.
+template <typename Quirks>
+int Chip8::run_threaded(int budget) {
+#if CHIP8_THREADED
+    // Same order as OpKind
+    static void *const labels[OP_KIND_COUNT] = {
+        &&op_nop, &&op_illegal,
+        &&op_00E0, &&op_00EE, &&op_00CN, &&op_00DN, &&op_00FB, &&op_00FC, &&op_00FD, &&op_00FE, &&op_00FF,
+        &&op_1NNN, &&op_2NNN, &&op_3XNN, &&op_4XNN, &&op_5XY0, &&op_5XY2, &&op_5XY3, &&op_6XNN, &&op_7XNN,
+        &&op_8XY0, &&op_8XY1, &&op_8XY2, &&op_8XY3, &&op_8XY4, &&op_8XY5, &&op_8XY6, &&op_8XY7, &&op_8XYE,
+        &&op_9XY0, &&op_ANNN, &&op_BNNN, &&op_CXNN, &&op_DXYN, &&op_EX9E, &&op_EXA1,
+        &&op_F000, &&op_FN01, &&op_FX07, &&op_FX0A, &&op_FX15, &&op_FX18, &&op_FX1E, &&op_FX29, &&op_FX30,
+        &&op_FX33, &&op_FX55, &&op_FX65, &&op_FX75, &&op_FX85,
+        &&op_breakpoint,
+    };
+
+    int executed = 0;
+    const DecodedOp *op;
+
+#define DISPATCH()                                      \
+    if (executed == budget || exited || idle) {         \
+        return executed;                                \
+    }                                                   \
+    op = &predecoded.entry(pc);                         \
+    if (op->handler == nullptr) {                       \
+        op = &decode(pc);                               \
+    }                                                   \
+    opcode = op->opcode;                                \
+    pc += 2;                                            \
+    ++executed;                                         \
+    goto *labels[static_cast<int>(op->kind)]
+
+    DISPATCH();
+
+    op_nop:  DISPATCH();
+    op_illegal: OP_illegal(); DISPATCH();
+    op_00E0: OP_OOE0(); DISPATCH();
+    op_00EE: OP_00EE(); DISPATCH();
+    op_00CN: OP_00CN(); DISPATCH();
+    op_00DN: OP_00DN(); DISPATCH();
+    op_00FB: OP_00FB(); DISPATCH();
+    op_00FC: OP_00FC(); DISPATCH();
+    op_00FD: OP_00FD(); DISPATCH();
+    op_00FE: OP_00FE(); DISPATCH();
+    op_00FF: OP_00FF(); DISPATCH();
+    op_1NNN: OP_1NNN(); DISPATCH();
+    op_2NNN: OP_2NNN(); DISPATCH();
+    op_3XNN: OP_3XNN(); DISPATCH();
+    op_4XNN: OP_4XNN(); DISPATCH();
+    op_5XY0: OP_5XY0(); DISPATCH();
+    op_5XY2: OP_5XY2(); DISPATCH();
+    op_5XY3: OP_5XY3(); DISPATCH();
+    op_6XNN: OP_6XNN(); DISPATCH();
+    op_7XNN: OP_7XNN(); DISPATCH();
+    op_8XY0: OP_8XY0(); DISPATCH();
+    op_8XY1: OP_8XY1<Quirks>(); DISPATCH();
+    op_8XY2: OP_8XY2<Quirks>(); DISPATCH();
+    op_8XY3: OP_8XY3<Quirks>(); DISPATCH();
+    op_8XY4: OP_8XY4(); DISPATCH();
+    op_8XY5: OP_8XY5(); DISPATCH();
+    op_8XY6: OP_8XY6<Quirks>(); DISPATCH();
+    op_8XY7: OP_8XY7(); DISPATCH();
+    op_8XYE: OP_8XYE<Quirks>(); DISPATCH();
+    op_9XY0: OP_9XY0(); DISPATCH();
+    op_ANNN: OP_ANNN(); DISPATCH();
+    op_BNNN: OP_BNNN<Quirks>(); DISPATCH();
+    op_CXNN: OP_CXNN(); DISPATCH();
+    op_DXYN: OP_DXYN<Quirks>(); DISPATCH();
+    op_EX9E: OP_EX9E(); DISPATCH();
+    op_EXA1: OP_EXA1(); DISPATCH();
+    op_F000: OP_F000(); DISPATCH();
+    op_FN01: OP_FN01(); DISPATCH();
+    op_FX07: OP_FX07(); DISPATCH();
+    op_FX0A: OP_FX0A(); DISPATCH();
+    op_FX15: OP_FX15(); DISPATCH();
+    op_FX18: OP_FX18(); DISPATCH();
+    op_FX1E: OP_FX1E(); DISPATCH();
+    op_FX29: OP_FX29(); DISPATCH();
+    op_FX30: OP_FX30(); DISPATCH();
+    op_FX33: OP_FX33(); DISPATCH();
+    op_FX55: OP_FX55<Quirks>(); DISPATCH();
+    op_FX65: OP_FX65<Quirks>(); DISPATCH();
+    op_FX75: OP_FX75(); DISPATCH();
+    op_FX85: OP_FX85(); DISPATCH();
+    // Doesn't count as an instruction
+    op_breakpoint: hit_breakpoint(); return executed - 1;
+
+#undef DISPATCH
+#else
+    return run_predecoded<false>(budget);
+#endif
+}
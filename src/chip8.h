@@ -1,23 +1,100 @@
+#pragma once
+
 #include <cstdint>
 #include <random>
 #include <fstream>
+#include <vector>
+#include "debug.h"
+#include "display.h"
+#include "jit.h"
+#include "memory.h"
+#include "predecode.h"
+#include "quirks.h"
+
+// Why a run_cycles(), run_frames() or run_until() call returned
+enum class StopReason {
+    BudgetExhausted,  // Ran all the instructions it was allowed to
+    FrameCompleted,   // Ran all the frames it was asked to
+    TimerWait,        // The ROM spins until the next timer tick, which only run_frames() advances
+    WaitingForKey,    // Blocked on FX0A until key_event() releases a key
+    Exited,           // 00FD
+    Breakpoint,       // pc is on a breakpoint, the instruction there hasn't run
+    Watchpoint,       // The last instruction read or wrote a watched byte
+    IllegalOpcode,    // pc is on an opcode no CHIP-8 variant defines
+    Predicate         // run_until()'s predicate returned true
+};
+
+struct RunResult {
+    StopReason reason;
+    uint64_t instructions; // Executed by this call
+    uint64_t frames;       // Completed by this call (run_frames() only)
+};
+
+// The machine state run_frames() depends on, for rewinding. Memory only holds the pages written since the ROM
+// was loaded, the quirk profile and the ROM itself are not included.
+struct Snapshot {
+    uint8_t registers[16];
+    uint16_t index;
+    uint16_t pc;
+    uint16_t stack[16];
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t keypad[16];
+    uint8_t rpl_flags[16];
+    Display display;
+    bool exited;
+    bool illegal_opcode;
+    bool waiting_for_key;
+    uint8_t key_register;
+    int frame_instructions;
+    std::default_random_engine random;
+    std::uniform_int_distribution<uint8_t> random_byte;
+    std::vector<uint16_t> pages;  // Numbers of the written pages
+    std::vector<uint8_t> bytes;   // Their contents, Memory::PAGE_SIZE bytes each
+};
 
 class Chip8 {
     public:
-        uint8_t memory[4096]; // 4K memory (1 byte = 8 bit)
+        Memory memory; // 4K memory, 64K for XO-CHIP. Copy-on-write view of a shared ROM image
         uint8_t registers[16]; // V0 to VF
         uint16_t index; // Index register
         uint16_t pc; // Program counter
         uint16_t stack[16]; // 16-level stack
-        uint8_t sp; // Stack pointer
+        uint8_t sp; // Stack pointer, wraps around at 16 so runaway recursion stays inside the stack
         uint8_t delay_timer;
         uint8_t sound_timer;
 
         // Keypad (16 keys ranging from 0 to F)
         uint8_t keypad[16];
 
-        // Display
-        uint32_t display[64*32];
+        // Display (64x32, or 128x64 in SUPER-CHIP hi-res mode) with two XO-CHIP bit planes
+        Display display;
+
+        // SUPER-CHIP RPL user flags (FX75/FX85)
+        uint8_t rpl_flags[16];
+
+        // Set by 00FD or an illegal opcode, the frontend should stop running the ROM
+        bool exited;
+        bool illegal_opcode;
+
+        // Set when the ROM spins until the next timer tick (an FX07/3XNN/1NNN delay loop, or a jump to itself) or
+        // blocks on FX0A. Nothing changes before then, so run loops can end the frame early. Cleared by the caller.
+        bool idle;
+
+        // Set by FX0A until a key is released, see key_event(). No instructions should be run while it is set,
+        // timers keep ticking.
+        bool waiting_for_key;
+        uint8_t key_register; // X of the FX0A being waited on
+
+        // Active quirk profile, change it with set_quirks(). CHIP-8 until then, init() keeps it.
+        QuirkProfile quirks;
+
+        // Instructions per 60 Hz frame for run_frames()
+        int cycles_per_frame;
+
+        // Hash of the loaded ROM, used to look it up in the ROM database
+        uint64_t rom_hash;
 
         // 16bit opcode (First instruction in 1byte + Second instruction in 1byte)
         uint16_t opcode;
@@ -25,12 +102,164 @@ class Chip8 {
         std::default_random_engine randGen;
         std::uniform_int_distribution<uint8_t> randByte;
 
+        // Loop used by run_instructions()
+        Interpreter interpreter;
+
+        // Instruction counts gathered by run_instructions() while profiling is set, and memory accesses by address.
+        // Profiling always runs the predecoded interpreter.
+        bool profiling;
+        uint64_t opcode_counts[16]; // By the first nibble of the opcode
+        uint64_t fusion_counts[FUSION_COUNT];
+        AccessCounts access_counts;
+
+        // Bytes run as instructions, and read as data by DXYN, FX65 and 5XY3, while coverage is on. The
+        // interpreters mark an instruction when they decode it, so covered code runs at full speed. The block JIT
+        // gives way to the predecoded interpreter meanwhile.
+        AddressBitmap code_coverage;
+        AddressBitmap data_coverage;
+
+        // Set when a run stops on a breakpoint. The next run starts by running the instruction under it.
+        bool breakpoint_hit;
+        // Set when a run stops after an access to a watched byte, until the next run
+        bool watchpoint_hit;
+        uint32_t watch_address;  // First watched byte the instruction accessed
+        bool watch_was_write;
+
+        // Run so far of the frame run_frames() was stopped in by a breakpoint or watchpoint, or a single step
+        int frame_instructions;
+
         Chip8();
+        // Resets the machine for a new run, keeping the quirk profile, interpreter and RPL flags
         void init();
-        void load_rom(char const *file_path);
+
+        // Load a ROM at 0x200. Fails (leaving memory untouched) if the file can't be read or the ROM doesn't fit
+        // in the memory of the active quirk profile, so set the profile first.
+        bool load_rom(char const *file_path);
+        bool load_rom(const uint8_t *data, size_t size);
+        bool load_rom(std::shared_ptr<const RomImage> image);
+        uint32_t max_rom_size() const;
+
+        // Bytes used by this instance: the object, the memory overlay and the decoded instruction and block tables.
+        // Profiling and debugging tables are not counted, nor the shared ROM image.
+        size_t allocated_bytes() const {
+            return sizeof(Chip8) + memory.allocated_bytes() + predecoded.allocated_bytes() + jit.allocated_bytes();
+        }
+
+        void set_quirks(QuirkProfile profile);
+
+        // Presses or releases a key. Releasing a held key ends an FX0A wait and stores the key in VX.
+        // Keys above F don't exist and are ignored.
+        void key_event(uint8_t key, bool pressed);
+
+        // Fetches, decodes and executes a single instruction
         void emulate_cycle();
 
-        // Opcodes (35 total)
+        // Runs up to budget instructions from the predecoded cache, stopping early when the ROM exits or idles
+        // (idle is reset first). Returns the number of instructions executed, a superinstruction counts as two.
+        int run_instructions(int budget);
+
+        // Run API for embedders: the loops run inside the core and say why they stopped.
+        // run_cycles() runs instructions without ticking the timers and stops at a timer wait.
+        // run_frames() runs cycles_per_frame instructions and ticks the timers per frame, idle frames end early.
+        // It stops after a frame in which the ROM starts waiting for a key. A breakpoint or watchpoint stops it in
+        // the middle of a frame, the next call finishes that frame first.
+        RunResult run_cycles(uint64_t cycles);
+        RunResult run_frames(uint64_t frames);
+
+        // Runs one instruction at a time until done(const Chip8 &) returns true before an instruction, or
+        // max_instructions ran. Timers don't tick.
+        template <typename Predicate>
+        RunResult run_until(Predicate done, uint64_t max_instructions) {
+            RunResult result = { StopReason::BudgetExhausted, 0, 0 };
+            while (result.instructions < max_instructions) {
+                if (done(static_cast<const Chip8 &>(*this))) {
+                    result.reason = StopReason::Predicate;
+                    break;
+                }
+                if (run_instructions(1) == 0) {
+                    result.reason = stop_reason();
+                    break;
+                }
+                ++result.instructions;
+                if (watchpoint_hit) {
+                    result.reason = StopReason::Watchpoint;
+                    break;
+                }
+            }
+            return result;
+        }
+
+        // Why run_instructions() stopped before its budget
+        StopReason stop_reason() const;
+
+        // Debugger. Breakpoints are patched into the predecoded instructions (and the JIT steps aside while any
+        // breakpoint or watchpoint is set), so the interpreter loops don't check for them. Only the Switch
+        // interpreter tests the breakpoint bitmap per instruction. Watchpoints are checked by the instructions that
+        // access memory through I, so nothing else pays for them. Both survive init() and load_rom().
+        void set_breakpoint(uint16_t address);
+        void clear_breakpoint(uint16_t address);
+        bool has_breakpoint(uint16_t address) const { return breakpoints.test(address); }
+        bool has_watchpoint(uint32_t address, int kind) const {
+            return (kind == WATCH_READ ? read_watches : write_watches).test(address);
+        }
+        void set_watchpoint(uint32_t address, uint32_t length, int kinds);    // kinds is a WatchKind mask
+        void clear_watchpoint(uint32_t address, uint32_t length, int kinds);
+        void clear_debug_points();
+        bool debugging() const { return !breakpoints.empty() || !read_watches.empty() || !write_watches.empty(); }
+
+        // Starts or stops gathering code_coverage and data_coverage, which are kept until cleared. Starting drops the
+        // decoded instructions so every instruction is decoded (and marked) again.
+        void set_coverage(bool enabled);
+        bool coverage() const { return coverage_enabled; }
+
+        // Restoring drops the decoded instructions and compiled blocks. Debug points are kept.
+        void save(Snapshot &snapshot) const;
+        void restore(const Snapshot &snapshot);
+
+        // Memory writes by instructions go through here to keep the predecoded instructions and compiled blocks in
+        // sync
+        void write_memory(uint32_t address, uint8_t value) {
+            memory.write(address, value);
+            predecoded.invalidate(address);
+            jit.invalidate(address);
+        }
+
+        void skip_next_instruction();
+        bool is_timer_wait(uint16_t address) const;
+
+        // Decrements the delay and sound timers, call at 60 Hz
+        void tick_timers();
+
+        // Fetch, decode and execute one instruction with the given quirks resolved at compile time
+        template <typename Quirks> void execute();
+
+        // Predecoder handler of a single instruction for the active quirk profile
+        OpHandler handler(OpKind kind) const { return handler_table[static_cast<int>(kind)]; }
+
+        // Stop the run at a breakpoint (pc is rewound onto it) or after an access to a watched byte. Reads are
+        // also data coverage.
+        void hit_breakpoint();
+        void watch_read(uint32_t address, uint32_t length) {
+            if (coverage_enabled) {
+                cover_data(address, length);
+            }
+            if (profiling) {
+                count_accesses(access_counts.reads, address, length);
+            }
+            if (!read_watches.empty()) {
+                check_watchpoints(read_watches, address, length, false);
+            }
+        }
+        void watch_write(uint32_t address, uint32_t length) {
+            if (profiling) {
+                count_accesses(access_counts.writes, address, length);
+            }
+            if (!write_watches.empty()) {
+                check_watchpoints(write_watches, address, length, true);
+            }
+        }
+
+        // Opcodes
         void OP_OOE0();
         void OP_00EE();
         void OP_1NNN();
@@ -41,19 +270,19 @@ class Chip8 {
         void OP_6XNN();
         void OP_7XNN();
         void OP_8XY0();
-        void OP_8XY1();
-        void OP_8XY2();
-        void OP_8XY3();
+        template <typename Quirks> void OP_8XY1();
+        template <typename Quirks> void OP_8XY2();
+        template <typename Quirks> void OP_8XY3();
         void OP_8XY4();
         void OP_8XY5();
-        void OP_8XY6();
+        template <typename Quirks> void OP_8XY6();
         void OP_8XY7();
-        void OP_8XYE();
+        template <typename Quirks> void OP_8XYE();
         void OP_9XY0();
         void OP_ANNN();
-        void OP_BNNN();
+        template <typename Quirks> void OP_BNNN();
         void OP_CXNN();
-        void OP_DXYN();
+        template <typename Quirks> void OP_DXYN();
         void OP_EX9E();
         void OP_EXA1();
         void OP_FX07();
@@ -63,6 +292,51 @@ class Chip8 {
         void OP_FX1E();
         void OP_FX29();
         void OP_FX33();
-        void OP_FX55();
-        void OP_FX65();
+        template <typename Quirks> void OP_FX55();
+        template <typename Quirks> void OP_FX65();
+
+        // SUPER-CHIP
+        void OP_00CN();
+        void OP_00FB();
+        void OP_00FC();
+        void OP_00FD();
+        void OP_illegal();
+        void OP_00FE();
+        void OP_00FF();
+        void OP_FX30();
+        void OP_FX75();
+        void OP_FX85();
+
+        // XO-CHIP
+        void OP_00DN();
+        void OP_5XY2();
+        void OP_5XY3();
+        void OP_F000();
+        void OP_FN01();
+
+    private:
+        // execute(), the predecoder and the threaded interpreter instantiated for the active quirk profile
+        void (Chip8::*execute_handler)();
+        void (*decode_handler)(const Memory &memory, uint32_t address, DecodedOp &op);
+        int (Chip8::*threaded_handler)(int budget);
+        const OpHandler *handler_table;
+
+        Predecoder predecoded;
+        BlockCache jit;
+
+        AddressBitmap breakpoints;
+        AddressBitmap read_watches;
+        AddressBitmap write_watches;
+        bool coverage_enabled;
+
+        DecodedOp &decode(uint32_t address);  // Returns the entry it decoded into
+        void check_watchpoints(const AddressBitmap &watches, uint32_t address, uint32_t length, bool write);
+        void cover_code(uint32_t address);
+        void cover_data(uint32_t address, uint32_t length);
+        void count_accesses(std::vector<uint32_t> &counts, uint32_t address, uint32_t length);
+        void count_fetch(uint32_t address);
+        void change_watchpoints(uint32_t address, uint32_t length, int kinds, bool set);
+        int dispatch(int budget);
+        template <bool Profiling> int run_predecoded(int budget);
+        template <typename Quirks> int run_threaded(int budget);
 };
\ No newline at end of file
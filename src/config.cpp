@@ -0,0 +1,234 @@
+#include "config.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include "quirk_infer.h"
+#include "rom_db.h"
+
+const char *const CONFIG_USAGE =
+    "[options] <ROM> [chip8|schip|xochip|vip]\n"
+    "  --cycles=<n>         Instructions per frame (60 frames per second)\n"
+    "  --scale=<n>          Window pixels per CHIP-8 pixel (default 10)\n"
+    "  --palette=<name>     mono, green or amber\n"
+    "  --quirks=<profile>   chip8, schip, xochip or vip\n"
+    "  --quirk-cache=<file> Where quirks inferred for unknown ROMs are kept, empty to not keep them\n"
+    "  --blend=<mode>       off, or, phosphor (default)\n"
+    "  --interpreter=<loop> switch, predecoded, threaded (default where supported) or jit\n"
+    "  --headless=<frames>  Run without a window and report cycles per second\n"
+    "  --turbo              Run as fast as possible\n"
+    "  --trace              Print every instruction to stderr\n"
+    "  --profile            Print an instruction count report on exit\n"
+    "  --coverage=<file>    Save the addresses run and read as data on exit, see chip8_disasm --coverage\n"
+    "  --heatmap=<file.bmp> Save a memory access heatmap on exit\n"
+    "  --heatmap-window     Show the memory access heatmap live\n"
+    "  --seed=<n>           Random number seed\n"
+    "  --gdb=<port>         Wait for GDB on 127.0.0.1:<port> (or unix:<path>) and run under its control\n"
+    "  --config=<file>      Read name = value settings from a file\n";
+
+// Same order as PALETTES
+static const char *PALETTE_NAMES[PALETTE_COUNT] = { "mono", "green", "amber" };
+static const char *BLEND_NAMES[] = { "off", "or", "phosphor" };
+static const char *INTERPRETER_NAMES[] = { "switch", "predecoded", "threaded", "jit" };
+
+Config::Config() {
+    cycles_per_frame = 0;
+    scale = 10;
+    palette = -1;
+    has_profile = false;
+    profile = QuirkProfile::Chip8;
+    quirk_cache = default_quirk_cache_path();
+    blend = BlendMode::Phosphor;
+    interpreter = DEFAULT_INTERPRETER;
+    headless_frames = 0;
+    turbo = false;
+    trace = false;
+    profile_opcodes = false;
+    heatmap_window = false;
+    has_seed = false;
+    seed = 0;
+}
+
+static bool parse_number(const std::string &value, long min, long max, long &number) {
+    if (value.empty()) {
+        return false;
+    }
+    char *end;
+    number = std::strtol(value.c_str(), &end, 0);
+    return *end == '\0' && number >= min && number <= max;
+}
+
+// A switch given without a value is turned on
+static bool parse_switch(const std::string &value, bool &on) {
+    if (value.empty() || value == "1" || value == "true" || value == "on" || value == "yes") {
+        on = true;
+    } else if (value == "0" || value == "false" || value == "off" || value == "no") {
+        on = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int find_name(const std::string &value, const char *const *names, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (value == names[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Config files may include others, this deep. Deeper means they include each other.
+static const int MAX_CONFIG_NESTING = 8;
+
+static bool read_config_file(const char *file_path, Config &config, std::string &error, int nesting);
+
+// nesting is the number of config files open around this option
+static bool apply_option(const std::string &name, const std::string &value, Config &config, std::string &error,
+                         int nesting) {
+    long number = 0;
+    bool valid;
+
+    if (name == "rom") {
+        config.rom_path = value;
+        valid = !value.empty();
+    } else if (name == "cycles") {
+        valid = parse_number(value, 1, 1000000, number);
+        config.cycles_per_frame = static_cast<int>(number);
+    } else if (name == "scale") {
+        valid = parse_number(value, 1, 64, number);
+        config.scale = static_cast<int>(number);
+    } else if (name == "palette") {
+        config.palette = find_name(value, PALETTE_NAMES, PALETTE_COUNT);
+        valid = config.palette >= 0;
+    } else if (name == "quirks") {
+        valid = parse_quirk_profile(value.c_str(), config.profile);
+        config.has_profile = valid;
+    } else if (name == "quirk-cache") {
+        config.quirk_cache = value;
+        valid = true;
+    } else if (name == "blend") {
+        int mode = find_name(value, BLEND_NAMES, 3);
+        valid = mode >= 0;
+        config.blend = static_cast<BlendMode>(mode);
+    } else if (name == "interpreter") {
+        int loop = find_name(value, INTERPRETER_NAMES, 4);
+        valid = loop >= 0 && (CHIP8_THREADED || static_cast<Interpreter>(loop) != Interpreter::Threaded);
+        config.interpreter = static_cast<Interpreter>(loop);
+    } else if (name == "headless") {
+        valid = parse_number(value, 1, 0x7FFFFFFF, number);
+        config.headless_frames = number;
+    } else if (name == "turbo") {
+        valid = parse_switch(value, config.turbo);
+    } else if (name == "trace") {
+        valid = parse_switch(value, config.trace);
+    } else if (name == "profile") {
+        valid = parse_switch(value, config.profile_opcodes);
+    } else if (name == "coverage") {
+        config.coverage = value;
+        valid = !value.empty();
+    } else if (name == "heatmap") {
+        config.heatmap = value;
+        valid = !value.empty();
+    } else if (name == "heatmap-window") {
+        valid = parse_switch(value, config.heatmap_window);
+    } else if (name == "seed") {
+        valid = parse_number(value, 0, 0x7FFFFFFF, number);
+        config.seed = static_cast<uint32_t>(number);
+        config.has_seed = valid;
+    } else if (name == "gdb") {
+        config.gdb = value;
+        valid = !value.empty();
+    } else if (name == "config") {
+        return read_config_file(value.c_str(), config, error, nesting + 1);
+    } else {
+        error = "Unknown option: " + name;
+        return false;
+    }
+
+    if (!valid) {
+        error = "Invalid value for " + name + ": " + value;
+    }
+    return valid;
+}
+
+static std::string trim(const std::string &s) {
+    size_t first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+}
+
+bool apply_option(const std::string &name, const std::string &value, Config &config, std::string &error) {
+    return apply_option(name, value, config, error, 0);
+}
+
+static bool read_config_file(const char *file_path, Config &config, std::string &error, int nesting) {
+    if (nesting > MAX_CONFIG_NESTING) {
+        error = std::string("Config files include each other: ") + file_path;
+        return false;
+    }
+    std::ifstream file(file_path);
+    if (!file) {
+        error = std::string("Could not read config file: ") + file_path;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        std::string name = trim(line.substr(0, equals));
+        std::string value = equals == std::string::npos ? "" : trim(line.substr(equals + 1));
+        if (!apply_option(name, value, config, error, nesting)) {
+            error = std::string(file_path) + ":" + std::to_string(line_number) + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_config_file(const char *file_path, Config &config, std::string &error) {
+    return read_config_file(file_path, config, error, 1);
+}
+
+bool parse_command_line(int argc, char *argv[], Config &config, std::string &error) {
+    int positional = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+
+        if (arg.compare(0, 2, "--") == 0) {
+            size_t equals = arg.find('=');
+            std::string name = arg.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+            std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+            if (!apply_option(name, value, config, error)) {
+                return false;
+            }
+        } else if (positional == 0) {
+            config.rom_path = arg;
+            ++positional;
+        } else if (positional == 1) {
+            if (!apply_option("quirks", arg, config, error)) {
+                return false;
+            }
+            ++positional;
+        } else {
+            error = "Unexpected argument: " + arg;
+            return false;
+        }
+    }
+
+    if (config.rom_path.empty()) {
+        error = "No ROM given";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "blender.h"
+#include "predecode.h"
+#include "quirks.h"
+
+// Frontend settings from the command line and an optional config file.
+// Settings left unset fall back to the ROM database entry (or the defaults for unknown ROMs).
+struct Config {
+    std::string rom_path;
+
+    int cycles_per_frame;  // Instructions per 60 Hz frame, 0 = from the ROM database
+    int scale;             // Window pixels per lo-res pixel, hi-res frames are drawn at half of it
+    int palette;           // Index into PALETTES, -1 = from the ROM database
+    bool has_profile;
+    QuirkProfile profile;  // Used if has_profile, otherwise from the ROM database or inferred for unknown ROMs
+    std::string quirk_cache;  // File of the inferred profiles by ROM hash, "" to infer them every time
+    BlendMode blend;
+    Interpreter interpreter;
+
+    long headless_frames;  // Run this many frames without a window and report the speed, 0 = windowed
+    bool turbo;            // Always fast-forward
+    bool trace;            // Print every executed instruction to stderr
+    bool profile_opcodes;  // Count executed instructions and print a report on exit
+    std::string coverage;  // File the run's coverage is saved to on exit, "" = no coverage
+    std::string heatmap;   // BMP file the memory access heatmap is saved to on exit, "" = none
+    bool heatmap_window;   // Show the heatmap live in a second window
+    bool has_seed;
+    uint32_t seed;         // CXNN random seed, used if has_seed, otherwise seeded from the clock
+    std::string gdb;       // Where the GDB stub listens, "<port>" or "unix:<path>", "" = no stub
+
+    Config();
+};
+
+// Command line: [options] <ROM> [chip8|schip|xochip|vip]
+// Every option is --name=value (or --name for switches). --config=<file> reads name = value lines with the
+// same names, # starts a comment, and may include other config files up to 8 deep. Settings are applied in order,
+// so later ones win.
+bool parse_command_line(int argc, char *argv[], Config &config, std::string &error);
+bool load_config_file(const char *file_path, Config &config, std::string &error);
+bool apply_option(const std::string &name, const std::string &value, Config &config, std::string &error);
+
+extern const char *const CONFIG_USAGE;
@@ -0,0 +1,107 @@
+#include "coverage.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Ranges per line, to keep the lines short
+static const int RANGES_PER_LINE = 16;
+
+static void write_ranges(std::ofstream &file, const char *name, const AddressBitmap &bits) {
+    int ranges = 0;
+    char range[24];
+    for (uint32_t address = 0; address < MAX_MEMORY_SIZE; ++address) {
+        if (!bits.test(address)) {
+            continue;
+        }
+        uint32_t last = address;
+        while (last + 1 < MAX_MEMORY_SIZE && bits.test(last + 1)) {
+            ++last;
+        }
+        if (last == address) {
+            std::snprintf(range, sizeof(range), " %x", address);
+        } else {
+            std::snprintf(range, sizeof(range), " %x-%x", address, last);
+        }
+        if (ranges % RANGES_PER_LINE == 0) {
+            file << (ranges == 0 ? "" : "\n") << name;
+        }
+        file << range;
+        ++ranges;
+        address = last;
+    }
+    if (ranges > 0) {
+        file << "\n";
+    }
+}
+
+bool save_coverage(const std::string &path, const RomCoverage &coverage, std::string &error) {
+    std::ofstream file(path);
+    char header[64];
+    std::snprintf(header, sizeof(header), "rom %016llx\nruns %u\n",
+                  static_cast<unsigned long long>(coverage.rom_hash), coverage.runs);
+    file << "# CHIP-8 coverage\n" << header;
+    write_ranges(file, "code", coverage.code);
+    write_ranges(file, "data", coverage.data);
+    if (!file) {
+        error = "Could not write coverage file: " + path;
+        return false;
+    }
+    return true;
+}
+
+bool merge_coverage(const std::string &path, RomCoverage &coverage, std::string &error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "Could not read coverage file: " + path;
+        return false;
+    }
+
+    RomCoverage run;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        std::istringstream words(line);
+        std::string name, word;
+        words >> name;
+        bool valid = true;
+        if (name.empty() || name[0] == '#') {
+            continue;
+        } else if (name == "rom") {
+            unsigned long long hash = 0;
+            valid = static_cast<bool>(words >> word) && std::sscanf(word.c_str(), "%llx", &hash) == 1;
+            run.rom_hash = hash;
+        } else if (name == "runs") {
+            valid = static_cast<bool>(words >> run.runs);
+        } else if (name == "code" || name == "data") {
+            AddressBitmap &bits = name == "code" ? run.code : run.data;
+            while (valid && words >> word) {
+                unsigned first, last;
+                int fields = std::sscanf(word.c_str(), "%x-%x", &first, &last);
+                if (fields == 1) {
+                    last = first;
+                }
+                valid = fields >= 1 && first <= last && last < MAX_MEMORY_SIZE;
+                for (uint32_t address = first; valid && address <= last; ++address) {
+                    bits.set(address);
+                }
+            }
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            error = path + ":" + std::to_string(line_number) + ": Invalid coverage line";
+            return false;
+        }
+    }
+
+    if (coverage.runs > 0 && run.rom_hash != coverage.rom_hash) {
+        error = path + ": Coverage of another ROM";
+        return false;
+    }
+    coverage.rom_hash = run.rom_hash;
+    coverage.runs += run.runs;
+    coverage.code.merge(run.code);
+    coverage.data.merge(run.data);
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "debug.h"
+
+// Coverage of one or more runs of a ROM, as gathered by Chip8::set_coverage(). Runs are saved one file each
+// (the emulator's --coverage option) and merged by chip8_disasm --coverage, which annotates the listing with it.
+struct RomCoverage {
+    uint64_t rom_hash;
+    uint32_t runs;
+    AddressBitmap code;  // Bytes of the instructions that ran
+    AddressBitmap data;  // Bytes read by DXYN, FX65 and 5XY3
+
+    RomCoverage() : rom_hash(0), runs(0) {}
+};
+
+// Text file: the ROM hash, the number of runs, then "code" and "data" lines of hex address ranges, e.g.
+// "code 200-20b 210-213".
+bool save_coverage(const std::string &path, const RomCoverage &coverage, std::string &error);
+
+// Adds the runs in a file to coverage. Fails for a file of another ROM, unless coverage has no runs yet.
+bool merge_coverage(const std::string &path, RomCoverage &coverage, std::string &error);
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "memory.h"
+
+// Watchpoint kinds, combined as a mask
+enum WatchKind {
+    WATCH_READ = 1,    // DXYN sprite fetches, FX65, 5XY3
+    WATCH_WRITE = 2,   // FX33, FX55, 5XY2
+    WATCH_ACCESS = 3
+};
+
+// One bit per address of the largest memory, for breakpoints, watchpoints and coverage. The bits are allocated by
+// the first set(), so checking an empty bitmap is a single compare.
+class AddressBitmap {
+    public:
+        AddressBitmap() : count(0) {}
+
+        bool empty() const { return count == 0; }
+        uint32_t size() const { return count; }
+
+        bool test(uint32_t address) const {
+            if (bits.empty()) {
+                return false;
+            }
+            address &= MAX_MEMORY_SIZE - 1;
+            return (bits[address >> 6] >> (address & 63)) & 1;
+        }
+
+        // Returns false if the address was already set
+        bool set(uint32_t address) {
+            if (bits.empty()) {
+                bits.assign(MAX_MEMORY_SIZE / 64, 0);
+            }
+            if (test(address)) {
+                return false;
+            }
+            address &= MAX_MEMORY_SIZE - 1;
+            bits[address >> 6] |= uint64_t(1) << (address & 63);
+            ++count;
+            return true;
+        }
+
+        // Returns false if the address wasn't set
+        bool clear(uint32_t address) {
+            if (!test(address)) {
+                return false;
+            }
+            address &= MAX_MEMORY_SIZE - 1;
+            bits[address >> 6] &= ~(uint64_t(1) << (address & 63));
+            --count;
+            return true;
+        }
+
+        // Sets the bits set in other, returns how many of them were new
+        uint32_t merge(const AddressBitmap &other) {
+            if (other.bits.empty()) {
+                return 0;
+            }
+            if (bits.empty()) {
+                bits.assign(MAX_MEMORY_SIZE / 64, 0);
+            }
+            uint32_t added = 0;
+            for (size_t i = 0; i < bits.size(); ++i) {
+                for (uint64_t fresh = other.bits[i] & ~bits[i]; fresh != 0; fresh &= fresh - 1) {
+                    ++added;
+                }
+                bits[i] |= other.bits[i];
+            }
+            count += added;
+            return added;
+        }
+
+        void clear_all() {
+            bits.clear();
+            count = 0;
+        }
+
+    private:
+        std::vector<uint64_t> bits;
+        uint32_t count;
+};
+
+// Per-address access counts for the memory heatmap, allocated for the largest memory on first use
+struct AccessCounts {
+    std::vector<uint32_t> fetches;  // Bytes of the instructions run
+    std::vector<uint32_t> reads;    // DXYN sprite fetches, FX65, 5XY3
+    std::vector<uint32_t> writes;   // FX33, FX55, 5XY2
+
+    bool empty() const { return fetches.empty(); }
+
+    void allocate() {
+        fetches.assign(MAX_MEMORY_SIZE, 0);
+        reads.assign(MAX_MEMORY_SIZE, 0);
+        writes.assign(MAX_MEMORY_SIZE, 0);
+    }
+
+    void clear() {
+        fetches.clear();
+        reads.clear();
+        writes.clear();
+    }
+};
@@ -0,0 +1,471 @@
+#include "disasm.h"
+#include <algorithm>
+#include <cstdio>
+#include <set>
+#include "predecode.h"
+
+static const char *const EDGE_KIND_NAMES[] = { "fallthrough", "jump", "call", "skip", "indirect" };
+
+// Mnemonics of 8XYN by N
+static const char *const ALU_NAMES[16] = {
+    "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL"
+};
+
+// Longest table of jumps followed after BNNN, V0 selects one of at most 128 two-byte entries
+static const int MAX_JUMP_TABLE = 128;
+
+static uint16_t read_opcode(const Memory &memory, uint32_t address) {
+    return memory.read(address) << 8 | memory.read(address + 1);
+}
+
+static bool load_store_increments_i(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::SuperChip: return SuperChipQuirks::load_store_increments_i;
+        case QuirkProfile::XoChip:    return XoChipQuirks::load_store_increments_i;
+        case QuirkProfile::CosmacVip: return CosmacVipQuirks::load_store_increments_i;
+        default:                      return Chip8Quirks::load_store_increments_i;
+    }
+}
+
+static bool large_sprites(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::SuperChip: return SuperChipQuirks::large_sprites;
+        case QuirkProfile::XoChip:    return XoChipQuirks::large_sprites;
+        case QuirkProfile::CosmacVip: return CosmacVipQuirks::large_sprites;
+        default:                      return Chip8Quirks::large_sprites;
+    }
+}
+
+uint32_t instruction_size(uint16_t opcode) {
+    return opcode == 0xF000 ? 4 : 2;
+}
+
+const char *edge_kind_name(EdgeKind kind) {
+    return EDGE_KIND_NAMES[static_cast<int>(kind)];
+}
+
+std::string disassemble(uint16_t opcode, uint16_t next) {
+    unsigned x = (opcode & 0x0F00u) >> 8u;
+    unsigned y = (opcode & 0x00F0u) >> 4u;
+    unsigned n = opcode & 0x000Fu;
+    unsigned nn = opcode & 0x00FFu;
+    unsigned nnn = opcode & 0x0FFFu;
+    char text[32];
+
+    switch (classify_opcode(opcode)) {
+        case OpKind::Op00E0: return "CLS";
+        case OpKind::Op00EE: return "RET";
+        case OpKind::Op00CN: std::snprintf(text, sizeof(text), "SCD %u", n); break;
+        case OpKind::Op00DN: std::snprintf(text, sizeof(text), "SCU %u", n); break;
+        case OpKind::Op00FB: return "SCR";
+        case OpKind::Op00FC: return "SCL";
+        case OpKind::Op00FD: return "EXIT";
+        case OpKind::Op00FE: return "LOW";
+        case OpKind::Op00FF: return "HIGH";
+        case OpKind::Op1NNN: std::snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+        case OpKind::Op2NNN: std::snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+        case OpKind::Op3XNN: std::snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+        case OpKind::Op4XNN: std::snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+        case OpKind::Op5XY0: std::snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+        case OpKind::Op5XY2: std::snprintf(text, sizeof(text), "SAVE V%X-V%X", x, y); break;
+        case OpKind::Op5XY3: std::snprintf(text, sizeof(text), "LOAD V%X-V%X", x, y); break;
+        case OpKind::Op6XNN: std::snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+        case OpKind::Op7XNN: std::snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+        case OpKind::Op8XY0:
+        case OpKind::Op8XY1:
+        case OpKind::Op8XY2:
+        case OpKind::Op8XY3:
+        case OpKind::Op8XY4:
+        case OpKind::Op8XY5:
+        case OpKind::Op8XY6:
+        case OpKind::Op8XY7:
+        case OpKind::Op8XYE: std::snprintf(text, sizeof(text), "%s V%X, V%X", ALU_NAMES[n], x, y); break;
+        case OpKind::Op9XY0: std::snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+        case OpKind::OpANNN: std::snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+        case OpKind::OpBNNN: std::snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn); break;
+        case OpKind::OpCXNN: std::snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+        case OpKind::OpDXYN: std::snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n); break;
+        case OpKind::OpEX9E: std::snprintf(text, sizeof(text), "SKP V%X", x); break;
+        case OpKind::OpEXA1: std::snprintf(text, sizeof(text), "SKNP V%X", x); break;
+        case OpKind::OpF000: std::snprintf(text, sizeof(text), "LD I, 0x%04X", next); break;
+        case OpKind::OpFN01: std::snprintf(text, sizeof(text), "PLANE %u", x); break;
+        case OpKind::OpFX07: std::snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+        case OpKind::OpFX0A: std::snprintf(text, sizeof(text), "LD V%X, K", x); break;
+        case OpKind::OpFX15: std::snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+        case OpKind::OpFX18: std::snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+        case OpKind::OpFX1E: std::snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+        case OpKind::OpFX29: std::snprintf(text, sizeof(text), "LD F, V%X", x); break;
+        case OpKind::OpFX30: std::snprintf(text, sizeof(text), "LD HF, V%X", x); break;
+        case OpKind::OpFX33: std::snprintf(text, sizeof(text), "LD B, V%X", x); break;
+        case OpKind::OpFX55: std::snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+        case OpKind::OpFX65: std::snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+        case OpKind::OpFX75: std::snprintf(text, sizeof(text), "LD R, V%X", x); break;
+        case OpKind::OpFX85: std::snprintf(text, sizeof(text), "LD V%X, R", x); break;
+        case OpKind::Nop:
+            if ((opcode & 0xF0FFu) == 0xF002u) {
+                return "AUDIO";
+            }
+            if ((opcode & 0xF0FFu) == 0xF03Au) {
+                std::snprintf(text, sizeof(text), "PITCH V%X", x);
+            } else {
+                std::snprintf(text, sizeof(text), "SYS 0x%03X", nnn);
+            }
+            break;
+        default:
+            std::snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+            break;
+    }
+    return text;
+}
+
+// Instructions after which the next one isn't simply the following address
+static bool ends_block(OpKind kind) {
+    switch (kind) {
+        case OpKind::Op00EE:
+        case OpKind::Op00FD:
+        case OpKind::Op1NNN:
+        case OpKind::Op2NNN:
+        case OpKind::Op3XNN:
+        case OpKind::Op4XNN:
+        case OpKind::Op5XY0:
+        case OpKind::Op9XY0:
+        case OpKind::OpBNNN:
+        case OpKind::OpEX9E:
+        case OpKind::OpEXA1:
+        case OpKind::Illegal:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void add_edge(std::vector<CfgEdge> &edges, uint32_t target, EdgeKind kind) {
+    CfgEdge edge = { target, kind };
+    edges.push_back(edge);
+}
+
+// Where execution goes after the instruction at address. Fallthrough edges past the ROM are dropped.
+static void instruction_successors(const Memory &memory, uint32_t rom_end, uint32_t address,
+                                   std::vector<CfgEdge> &edges) {
+    uint16_t opcode = read_opcode(memory, address);
+    uint32_t next = address + instruction_size(opcode);
+    uint32_t nnn = opcode & 0x0FFFu;
+    OpKind kind = classify_opcode(opcode);
+
+    edges.clear();
+    switch (kind) {
+        case OpKind::Op00EE:
+        case OpKind::Op00FD:
+        case OpKind::Illegal:
+            return;
+        case OpKind::Op1NNN:
+            add_edge(edges, nnn, EdgeKind::Jump);
+            return;
+        case OpKind::Op2NNN:
+            add_edge(edges, nnn, EdgeKind::Call);
+            break;
+        case OpKind::Op3XNN:
+        case OpKind::Op4XNN:
+        case OpKind::Op5XY0:
+        case OpKind::Op9XY0:
+        case OpKind::OpEX9E:
+        case OpKind::OpEXA1:
+            add_edge(edges, next + instruction_size(read_opcode(memory, next)), EdgeKind::Skip);
+            break;
+        case OpKind::OpBNNN:
+            // Only tables of 1NNN are recognised, anything else at NNN is a computed jump we can't follow
+            for (int i = 0; i < MAX_JUMP_TABLE; ++i) {
+                uint32_t entry = nnn + 2 * i;
+                if (entry + 1 >= rom_end || (read_opcode(memory, entry) & 0xF000u) != 0x1000u) {
+                    break;
+                }
+                add_edge(edges, entry, EdgeKind::Indirect);
+            }
+            return;
+        default:
+            break;
+    }
+    if (next + 1 < rom_end) {
+        add_edge(edges, next, EdgeKind::Fallthrough);
+    }
+}
+
+static void mark(RomAnalysis &analysis, uint32_t address, uint32_t size, uint8_t flag) {
+    uint32_t mask = static_cast<uint32_t>(analysis.flags.size()) - 1;
+    for (uint32_t i = 0; i < size; ++i) {
+        analysis.flags[(address + i) & mask] |= flag;
+    }
+}
+
+struct IndexWalk {
+    const Memory &memory;
+    const std::vector<int32_t> &block_at;  // Block starting at each address, -1 if none
+    bool increments;                       // load_store_increments_i
+    bool large_sprites;
+    uint32_t planes;                       // Most planes any FN01 selects, each one draws its own sprite data
+    std::vector<int8_t> changes_index;     // subroutine_changes_index() per block, -1 until needed
+};
+
+// Effect of the instruction at address on a known I: marks the bytes it accesses through I and advances index
+// like the instruction does. Returns false if it loads I with something else.
+static bool follow_index(RomAnalysis &analysis, const IndexWalk &walk, uint32_t address, uint32_t &index) {
+    uint16_t opcode = read_opcode(walk.memory, address);
+    unsigned x = (opcode & 0x0F00u) >> 8u;
+    unsigned y = (opcode & 0x00F0u) >> 4u;
+
+    switch (classify_opcode(opcode)) {
+        case OpKind::OpANNN:
+        case OpKind::OpF000:
+        case OpKind::OpFX1E:
+        case OpKind::OpFX29:
+        case OpKind::OpFX30:
+            return false;
+        case OpKind::OpDXYN:
+            // Sized like the core's draw: N bytes, or 16 rows of 2 bytes for DXY0, for each selected plane
+            if ((opcode & 0x000Fu) != 0 || walk.large_sprites) {
+                uint32_t bytes = (opcode & 0x000Fu) == 0 ? 32 : opcode & 0x000Fu;
+                mark(analysis, index, walk.planes * bytes, ADDRESS_SPRITE);
+            }
+            break;
+        case OpKind::OpFX33:
+            mark(analysis, index, 3, ADDRESS_DATA);
+            break;
+        case OpKind::OpFX55:
+        case OpKind::OpFX65:
+            mark(analysis, index, x + 1, ADDRESS_DATA);
+            if (walk.increments) {
+                index = (index + x + 1) & 0xFFFFu;
+            }
+            break;
+        case OpKind::Op5XY2:
+        case OpKind::Op5XY3:
+            mark(analysis, index, (x > y ? x - y : y - x) + 1, ADDRESS_DATA);
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool block_changes_index(const Memory &memory, const CfgBlock &block, bool increments) {
+    for (uint32_t address = block.start; address < block.end;) {
+        uint16_t opcode = read_opcode(memory, address);
+        switch (classify_opcode(opcode)) {
+            case OpKind::OpANNN:
+            case OpKind::OpF000:
+            case OpKind::OpFX1E:
+            case OpKind::OpFX29:
+            case OpKind::OpFX30:
+                return true;
+            case OpKind::OpFX55:
+            case OpKind::OpFX65:
+                if (increments) {
+                    return true;
+                }
+                break;
+            default:
+                break;
+        }
+        address += instruction_size(opcode);
+    }
+    return false;
+}
+
+// Whether anything reachable from a subroutine's first block may change I. Calls from it are followed too.
+static bool subroutine_changes_index(const RomAnalysis &analysis, const Memory &memory,
+                                     const std::vector<int32_t> &block_at, int32_t first, bool increments) {
+    std::vector<bool> visited(analysis.blocks.size(), false);
+    std::vector<int32_t> stack(1, first);
+    visited[first] = true;
+    while (!stack.empty()) {
+        const CfgBlock &block = analysis.blocks[stack.back()];
+        stack.pop_back();
+        if (block.indirect || block_changes_index(memory, block, increments)) {
+            return true;
+        }
+        for (const CfgEdge &edge : block.successors) {
+            int32_t successor = edge.target < block_at.size() ? block_at[edge.target] : -1;
+            if (successor >= 0 && !visited[successor]) {
+                visited[successor] = true;
+                stack.push_back(successor);
+            }
+        }
+    }
+    return false;
+}
+
+// Whether I may be different after the call that ends the block returns
+static bool call_changes_index(const RomAnalysis &analysis, IndexWalk &walk, const CfgBlock &block) {
+    if (block.successors.empty() || block.successors[0].kind != EdgeKind::Call) {
+        return false;
+    }
+    uint32_t target = block.successors[0].target;
+    int32_t subroutine = target < walk.block_at.size() ? walk.block_at[target] : -1;
+    if (subroutine < 0) {
+        return true;
+    }
+    if (walk.changes_index[subroutine] < 0) {
+        bool changes = subroutine_changes_index(analysis, walk.memory, walk.block_at, subroutine, walk.increments);
+        walk.changes_index[subroutine] = changes ? 1 : 0;
+    }
+    return walk.changes_index[subroutine] == 1;
+}
+
+// Follows the value loaded into I before address in block through the graph until I changes again. Calls are
+// followed into the subroutine, and past it if the subroutine leaves I alone. 00EE ends the walk.
+static void walk_index(RomAnalysis &analysis, IndexWalk &walk, int32_t block, uint32_t address, uint32_t index) {
+    struct Position {
+        int32_t block;
+        uint32_t address;
+        uint32_t index;
+    };
+    std::vector<Position> stack(1, Position{ block, address, index });
+    std::set<std::pair<int32_t, uint32_t>> visited;  // Blocks entered, with the value of I
+    while (!stack.empty()) {
+        Position position = stack.back();
+        stack.pop_back();
+
+        const CfgBlock &current = analysis.blocks[position.block];
+        bool reached_end = true;
+        for (uint32_t at = position.address; at < current.end && reached_end;) {
+            reached_end = follow_index(analysis, walk, at, position.index);
+            at += instruction_size(read_opcode(walk.memory, at));
+        }
+        if (!reached_end) {
+            continue;
+        }
+
+        bool clobbered = call_changes_index(analysis, walk, current);
+        for (const CfgEdge &edge : current.successors) {
+            int32_t successor = edge.target < walk.block_at.size() ? walk.block_at[edge.target] : -1;
+            if (successor < 0 || (clobbered && edge.kind == EdgeKind::Fallthrough)) {
+                continue;
+            }
+            if (visited.insert(std::make_pair(successor, position.index)).second) {
+                stack.push_back(Position{ successor, analysis.blocks[successor].start, position.index });
+            }
+        }
+    }
+}
+
+const CfgBlock *RomAnalysis::find_block(uint32_t address) const {
+    auto after = std::upper_bound(blocks.begin(), blocks.end(), address,
+                                  [](uint32_t value, const CfgBlock &block) { return value < block.start; });
+    if (after == blocks.begin() || address >= (after - 1)->end) {
+        return nullptr;
+    }
+    return &*(after - 1);
+}
+
+RomAnalysis analyze_rom(const Memory &memory, uint32_t rom_size, QuirkProfile profile,
+                        const AddressBitmap *executed) {
+    RomAnalysis analysis;
+    uint32_t memory_size = quirk_memory_size(profile);
+    analysis.rom_end = std::min(START_ADDRESS + rom_size, memory_size);
+    analysis.flags.assign(memory_size, 0);
+
+    // Find every reachable instruction, and the leaders: addresses control flow arrives at other than by
+    // falling through from the previous instruction
+    std::vector<bool> leader(memory_size, false);
+    std::vector<uint32_t> worklist;
+    std::vector<CfgEdge> edges;
+    auto follow = [&](uint32_t entry) {
+        leader[entry] = true;
+        worklist.push_back(entry);
+        while (!worklist.empty()) {
+            uint32_t address = worklist.back();
+            worklist.pop_back();
+
+            while (address + 1 < analysis.rom_end && !(analysis.flags[address] & ADDRESS_CODE)) {
+                uint16_t opcode = read_opcode(memory, address);
+                analysis.flags[address] |= ADDRESS_CODE;
+                mark(analysis, address + 1, instruction_size(opcode) - 1, ADDRESS_OPERAND);
+
+                bool ends = ends_block(classify_opcode(opcode));
+                instruction_successors(memory, analysis.rom_end, address, edges);
+                for (const CfgEdge &edge : edges) {
+                    if ((edge.kind == EdgeKind::Fallthrough && !ends) || edge.target >= memory_size) {
+                        continue;
+                    }
+                    if (edge.kind == EdgeKind::Jump || edge.kind == EdgeKind::Indirect) {
+                        analysis.flags[edge.target] |= ADDRESS_JUMP_TARGET;
+                    } else if (edge.kind == EdgeKind::Call) {
+                        analysis.flags[edge.target] |= ADDRESS_CALL_TARGET;
+                    }
+                    if (!leader[edge.target]) {
+                        leader[edge.target] = true;
+                        worklist.push_back(edge.target);
+                    }
+                }
+                if (ends) {
+                    break;
+                }
+                address += instruction_size(opcode);
+            }
+        }
+    };
+    follow(START_ADDRESS);
+
+    // Code that ran but wasn't found, in order, so code falling through from one to the next stays one block
+    if (executed != nullptr) {
+        for (uint32_t address = START_ADDRESS; address + 1 < analysis.rom_end; ++address) {
+            if (executed->test(address) && !(analysis.flags[address] & (ADDRESS_CODE | ADDRESS_OPERAND))) {
+                follow(address);
+            }
+        }
+    }
+
+    // Split the instructions into blocks at the leaders
+    std::vector<int32_t> block_at(memory_size, -1);
+    for (uint32_t start = START_ADDRESS; start < analysis.rom_end; ++start) {
+        if (!leader[start] || !(analysis.flags[start] & ADDRESS_CODE)) {
+            continue;
+        }
+        CfgBlock block;
+        block.start = start;
+        block.returns = false;
+        block.indirect = false;
+
+        uint32_t address = start;
+        while (true) {
+            uint16_t opcode = read_opcode(memory, address);
+            OpKind kind = classify_opcode(opcode);
+            uint32_t next = address + instruction_size(opcode);
+            if (ends_block(kind) || next + 1 >= analysis.rom_end || leader[next] ||
+                !(analysis.flags[next] & ADDRESS_CODE)) {
+                instruction_successors(memory, analysis.rom_end, address, block.successors);
+                block.end = next;
+                block.returns = kind == OpKind::Op00EE;
+                block.indirect = kind == OpKind::OpBNNN;
+                break;
+            }
+            address = next;
+        }
+        block_at[start] = static_cast<int32_t>(analysis.blocks.size());
+        analysis.blocks.push_back(block);
+    }
+
+    // Follow every value loaded into I to the instructions that use it
+    // Which planes are selected at a draw isn't tracked, so every draw is sized for the most any FN01 selects
+    uint32_t planes = 1;
+    for (uint32_t address = START_ADDRESS; address + 1 < analysis.rom_end; ++address) {
+        uint16_t opcode = read_opcode(memory, address);
+        if ((analysis.flags[address] & ADDRESS_CODE) && classify_opcode(opcode) == OpKind::OpFN01) {
+            planes = std::max(planes, (opcode >> 8 & 1u) + (opcode >> 9 & 1u));
+        }
+    }
+
+    IndexWalk walk = { memory, block_at, load_store_increments_i(profile), large_sprites(profile), planes,
+                       std::vector<int8_t>(analysis.blocks.size(), -1) };
+    for (size_t i = 0; i < analysis.blocks.size(); ++i) {
+        for (uint32_t address = analysis.blocks[i].start; address < analysis.blocks[i].end;) {
+            uint16_t opcode = read_opcode(memory, address);
+            if (classify_opcode(opcode) == OpKind::OpANNN || classify_opcode(opcode) == OpKind::OpF000) {
+                uint32_t index = opcode == 0xF000 ? read_opcode(memory, address + 2) : opcode & 0x0FFFu;
+                walk_index(analysis, walk, static_cast<int32_t>(i), address + instruction_size(opcode), index);
+            }
+            address += instruction_size(opcode);
+        }
+    }
+    return analysis;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "debug.h"
+#include "memory.h"
+#include "quirks.h"
+
+// Static analysis of a ROM: which bytes are code and which are sprite data, and the control-flow graph of the
+// code. Used by tools/chip8_disasm.cpp.
+
+// Bytes of the instruction, 4 for F000 NNNN and 2 for everything else
+uint32_t instruction_size(uint16_t opcode);
+
+// Assembly text of one instruction in Cowgod's syntax, e.g. "LD V1, 0x05". next is the following word, the
+// address of F000 NNNN.
+std::string disassemble(uint16_t opcode, uint16_t next);
+
+// What the analysis found at an address
+enum AddressFlags : uint8_t {
+    ADDRESS_CODE = 1,          // First byte of a reachable instruction
+    ADDRESS_OPERAND = 2,       // Other bytes of a reachable instruction
+    ADDRESS_SPRITE = 4,        // Drawn by DXYN with I loaded by ANNN
+    ADDRESS_DATA = 8,          // Read or written through a known I by FX33/FX55/FX65
+    ADDRESS_JUMP_TARGET = 16,  // Target of 1NNN or BNNN
+    ADDRESS_CALL_TARGET = 32   // Target of 2NNN
+};
+
+enum class EdgeKind : uint8_t {
+    Fallthrough,  // Next instruction, also after a call returns and when a skip isn't taken
+    Jump,         // 1NNN
+    Call,         // 2NNN
+    Skip,         // Taken skip
+    Indirect      // BNNN into a table of jumps at NNN
+};
+
+const char *edge_kind_name(EdgeKind kind);
+
+struct CfgEdge {
+    uint32_t target;
+    EdgeKind kind;
+};
+
+// Straight-line code from start to end - 1. 00EE has no successors, the caller's block continues at the
+// Fallthrough edge of its call.
+struct CfgBlock {
+    uint32_t start;
+    uint32_t end;
+    std::vector<CfgEdge> successors;
+    bool returns;   // Ends with 00EE
+    bool indirect;  // Ends with BNNN, the successors are a guess
+};
+
+struct RomAnalysis {
+    uint32_t rom_end;              // First address after the ROM, code is only followed below it
+    std::vector<uint8_t> flags;    // AddressFlags per address of the profile's memory
+    std::vector<CfgBlock> blocks;  // Sorted by start
+
+    // Block containing the instruction at address, nullptr if it isn't code
+    const CfgBlock *find_block(uint32_t address) const;
+};
+
+// Follows 1NNN, 2NNN, skips and 00EE from 0x200 and tracks I through the graph to find sprites.
+// Code reached only through computed jumps other than BNNN tables, or written at run time, isn't found, unless
+// executed (coverage of runs of the ROM) has it: addresses that ran are followed too.
+RomAnalysis analyze_rom(const Memory &memory, uint32_t rom_size, QuirkProfile profile,
+                        const AddressBitmap *executed = nullptr);
@@ -0,0 +1,179 @@
+#include "display.h"
+#include <cstring>
+
+Display::Display() : width(64), height(32), plane_mask(1) {
+    memset(rows, 0, sizeof(rows));
+    mark_all_dirty();
+}
+
+// Clears the selected planes
+void Display::clear() {
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected(plane)) {
+            memset(rows[plane], 0, sizeof(rows[plane]));
+        }
+    }
+    mark_all_dirty();
+}
+
+// Switching resolution clears every plane (SUPER-CHIP 1.1 / XO-CHIP behaviour)
+void Display::set_hires(bool enabled) {
+    width = enabled ? MAX_WIDTH : 64;
+    height = enabled ? MAX_HEIGHT : 32;
+    memset(rows, 0, sizeof(rows));
+    mark_all_dirty();
+}
+
+bool Display::draw_sprite_row(int plane, int x, int y, uint16_t bits, int sprite_width, bool wrap) {
+    uint64_t mask[WORDS_PER_ROW] = {0, 0};
+
+    // Align the sprite to the top of a word, then shift it into place
+    uint64_t sprite = (uint64_t)bits << (64 - sprite_width);
+    int word = x >> 6;
+    int offset = x & 63;
+    mask[word] = sprite >> offset;
+
+    // Part of the sprite spills over into the next word, or past the right edge where it wraps or is dropped
+    if (offset + sprite_width > 64) {
+        int next = word + 1;
+        if (next == words()) {
+            next = wrap ? 0 : -1;
+        }
+        if (next >= 0) {
+            mask[next] |= sprite << (64 - offset);
+        }
+    }
+
+    uint64_t *row = rows[plane][y];
+    bool collision = false;
+    for (int i = 0; i < words(); ++i) {
+        if (row[i] & mask[i]) {
+            collision = true;
+        }
+        row[i] ^= mask[i];
+    }
+    if (mask[0] | mask[1]) {
+        dirty_rows |= 1ull << y;
+    }
+    return collision;
+}
+
+// Scrolls the selected planes down by n rows, the top rows become blank
+void Display::scroll_down(int n) {
+    if (n > height) {
+        n = height;
+    }
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected(plane)) {
+            memmove(rows[plane][n], rows[plane][0], sizeof(rows[plane][0]) * (height - n));
+            memset(rows[plane][0], 0, sizeof(rows[plane][0]) * n);
+        }
+    }
+    mark_all_dirty();
+}
+
+// Scrolls the selected planes up by n rows, the bottom rows become blank
+void Display::scroll_up(int n) {
+    if (n > height) {
+        n = height;
+    }
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected(plane)) {
+            memmove(rows[plane][0], rows[plane][n], sizeof(rows[plane][0]) * (height - n));
+            memset(rows[plane][height - n], 0, sizeof(rows[plane][0]) * n);
+        }
+    }
+    mark_all_dirty();
+}
+
+// Scrolls every row of the selected planes left by n pixels (n < 64)
+void Display::scroll_left(int n) {
+    if (n == 0) {
+        return;
+    }
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (!selected(plane)) {
+            continue;
+        }
+        for (int y = 0; y < height; ++y) {
+            uint64_t *row = rows[plane][y];
+            if (words() == 2) {
+                row[0] = (row[0] << n) | (row[1] >> (64 - n));
+                row[1] <<= n;
+            } else {
+                row[0] <<= n;
+            }
+        }
+    }
+    mark_all_dirty();
+}
+
+// Scrolls every row of the selected planes right by n pixels (n < 64)
+void Display::scroll_right(int n) {
+    if (n == 0) {
+        return;
+    }
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (!selected(plane)) {
+            continue;
+        }
+        for (int y = 0; y < height; ++y) {
+            uint64_t *row = rows[plane][y];
+            if (words() == 2) {
+                row[1] = (row[1] >> n) | (row[0] << (64 - n));
+            }
+            row[0] >>= n;
+        }
+    }
+    mark_all_dirty();
+}
+
+uint64_t Display::take_dirty_rows() {
+    uint64_t dirty = dirty_rows;
+    dirty_rows = 0;
+    return dirty;
+}
+
+void Display::copy_from(const Display &other) {
+    plane_mask = other.plane_mask;
+    if (other.width != width || other.height != height) {
+        width = other.width;
+        height = other.height;
+        memcpy(rows, other.rows, sizeof(rows));
+        mark_all_dirty();
+        return;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        for (int plane = 0; plane < PLANES; ++plane) {
+            if (memcmp(rows[plane][y], other.rows[plane][y], sizeof(rows[plane][y])) != 0) {
+                memcpy(rows[plane][y], other.rows[plane][y], sizeof(rows[plane][y]));
+                dirty_rows |= 1ull << y;
+            }
+        }
+    }
+}
+
+bool Display::pixel(int x, int y, int plane) const {
+    return (rows[plane][y][x >> 6] >> (63 - (x & 63))) & 1u;
+}
+
+int Display::color(int x, int y) const {
+    return pixel(x, y, 0) | pixel(x, y, 1) << 1;
+}
+
+void Display::to_rgba(uint32_t *pixels, int pitch, const uint32_t palette[COLORS]) const {
+    for (int y = 0; y < height; ++y) {
+        to_rgba_row(pixels + y * pitch, y, palette);
+    }
+}
+
+void Display::to_rgba_row(uint32_t *out, int y, const uint32_t palette[COLORS]) const {
+    for (int w = 0; w < words(); ++w) {
+        uint64_t low = rows[0][y][w];
+        uint64_t high = rows[1][y][w];
+        for (int bit = 63; bit >= 0; --bit) {
+            *out++ = palette[((low >> bit) & 1u) | ((high >> bit) & 1u) << 1];
+        }
+    }
+}
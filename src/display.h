@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// Bit-packed framebuffer with two bit planes (XO-CHIP).
+// Every row is stored as 64-bit words with the leftmost pixel in the most significant bit of word 0,
+// so a full 128x64 SUPER-CHIP plane is 1 KB and scrolling a row is a couple of word shifts.
+// Lo-res (64x32) only uses the first word of the first 32 rows.
+// The two planes form a 2-bit colour index per pixel (plane 0 is bit 0), resolved against a palette at present time.
+class Display {
+    public:
+        static constexpr int MAX_WIDTH = 128;
+        static constexpr int MAX_HEIGHT = 64;
+        static constexpr int WORDS_PER_ROW = MAX_WIDTH / 64;
+        static constexpr int PLANES = 2;
+        static constexpr int COLORS = 1 << PLANES;
+
+        uint64_t rows[PLANES][MAX_HEIGHT][WORDS_PER_ROW];
+
+        // Current resolution, 64x32 or 128x64
+        int width;
+        int height;
+
+        // Planes affected by drawing, clearing and scrolling (FN01), bit 0 is plane 0. Defaults to plane 0 only.
+        uint8_t plane_mask;
+
+        // Rows changed since the frontend last called take_dirty_rows(), bit y is row y
+        uint64_t dirty_rows;
+
+        Display();
+        void clear();
+        void set_hires(bool enabled);
+        bool hires() const { return width == MAX_WIDTH; }
+
+        // XORs one sprite row (the low sprite_width bits of bits, MSB first) at (x, y) into a plane, wrapping
+        // around the right edge or clipping it. Returns true if any pixel was switched off (collision).
+        bool draw_sprite_row(int plane, int x, int y, uint16_t bits, int sprite_width, bool wrap = true);
+
+        void scroll_down(int n);
+        void scroll_up(int n);
+        void scroll_left(int n);
+        void scroll_right(int n);
+
+        // Returns the dirty rows and resets them, so the next call only reports new changes
+        uint64_t take_dirty_rows();
+
+        // Copies another display (e.g. a frame published by the emulation thread), marking the rows that differ
+        void copy_from(const Display &other);
+
+        bool pixel(int x, int y, int plane = 0) const;
+
+        // Colour index (0-3) of a pixel, combining both planes
+        int color(int x, int y) const;
+
+        // Expands the visible area into 32-bit pixels using a 4 colour palette, pitch is in pixels.
+        void to_rgba(uint32_t *pixels, int pitch, const uint32_t palette[COLORS]) const;
+        void to_rgba_row(uint32_t *out, int y, const uint32_t palette[COLORS]) const;
+
+    private:
+        int words() const { return width / 64; }
+        bool selected(int plane) const { return plane_mask & (1u << plane); }
+        void mark_all_dirty() { dirty_rows = height == 64 ? ~0ull : (1ull << height) - 1; }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+
+// Decides when emulation frames start and which ones are presented.
+// Normally frames start every frame_duration and all of them are presented. While fast-forwarding they run back to
+// back and only every skip-th one is presented, and the normal pace resumes from the time fast-forward ends instead
+// of rushing to catch up with the frames it skipped.
+class FramePacer {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        FramePacer(Clock::duration frame_duration, int skip, Clock::time_point now)
+            : frame_duration(frame_duration), skip(skip), next(now), frames(0) {}
+
+        // Called after every frame. Returns true if it should be presented.
+        bool frame_done(bool unthrottled, Clock::time_point now) {
+            ++frames;
+            next = unthrottled ? now : next + frame_duration;
+            return !unthrottled || frames % skip == 0;
+        }
+
+        // Starts pacing again from now, e.g. after the machine was stopped by a debugger
+        void restart(Clock::time_point now) { next = now; }
+
+        // When the next frame is due
+        Clock::time_point next_frame() const { return next; }
+        long frame_count() const { return frames; }
+
+    private:
+        Clock::duration frame_duration;
+        int skip;
+        Clock::time_point next;
+        long frames;
+};
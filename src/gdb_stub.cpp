@@ -0,0 +1,656 @@
+#include "gdb_stub.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET Socket;
+typedef WSAPOLLFD PollFd;
+static void close_socket(Socket s) { closesocket(s); }
+static int poll_sockets(PollFd *fds, unsigned long count, int timeout_ms) { return WSAPoll(fds, count, timeout_ms); }
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int Socket;
+typedef pollfd PollFd;
+static void close_socket(Socket s) { close(s); }
+static int poll_sockets(PollFd *fds, nfds_t count, int timeout_ms) { return poll(fds, count, timeout_ms); }
+#endif
+
+// A debugger that went away must not kill the emulator with SIGPIPE
+#ifdef MSG_NOSIGNAL
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static const int SEND_FLAGS = 0;
+#endif
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static void append_hex(std::string &out, uint8_t byte) {
+    out += HEX_DIGITS[byte >> 4];
+    out += HEX_DIGITS[byte & 0xF];
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parses hex digits from pos up to the first non-hex character, which pos is left on
+static bool parse_hex(const std::string &text, size_t &pos, uint32_t &value) {
+    size_t start = pos;
+    value = 0;
+    while (pos < text.size() && hex_value(text[pos]) >= 0 && pos - start < 8) {
+        value = value << 4 | hex_value(text[pos]);
+        ++pos;
+    }
+    return pos > start;
+}
+
+static bool parse_hex_bytes(const std::string &text, size_t pos, std::string &bytes) {
+    if ((text.size() - pos) % 2 != 0) {
+        return false;
+    }
+    for (; pos < text.size(); pos += 2) {
+        int high = hex_value(text[pos]);
+        int low = hex_value(text[pos + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes += static_cast<char>(high << 4 | low);
+    }
+    return true;
+}
+
+static bool in_memory(const Chip8 &chip8, uint32_t address, uint32_t length) {
+    return length <= chip8.memory.size() && address <= chip8.memory.size() - length;
+}
+
+static int register_size(int number) {
+    return number == GDB_REGISTER_I || number == GDB_REGISTER_PC ? 2 : 1;
+}
+
+// Multi-byte registers are big-endian, like the machine's memory
+static uint32_t read_register(const Chip8 &chip8, int number) {
+    switch (number) {
+        case GDB_REGISTER_I: return chip8.index;
+        case GDB_REGISTER_PC: return chip8.pc;
+        case GDB_REGISTER_SP: return chip8.sp;
+        case GDB_REGISTER_DT: return chip8.delay_timer;
+        case GDB_REGISTER_ST: return chip8.sound_timer;
+        default: return chip8.registers[number];
+    }
+}
+
+static void write_register(Chip8 &chip8, int number, uint32_t value) {
+    switch (number) {
+        case GDB_REGISTER_I: chip8.index = static_cast<uint16_t>(value); break;
+        case GDB_REGISTER_PC: chip8.pc = static_cast<uint16_t>(value); break;
+        case GDB_REGISTER_SP: chip8.sp = static_cast<uint8_t>(value & 0xF); break;
+        case GDB_REGISTER_DT: chip8.delay_timer = static_cast<uint8_t>(value); break;
+        case GDB_REGISTER_ST: chip8.sound_timer = static_cast<uint8_t>(value); break;
+        default: chip8.registers[number] = static_cast<uint8_t>(value); break;
+    }
+}
+
+static void append_register(std::string &out, const Chip8 &chip8, int number) {
+    uint32_t value = read_register(chip8, number);
+    if (register_size(number) == 2) {
+        append_hex(out, static_cast<uint8_t>(value >> 8));
+    }
+    append_hex(out, static_cast<uint8_t>(value));
+}
+
+// Reads one register from bytes at pos, advancing pos
+static void parse_register(Chip8 &chip8, int number, const std::string &bytes, size_t &pos) {
+    uint32_t value = static_cast<uint8_t>(bytes[pos++]);
+    if (register_size(number) == 2) {
+        value = value << 8 | static_cast<uint8_t>(bytes[pos++]);
+    }
+    write_register(chip8, number, value);
+}
+
+// Followed by <offset>,<length>
+static const char TARGET_XML_READ[] = "qXfer:features:read:target.xml:";
+
+static std::string target_xml() {
+    static const char *const NAMES[GDB_REGISTER_COUNT - 16] = { "i", "pc", "sp", "dt", "st" };
+    std::string xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                      "<target version=\"1.0\"><feature name=\"org.chip8.core\">";
+    char reg[96];
+    for (int i = 0; i < GDB_REGISTER_COUNT; ++i) {
+        const char *type = i == GDB_REGISTER_PC ? "code_ptr" : i == GDB_REGISTER_I ? "data_ptr" : "uint8";
+        if (i < 16) {
+            std::snprintf(reg, sizeof(reg), "<reg name=\"v%x\" bitsize=\"8\" type=\"%s\"/>", i, type);
+        } else {
+            std::snprintf(reg, sizeof(reg), "<reg name=\"%s\" bitsize=\"%d\" type=\"%s\"/>", NAMES[i - 16],
+                          8 * register_size(i), type);
+        }
+        xml += reg;
+    }
+    return xml + "</feature></target>";
+}
+
+GdbStub::GdbStub(Chip8 &chip8) : chip8(chip8) {
+    timeline = nullptr;
+    server = -1;
+    client = -1;
+    halted = true;
+    interrupted = false;
+    no_ack = false;
+    detaching = false;
+}
+
+GdbStub::~GdbStub() {
+    close_client();
+    if (server != -1) {
+        close_socket(static_cast<Socket>(server));
+    }
+    if (!unix_path.empty()) {
+        std::remove(unix_path.c_str());
+    }
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+bool GdbStub::listen(const std::string &address, std::string &error) {
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+    Socket s;
+    if (address.compare(0, 5, "unix:") == 0) {
+#ifdef _WIN32
+        error = "Unix sockets are not supported on Windows";
+        return false;
+#else
+        sockaddr_un local;
+        std::memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+            error = "Invalid socket path: " + path;
+            return false;
+        }
+        std::strcpy(local.sun_path, path.c_str());
+        std::remove(path.c_str());
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        server = static_cast<intptr_t>(s);
+        if (server == -1 || bind(s, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0) {
+            error = "Could not bind " + path;
+            return false;
+        }
+        unix_path = path;
+#endif
+    } else {
+        char *end;
+        long port = std::strtol(address.c_str(), &end, 10);
+        if (address.empty() || *end != '\0' || port < 1 || port > 65535) {
+            error = "Invalid port: " + address;
+            return false;
+        }
+        sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(static_cast<uint16_t>(port));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        server = static_cast<intptr_t>(s);
+        int reuse = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+        if (server == -1 || bind(s, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0) {
+            error = "Could not bind 127.0.0.1:" + address;
+            return false;
+        }
+    }
+
+    if (::listen(s, 1) != 0) {
+        error = "Could not listen on " + address;
+        return false;
+    }
+    Socket accepted = accept(s, nullptr, nullptr);
+    if (static_cast<intptr_t>(accepted) == -1) {
+        error = "Could not accept a connection on " + address;
+        return false;
+    }
+    int on = 1;
+    if (unix_path.empty()) {
+        // Packets are small and every one waits for an answer
+        setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&on), sizeof(on));
+    }
+#ifdef SO_NOSIGPIPE
+    setsockopt(accepted, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    client = static_cast<intptr_t>(accepted);
+    halted = true;
+    return true;
+}
+
+void GdbStub::close_client() {
+    if (client != -1) {
+        close_socket(static_cast<Socket>(client));
+        client = -1;
+    }
+}
+
+// Appends whatever arrives within timeout_ms to input. Returns false if nothing did.
+bool GdbStub::receive(int timeout_ms) {
+    PollFd fd;
+    fd.fd = static_cast<Socket>(client);
+    fd.events = POLLIN;
+    fd.revents = 0;
+    if (poll_sockets(&fd, 1, timeout_ms) <= 0) {
+        return false;
+    }
+    char buffer[4096];
+    int received = static_cast<int>(recv(static_cast<Socket>(client), buffer, sizeof(buffer), 0));
+    if (received <= 0) {
+        // The debugger went away, the machine runs on by itself
+        close_client();
+        chip8.clear_debug_points();
+        return false;
+    }
+    input.append(buffer, received);
+    return true;
+}
+
+void GdbStub::send_raw(const std::string &data) {
+    if (client != -1) {
+        send(static_cast<Socket>(client), data.data(), static_cast<int>(data.size()), SEND_FLAGS);
+    }
+}
+
+void GdbStub::send_packet(const std::string &payload) {
+    uint8_t checksum = 0;
+    for (char c : payload) {
+        checksum += static_cast<uint8_t>(c);
+    }
+    std::string packet = "$" + payload + "#";
+    append_hex(packet, checksum);
+    send_raw(packet);
+}
+
+void GdbStub::poll(int timeout_ms) {
+    if (!attached() || !receive(timeout_ms)) {
+        return;
+    }
+
+    while (attached()) {
+        size_t start = input.find_first_of("$\x03");
+        if (start == std::string::npos) {
+            // Only acknowledgements, which are not checked
+            input.clear();
+            break;
+        }
+        if (input[start] == '\x03') {
+            input.erase(0, start + 1);
+            if (!halted) {
+                halted = true;
+                interrupted = true;
+                send_packet(stop_reply());
+            }
+            continue;
+        }
+
+        size_t end = input.find('#', start);
+        if (end == std::string::npos || end + 2 >= input.size()) {
+            // Wait for the rest of the packet
+            input.erase(0, start);
+            break;
+        }
+        std::string payload = input.substr(start + 1, end - start - 1);
+        std::string checksum = input.substr(end + 1, 2);
+        input.erase(0, end + 3);
+
+        if (!no_ack) {
+            uint8_t sum = 0;
+            for (char c : payload) {
+                sum += static_cast<uint8_t>(c);
+            }
+            size_t pos = 0;
+            uint32_t sent;
+            if (!parse_hex(checksum, pos, sent) || sent != sum) {
+                send_raw("-");
+                continue;
+            }
+            send_raw("+");
+        }
+
+        std::string reply;
+        if (handle_packet(payload, reply)) {
+            send_packet(reply);
+        }
+        if (detaching) {
+            close_client();
+        }
+    }
+}
+
+void GdbStub::check_stop() {
+    if (attached() && !halted && (chip8.breakpoint_hit || chip8.watchpoint_hit || chip8.exited)) {
+        halted = true;
+        send_packet(stop_reply());
+    }
+}
+
+// Signals: 2 SIGINT, 4 SIGILL, 5 SIGTRAP
+std::string GdbStub::stop_reply() const {
+    char reply[32];
+    if (chip8.illegal_opcode) {
+        return "T04";
+    }
+    if (chip8.exited) {
+        return "W00";
+    }
+    if (interrupted) {
+        return "T02";
+    }
+    if (chip8.watchpoint_hit) {
+        std::snprintf(reply, sizeof(reply), "T05%s:%x;", chip8.watch_was_write ? "watch" : "rwatch",
+                      chip8.watch_address);
+        return reply;
+    }
+    if (chip8.breakpoint_hit) {
+        return "T05swbreak:;";
+    }
+    return "T05";
+}
+
+// Continue and step resume at address if one is given. A breakpoint under pc doesn't stop the machine again.
+void GdbStub::resume(const std::string &address) {
+    size_t pos = 0;
+    uint32_t value;
+    if (parse_hex(address, pos, value)) {
+        chip8.pc = static_cast<uint16_t>(value);
+    }
+    if (chip8.has_breakpoint(chip8.pc)) {
+        chip8.breakpoint_hit = true;
+    }
+    interrupted = false;
+}
+
+// Registers or memory written by the debugger
+void GdbStub::state_changed() {
+    if (timeline) {
+        timeline->state_changed();
+    }
+}
+
+std::string GdbStub::monitor(const std::string &command) {
+    char text[128];
+    unsigned a = 0, b = 0, plane = 0;
+    unsigned long long time = 0;
+    if (command == "when") {
+        std::snprintf(text, sizeof(text), "Time %llu of %llu recorded, %u keyframes\n",
+                      static_cast<unsigned long long>(timeline->now()),
+                      static_cast<unsigned long long>(timeline->end()),
+                      static_cast<unsigned>(timeline->keyframe_count()));
+    } else if (std::sscanf(command.c_str(), "goto %llu", &time) == 1) {
+        timeline->seek(time);
+        std::snprintf(text, sizeof(text), "Time %llu, pc 0x%03x\n",
+                      static_cast<unsigned long long>(timeline->now()), chip8.pc);
+    } else if (std::sscanf(command.c_str(), "last-write %x", &a) == 1) {
+        TimelineHit hit = timeline->last_write(a);
+        if (hit.found) {
+            std::snprintf(text, sizeof(text), "0x%03x written at time %llu by the instruction at 0x%03x\n", a,
+                          static_cast<unsigned long long>(hit.time), hit.pc);
+        } else {
+            std::snprintf(text, sizeof(text), "0x%03x not written since recording started\n", a);
+        }
+    } else if (std::sscanf(command.c_str(), "last-pixel %u %u %u", &a, &b, &plane) >= 2 && plane < 2) {
+        TimelineHit hit = timeline->last_pixel_change(a, b, plane);
+        if (hit.found) {
+            std::snprintf(text, sizeof(text), "Pixel %u,%u changed at time %llu by the instruction at 0x%03x\n",
+                          a, b, static_cast<unsigned long long>(hit.time), hit.pc);
+        } else {
+            std::snprintf(text, sizeof(text), "Pixel %u,%u unchanged since recording started\n", a, b);
+        }
+    } else {
+        std::snprintf(text, sizeof(text), "Commands: when, goto <time>, last-write <hex address>, "
+                      "last-pixel <x> <y> [<plane>]\n");
+    }
+    return text;
+}
+
+bool GdbStub::handle_packet(const std::string &packet, std::string &reply) {
+    size_t pos = 1;
+    uint32_t address, length, value;
+    reply.clear();
+    if (packet.empty()) {
+        return true;
+    }
+
+    switch (packet[0]) {
+        case '?':
+            reply = stop_reply();
+            return true;
+
+        case 'g':
+            for (int i = 0; i < GDB_REGISTER_COUNT; ++i) {
+                append_register(reply, chip8, i);
+            }
+            return true;
+
+        case 'G': {
+            std::string bytes;
+            if (!parse_hex_bytes(packet, 1, bytes) || bytes.size() != 16 + 2 * 2 + 3) {
+                reply = "E01";
+                return true;
+            }
+            size_t offset = 0;
+            for (int i = 0; i < GDB_REGISTER_COUNT; ++i) {
+                parse_register(chip8, i, bytes, offset);
+            }
+            state_changed();
+            reply = "OK";
+            return true;
+        }
+
+        case 'p':
+            if (!parse_hex(packet, pos, value) || value >= GDB_REGISTER_COUNT) {
+                reply = "E01";
+                return true;
+            }
+            append_register(reply, chip8, value);
+            return true;
+
+        case 'P': {
+            std::string bytes;
+            if (!parse_hex(packet, pos, value) || value >= GDB_REGISTER_COUNT || pos >= packet.size() ||
+                packet[pos] != '=' || !parse_hex_bytes(packet, pos + 1, bytes) ||
+                bytes.size() != static_cast<size_t>(register_size(value))) {
+                reply = "E01";
+                return true;
+            }
+            size_t offset = 0;
+            parse_register(chip8, value, bytes, offset);
+            state_changed();
+            reply = "OK";
+            return true;
+        }
+
+        case 'm':
+            if (!parse_hex(packet, pos, address) || packet[pos++] != ',' || !parse_hex(packet, pos, length) ||
+                !in_memory(chip8, address, length)) {
+                reply = "E01";
+                return true;
+            }
+            for (uint32_t i = 0; i < length; ++i) {
+                append_hex(reply, chip8.memory.read(address + i));
+            }
+            return true;
+
+        case 'M': {
+            std::string bytes;
+            if (!parse_hex(packet, pos, address) || packet[pos++] != ',' || !parse_hex(packet, pos, length) ||
+                pos >= packet.size() || packet[pos] != ':' || !parse_hex_bytes(packet, pos + 1, bytes) ||
+                bytes.size() != length || !in_memory(chip8, address, length)) {
+                reply = "E01";
+                return true;
+            }
+            for (uint32_t i = 0; i < length; ++i) {
+                chip8.write_memory(address + i, static_cast<uint8_t>(bytes[i]));
+            }
+            state_changed();
+            reply = "OK";
+            return true;
+        }
+
+        case 'Z':
+        case 'z': {
+            // Z<type>,<address>,<kind>: 0 and 1 are breakpoints, 2 write, 3 read and 4 access watchpoints
+            // A watchpoint's kind is the length watched, it has to stay inside memory
+            int type = packet.size() > 1 ? hex_value(packet[1]) : -1;
+            pos = 2;
+            if (type < 0 || type > 4 || pos >= packet.size() || packet[pos++] != ',' ||
+                !parse_hex(packet, pos, address) || pos >= packet.size() || packet[pos++] != ',' ||
+                !parse_hex(packet, pos, length) || address >= chip8.memory.size() ||
+                (type >= 2 && !in_memory(chip8, address, length))) {
+                reply = "E01";
+                return true;
+            }
+            static const int KINDS[] = { WATCH_WRITE, WATCH_READ, WATCH_ACCESS };
+            bool set = packet[0] == 'Z';
+            if (type <= 1 && set) {
+                chip8.set_breakpoint(address);
+            } else if (type <= 1) {
+                chip8.clear_breakpoint(address);
+            } else if (set) {
+                chip8.set_watchpoint(address, length, KINDS[type - 2]);
+            } else {
+                chip8.clear_watchpoint(address, length, KINDS[type - 2]);
+            }
+            reply = "OK";
+            return true;
+        }
+
+        case 'c':
+            resume(packet.substr(1));
+            halted = false;
+            return false;
+
+        case 's':
+            resume(packet.substr(1));
+            if (timeline) {
+                timeline->step();
+            } else {
+                chip8.run_instructions(1);
+            }
+            reply = stop_reply();
+            return true;
+
+        case 'b':
+            // Reverse step and continue. Going back past the start of the recording stops there.
+            if (!timeline || (packet != "bs" && packet != "bc")) {
+                return true;
+            }
+            interrupted = false;
+            if (packet == "bs" ? !timeline->step_back() : !timeline->reverse_continue()) {
+                timeline->seek(0);
+                reply = "T05replaylog:begin;";
+                return true;
+            }
+            if (chip8.has_breakpoint(chip8.pc) && !chip8.watchpoint_hit) {
+                chip8.breakpoint_hit = true;
+            }
+            reply = stop_reply();
+            return true;
+
+        case 'D':
+            // The connection closes after the reply
+            chip8.clear_debug_points();
+            detaching = true;
+            halted = false;
+            reply = "OK";
+            return true;
+
+        case 'k':
+            chip8.exited = true;
+            close_client();
+            halted = false;
+            return false;
+
+        case 'H':
+            reply = "OK";
+            return true;
+
+        case 'v':
+            if (packet == "vCont?") {
+                reply = "vCont;c;C;s;S";
+                return true;
+            }
+            if (packet.compare(0, 6, "vCont;") == 0 && packet.size() > 6) {
+                // A single thread, so the first action is the one for it. Signals are not delivered.
+                bool step = packet[6] == 's' || packet[6] == 'S';
+                return handle_packet(step ? "s" : "c", reply);
+            }
+            return true;
+
+        case 'q':
+            if (packet.compare(0, 10, "qSupported") == 0) {
+                reply = "PacketSize=1000;qXfer:features:read+;QStartNoAckMode+;swbreak+;hwbreak+";
+                if (timeline) {
+                    reply += ";ReverseStep+;ReverseContinue+";
+                }
+            } else if (packet == "qAttached") {
+                reply = "1";
+            } else if (packet == "qC") {
+                reply = "QC1";
+            } else if (packet == "qfThreadInfo") {
+                reply = "m1";
+            } else if (packet == "qsThreadInfo") {
+                reply = "l";
+            } else if (packet.compare(0, 6, "qRcmd,") == 0 && timeline) {
+                std::string command;
+                if (!parse_hex_bytes(packet, 6, command)) {
+                    reply = "E01";
+                    return true;
+                }
+                std::string output = monitor(command);
+                for (size_t i = 0; i < output.size(); ++i) {
+                    append_hex(reply, static_cast<uint8_t>(output[i]));
+                }
+            } else if (packet.compare(0, std::strlen(TARGET_XML_READ), TARGET_XML_READ) == 0) {
+                pos = std::strlen(TARGET_XML_READ);
+                std::string xml = target_xml();
+                if (!parse_hex(packet, pos, address) || pos >= packet.size() ||
+                    packet[pos++] != ',' || !parse_hex(packet, pos, length)) {
+                    reply = "E01";
+                } else if (address >= xml.size()) {
+                    reply = "l";
+                } else {
+                    std::string chunk = xml.substr(address, length);
+                    reply = (address + chunk.size() < xml.size() ? "m" : "l") + chunk;
+                }
+            }
+            return true;
+
+        case 'Q':
+            if (packet == "QStartNoAckMode") {
+                // The packet itself was acknowledged, nothing after it is
+                no_ack = true;
+                reply = "OK";
+            }
+            return true;
+
+        default:
+            // Empty reply: not supported
+            return true;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "chip8.h"
+#include "timeline.h"
+
+// GDB remote serial protocol stub for one debugger connection on a loopback TCP port or a Unix socket.
+// Registers, in "g" packet order: V0-VF (8 bit), I and PC (16 bit, big-endian like the machine), SP, DT and ST
+// (8 bit). The machine has no GDB architecture, so the register layout is offered as target.xml. Breakpoints
+// (Z0/Z1) and watchpoints (Z2-Z4) use the core's, see Chip8::set_breakpoint(), so a continued machine runs at
+// full interpreter speed until one is hit.
+//
+// With a timeline (set_timeline()) the debugger can also go backwards: reverse step and continue (bs/bc), and
+// "monitor last-write <address>", "monitor last-pixel <x> <y> [<plane>]", "monitor when" and
+// "monitor goto <time>" for the recorded past.
+//
+// The frontend owns the run loop: while stopped() it calls poll() to serve the debugger, otherwise it runs
+// frames as usual and calls poll(0) and check_stop() after each one.
+constexpr int GDB_REGISTER_COUNT = 21;
+constexpr int GDB_REGISTER_I = 16;
+constexpr int GDB_REGISTER_PC = 17;
+constexpr int GDB_REGISTER_SP = 18;
+constexpr int GDB_REGISTER_DT = 19;
+constexpr int GDB_REGISTER_ST = 20;
+
+class GdbStub {
+    public:
+        explicit GdbStub(Chip8 &chip8);
+        ~GdbStub();
+
+        // Listens on "<port>" (127.0.0.1 only) or "unix:<path>" and waits for the debugger to connect.
+        // The machine starts stopped.
+        bool listen(const std::string &address, std::string &error);
+
+        // False once the debugger detached, killed the machine or went away. The machine then runs freely.
+        bool attached() const { return client != -1; }
+        bool stopped() const { return attached() && halted; }
+
+        // Serves the packets that arrive within timeout_ms (-1 waits forever). Call it with 0 while the machine
+        // runs, the debugger only sends an interrupt (Ctrl-C) then.
+        void poll(int timeout_ms);
+
+        // The frontend then runs frames and presses keys through the timeline, which the stub steps and rewinds
+        void set_timeline(Timeline *timeline) { this->timeline = timeline; }
+
+        // Stops and tells the debugger if the last run ended on a breakpoint, a watchpoint or an exit
+        void check_stop();
+
+        // Handles the payload of one packet without the socket, exposed for tests. Returns false if there is no
+        // reply yet (continue replies when the machine stops).
+        bool handle_packet(const std::string &packet, std::string &reply);
+
+    private:
+        Chip8 &chip8;
+        Timeline *timeline;  // Not owned, null without time travel
+        intptr_t server;  // Sockets, -1 if not open
+        intptr_t client;
+        std::string unix_path;   // Removed when the stub closes
+        std::string input;       // Received bytes not handled yet
+        bool halted;
+        bool interrupted;  // Stopped by Ctrl-C rather than the machine
+        bool no_ack;
+        bool detaching;    // Close the connection after the reply
+
+        void close_client();
+        bool receive(int timeout_ms);
+        void send_raw(const std::string &data);
+        void send_packet(const std::string &payload);
+        std::string stop_reply() const;
+        void resume(const std::string &address);
+        void state_changed();
+        std::string monitor(const std::string &command);
+};
@@ -0,0 +1,97 @@
+#include "heatmap.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+static const int MIN_COLUMNS = 64;
+static const int MAX_ROWS = 256;
+static const int IMAGE_WIDTH = 512;
+
+static uint32_t channel_max(const std::vector<uint32_t> &counts, uint32_t memory_size) {
+    return counts.empty() ? 0 : *std::max_element(counts.begin(), counts.begin() + memory_size);
+}
+
+static uint32_t intensity(uint32_t count, double log_max) {
+    if (count == 0) {
+        return 0;
+    }
+    // The least accessed bytes still show
+    return 64 + static_cast<uint32_t>(191 * std::log(1.0 + count) / log_max);
+}
+
+void render_heatmap(const AccessCounts &counts, uint32_t memory_size, Heatmap &heatmap) {
+    heatmap.width = std::max<int>(MIN_COLUMNS, memory_size / MAX_ROWS);
+    heatmap.height = memory_size / heatmap.width;
+    heatmap.pixels.assign(memory_size, 0x000000FF);
+    if (counts.empty()) {
+        return;
+    }
+
+    double log_writes = std::log(1.0 + std::max<uint32_t>(channel_max(counts.writes, memory_size), 1));
+    double log_reads = std::log(1.0 + std::max<uint32_t>(channel_max(counts.reads, memory_size), 1));
+    double log_fetches = std::log(1.0 + std::max<uint32_t>(channel_max(counts.fetches, memory_size), 1));
+    for (uint32_t address = 0; address < memory_size; ++address) {
+        heatmap.pixels[address] = intensity(counts.writes[address], log_writes) << 24 |
+                                  intensity(counts.reads[address], log_reads) << 16 |
+                                  intensity(counts.fetches[address], log_fetches) << 8 | 0xFF;
+    }
+}
+
+int heatmap_scale(const Heatmap &heatmap) {
+    return std::max(1, IMAGE_WIDTH / heatmap.width);
+}
+
+static void put_u16(std::string &out, uint32_t value) {
+    out += static_cast<char>(value & 0xFF);
+    out += static_cast<char>(value >> 8 & 0xFF);
+}
+
+static void put_u32(std::string &out, uint32_t value) {
+    put_u16(out, value & 0xFFFF);
+    put_u16(out, value >> 16);
+}
+
+bool save_heatmap(const std::string &path, const Heatmap &heatmap, int scale, std::string &error) {
+    uint32_t width = heatmap.width * scale;
+    uint32_t height = heatmap.height * scale;
+    uint32_t row_bytes = (width * 3 + 3) & ~3u;  // Rows are padded to 4 bytes
+    const uint32_t HEADERS = 14 + 40;
+
+    std::string bmp;
+    bmp.reserve(HEADERS + row_bytes * height);
+    bmp += "BM";
+    put_u32(bmp, HEADERS + row_bytes * height);
+    put_u32(bmp, 0);
+    put_u32(bmp, HEADERS);
+    put_u32(bmp, 40);
+    put_u32(bmp, width);
+    put_u32(bmp, height);
+    put_u16(bmp, 1);   // Planes
+    put_u16(bmp, 24);  // Bits per pixel
+    put_u32(bmp, 0);   // Uncompressed
+    put_u32(bmp, row_bytes * height);
+    put_u32(bmp, 2835);  // 72 dpi
+    put_u32(bmp, 2835);
+    put_u32(bmp, 0);
+    put_u32(bmp, 0);
+
+    // Bottom row first, pixels as blue, green, red
+    for (uint32_t y = height; y-- > 0;) {
+        const uint32_t *row = &heatmap.pixels[(y / scale) * heatmap.width];
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t pixel = row[x / scale];
+            bmp += static_cast<char>(pixel >> 8 & 0xFF);
+            bmp += static_cast<char>(pixel >> 16 & 0xFF);
+            bmp += static_cast<char>(pixel >> 24 & 0xFF);
+        }
+        bmp.append(row_bytes - width * 3, '\0');
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(bmp.data(), bmp.size());
+    if (!file) {
+        error = "Could not write heatmap: " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "debug.h"
+
+// Memory access heatmap: one pixel per byte of memory, 64 bytes per row (more for memories larger than 16K, so
+// the map stays square-ish). Writes are red, reads green and instruction fetches blue, each on a log scale up to
+// the most accessed byte of its kind, so a hot byte of one kind doesn't wash out the others.
+struct Heatmap {
+    int width;
+    int height;
+    std::vector<uint32_t> pixels;  // RGBA8888 like the display texture, row by row
+};
+
+void render_heatmap(const AccessCounts &counts, uint32_t memory_size, Heatmap &heatmap);
+
+// 24-bit BMP, every pixel scaled up to a scale x scale square
+bool save_heatmap(const std::string &path, const Heatmap &heatmap, int scale, std::string &error);
+
+// Pixels per byte for an image of about 512 pixels across
+int heatmap_scale(const Heatmap &heatmap);
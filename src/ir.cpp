@@ -0,0 +1,622 @@
+#include "ir.h"
+#include <algorithm>
+#include <cstdio>
+#include "predecode.h"
+
+static uint16_t read_opcode(const Memory &memory, uint32_t address) {
+    return memory.read(address) << 8 | memory.read(address + 1);
+}
+
+static uint32_t slot_bit(int slot) {
+    return 1u << slot;
+}
+
+// VX to VY in either order, like 5XY2/5XY3
+static uint32_t register_range(int x, int y) {
+    if (x > y) {
+        std::swap(x, y);
+    }
+    return ((2u << y) - 1) & ~((1u << x) - 1);
+}
+
+static uint16_t emit(IrBlock &block, IrOp op, uint16_t a = 0, uint16_t b = 0, uint32_t imm = 0, uint32_t imm2 = 0) {
+    IrInst inst = { op, a, b, imm, imm2, 0, 0 };
+    block.code.push_back(inst);
+    return static_cast<uint16_t>(block.code.size() - 1);
+}
+
+static uint16_t emit_const(IrBlock &block, uint32_t value) {
+    return emit(block, IrOp::Const, 0, 0, value);
+}
+
+static uint16_t emit_get(IrBlock &block, int slot) {
+    return emit(block, IrOp::Get, 0, 0, slot);
+}
+
+static void emit_set(IrBlock &block, int slot, uint16_t value) {
+    emit(block, IrOp::Set, value, 0, slot);
+}
+
+static void emit_interp(IrBlock &block, uint32_t address, uint16_t opcode, uint32_t reads, uint32_t writes) {
+    uint16_t index = emit(block, IrOp::Interp, 0, 0, address & 0xFFFFu, opcode);
+    block.code[index].reads = reads;
+    block.code[index].writes = writes;
+}
+
+static void add_range(IrBlock &block, uint32_t first, uint32_t last) {
+    if (!block.ranges.empty() && block.ranges.back().last == first) {
+        block.ranges.back().last = last;
+    } else {
+        IrRange range = { first, last };
+        block.ranges.push_back(range);
+    }
+}
+
+// Skips (3XNN, 4XNN, 5XY0, 9XY0) leave the block over the next instruction, which is 4 bytes long if it is F000
+static void emit_skip(IrBlock &block, const Memory &memory, IrOp op, uint16_t a, uint16_t b, uint32_t next) {
+    uint32_t skipped = next + (read_opcode(memory, next) == 0xF000 ? 4 : 2);
+    emit(block, op, a, b, skipped & 0xFFFFu, block.instructions);
+    add_range(block, next, next + 2);
+}
+
+// Mirrors the opcode handlers in chip8.cpp, including the order in which VF and VX are written (it matters
+// when X is F)
+template <typename Quirks>
+static IrBlock build_block(const Memory &memory, uint32_t address) {
+    IrBlock block;
+    block.start = static_cast<uint16_t>(address);
+    block.instructions = 0;
+    // Most instructions are a handful of IR instructions, so the block rarely grows past this
+    block.code.reserve(8 * IR_MAX_BLOCK_INSTRUCTIONS);
+    block.ranges.reserve(IR_MAX_BLOCK_INSTRUCTIONS);
+
+    for (;;) {
+        uint16_t opcode = read_opcode(memory, address);
+        int x = (opcode & 0x0F00u) >> 8u;
+        int y = (opcode & 0x00F0u) >> 4u;
+        uint16_t nn = opcode & 0x00FFu;
+        uint16_t nnn = opcode & 0x0FFFu;
+        uint32_t next = address + 2;
+        uint16_t vx, vy, value, flag;
+        ++block.instructions;
+        add_range(block, address, address + 2);
+
+        switch (classify_opcode(opcode)) {
+            case OpKind::Nop:
+                break;
+
+            // Jumps are followed, unless they spin until the next timer tick
+            case OpKind::Op1NNN:
+                if (nnn == address || nnn + 4u == address) {
+                    emit(block, IrOp::Jump, 0, 0, nnn, nnn == address ? IR_IDLE_ALWAYS : IR_IDLE_TIMER_WAIT);
+                    return block;
+                }
+                next = nnn;
+                break;
+
+            case OpKind::Op2NNN:
+                emit(block, IrOp::Call, 0, 0, next & 0xFFFFu);
+                next = nnn;
+                break;
+
+            case OpKind::Op00EE:
+                emit(block, IrOp::Return);
+                return block;
+
+            case OpKind::Op3XNN:
+                emit_skip(block, memory, IrOp::ExitIfEqual, emit_get(block, x), emit_const(block, nn), next);
+                break;
+
+            case OpKind::Op4XNN:
+                emit_skip(block, memory, IrOp::ExitIfNotEqual, emit_get(block, x), emit_const(block, nn), next);
+                break;
+
+            case OpKind::Op5XY0:
+                emit_skip(block, memory, IrOp::ExitIfEqual, emit_get(block, x), emit_get(block, y), next);
+                break;
+
+            case OpKind::Op9XY0:
+                emit_skip(block, memory, IrOp::ExitIfNotEqual, emit_get(block, x), emit_get(block, y), next);
+                break;
+
+            case OpKind::OpEX9E:
+                value = emit(block, IrOp::Key, emit_get(block, x));
+                emit_skip(block, memory, IrOp::ExitIfEqual, value, emit_const(block, 1), next);
+                break;
+
+            case OpKind::OpEXA1:
+                value = emit(block, IrOp::Key, emit_get(block, x));
+                emit_skip(block, memory, IrOp::ExitIfNotEqual, value, emit_const(block, 1), next);
+                break;
+
+            case OpKind::Op6XNN:
+                emit_set(block, x, emit_const(block, nn));
+                break;
+
+            case OpKind::Op7XNN:
+                emit_set(block, x, emit(block, IrOp::Add, emit_get(block, x), emit_const(block, nn)));
+                break;
+
+            case OpKind::Op8XY0:
+                emit_set(block, x, emit_get(block, y));
+                break;
+
+            case OpKind::Op8XY1:
+            case OpKind::Op8XY2:
+            case OpKind::Op8XY3: {
+                static const IrOp LOGIC[] = { IrOp::Or, IrOp::And, IrOp::Xor };
+                vx = emit_get(block, x);
+                vy = emit_get(block, y);
+                emit_set(block, x, emit(block, LOGIC[(opcode & 0xF) - 1], vx, vy));
+                if (Quirks::logic_resets_vf) {
+                    emit_set(block, IR_SLOT_VF, emit_const(block, 0));
+                }
+                break;
+            }
+
+            case OpKind::Op8XY4:
+                vx = emit_get(block, x);
+                vy = emit_get(block, y);
+                value = emit(block, IrOp::Add, vx, vy);
+                emit_set(block, IR_SLOT_VF, emit(block, IrOp::Carry, vx, vy));
+                emit_set(block, x, value);
+                break;
+
+            case OpKind::Op8XY5:
+            case OpKind::Op8XY7: {
+                bool reverse = (opcode & 0xF) == 7;
+                vx = emit_get(block, x);
+                vy = emit_get(block, y);
+                emit_set(block, IR_SLOT_VF, emit(block, reverse ? IrOp::NotGreater : IrOp::Greater, vx, vy));
+                // The difference is taken after VF is written
+                vx = emit_get(block, x);
+                vy = emit_get(block, y);
+                emit_set(block, x, reverse ? emit(block, IrOp::Sub, vy, vx) : emit(block, IrOp::Sub, vx, vy));
+                break;
+            }
+
+            case OpKind::Op8XY6:
+            case OpKind::Op8XYE: {
+                bool left = (opcode & 0xF) == 0xE;
+                value = emit_get(block, Quirks::shift_uses_vy ? y : x);
+                emit_set(block, x, emit(block, left ? IrOp::Shl : IrOp::Shr, value));
+                flag = emit(block, left ? IrOp::HighBit : IrOp::LowBit, value);
+                emit_set(block, IR_SLOT_VF, flag);
+                break;
+            }
+
+            case OpKind::OpANNN:
+                emit_set(block, IR_SLOT_I, emit_const(block, nnn));
+                break;
+
+            case OpKind::OpFX07:
+                emit_set(block, x, emit_get(block, IR_SLOT_DELAY));
+                break;
+
+            case OpKind::OpFX15:
+                emit_set(block, IR_SLOT_DELAY, emit_get(block, x));
+                break;
+
+            case OpKind::OpFX18:
+                emit_set(block, IR_SLOT_SOUND, emit_get(block, x));
+                break;
+
+            case OpKind::OpFX1E:
+                value = emit_get(block, IR_SLOT_I);
+                emit_set(block, IR_SLOT_I, emit(block, IrOp::AddIndex, value, emit_get(block, x)));
+                break;
+
+            case OpKind::OpFX29:
+                emit_set(block, IR_SLOT_I, emit(block, IrOp::FontAddress, emit_get(block, x)));
+                break;
+
+            // Display, random numbers and register loads run through the interpreter
+            case OpKind::Op00E0:
+            case OpKind::Op00CN:
+            case OpKind::Op00DN:
+            case OpKind::Op00FB:
+            case OpKind::Op00FC:
+            case OpKind::Op00FE:
+            case OpKind::Op00FF:
+            case OpKind::OpFN01:
+                emit_interp(block, address, opcode, 0, 0);
+                break;
+
+            case OpKind::OpCXNN:
+                emit_interp(block, address, opcode, 0, slot_bit(x));
+                break;
+
+            case OpKind::OpDXYN:
+                emit_interp(block, address, opcode, slot_bit(x) | slot_bit(y) | slot_bit(IR_SLOT_I),
+                            slot_bit(IR_SLOT_VF));
+                break;
+
+            case OpKind::OpFX30:
+                emit_interp(block, address, opcode, slot_bit(x), slot_bit(IR_SLOT_I));
+                break;
+
+            case OpKind::OpFX65:
+                emit_interp(block, address, opcode, slot_bit(IR_SLOT_I),
+                            register_range(0, x) | (Quirks::load_store_increments_i ? slot_bit(IR_SLOT_I) : 0));
+                break;
+
+            case OpKind::OpFX75:
+                emit_interp(block, address, opcode, register_range(0, x), 0);
+                break;
+
+            case OpKind::OpFX85:
+                emit_interp(block, address, opcode, 0, register_range(0, x));
+                break;
+
+            case OpKind::Op5XY3:
+                emit_interp(block, address, opcode, slot_bit(IR_SLOT_I), register_range(x, y));
+                break;
+
+            case OpKind::OpF000:
+                emit_interp(block, address, opcode, 0, slot_bit(IR_SLOT_I));
+                add_range(block, next, next + 2);
+                next = address + 4;
+                break;
+
+            // Stores may overwrite the rest of the block, so it ends after them
+            case OpKind::OpFX33:
+                emit_interp(block, address, opcode, slot_bit(x) | slot_bit(IR_SLOT_I), 0);
+                emit(block, IrOp::Jump, 0, 0, next & 0xFFFFu, IR_IDLE_NEVER);
+                return block;
+
+            case OpKind::OpFX55:
+                emit_interp(block, address, opcode, register_range(0, x) | slot_bit(IR_SLOT_I),
+                            Quirks::load_store_increments_i ? slot_bit(IR_SLOT_I) : 0);
+                emit(block, IrOp::Jump, 0, 0, next & 0xFFFFu, IR_IDLE_NEVER);
+                return block;
+
+            case OpKind::Op5XY2:
+                emit_interp(block, address, opcode, register_range(x, y) | slot_bit(IR_SLOT_I), 0);
+                emit(block, IrOp::Jump, 0, 0, next & 0xFFFFu, IR_IDLE_NEVER);
+                return block;
+
+            // Computed jumps, key waits, exits and illegal opcodes leave pc to the interpreter
+            default:
+                emit_interp(block, address, opcode, IR_ALL_SLOTS, 0);
+                emit(block, IrOp::Exit);
+                return block;
+        }
+
+        address = next;
+        if (block.instructions == IR_MAX_BLOCK_INSTRUCTIONS) {
+            emit(block, IrOp::Jump, 0, 0, address & 0xFFFFu, IR_IDLE_NEVER);
+            return block;
+        }
+    }
+}
+
+IrBlock build_ir_block(const Memory &memory, uint32_t address, QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::SuperChip:
+            return build_block<SuperChipQuirks>(memory, address);
+        case QuirkProfile::XoChip:
+            return build_block<XoChipQuirks>(memory, address);
+        case QuirkProfile::CosmacVip:
+            return build_block<CosmacVipQuirks>(memory, address);
+        default:
+            return build_block<Chip8Quirks>(memory, address);
+    }
+}
+
+bool ir_is_terminator(IrOp op) {
+    return op == IrOp::Jump || op == IrOp::Return || op == IrOp::Exit;
+}
+
+bool ir_has_value(IrOp op) {
+    return op >= IrOp::Const && op <= IrOp::Key;
+}
+
+int ir_operand_count(IrOp op) {
+    switch (op) {
+        case IrOp::Shr:
+        case IrOp::Shl:
+        case IrOp::LowBit:
+        case IrOp::HighBit:
+        case IrOp::FontAddress:
+        case IrOp::Key:
+        case IrOp::Set:
+            return 1;
+        case IrOp::Add:
+        case IrOp::Sub:
+        case IrOp::And:
+        case IrOp::Or:
+        case IrOp::Xor:
+        case IrOp::Carry:
+        case IrOp::Greater:
+        case IrOp::NotGreater:
+        case IrOp::AddIndex:
+        case IrOp::ExitIfEqual:
+        case IrOp::ExitIfNotEqual:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+uint32_t ir_evaluate(const IrInst &inst, uint32_t a, uint32_t b) {
+    switch (inst.op) {
+        case IrOp::Const:       return inst.imm;
+        case IrOp::Add:         return (a + b) & 0xFFu;
+        case IrOp::Sub:         return (a - b) & 0xFFu;
+        case IrOp::And:         return a & b;
+        case IrOp::Or:          return a | b;
+        case IrOp::Xor:         return a ^ b;
+        case IrOp::Shr:         return a >> 1;
+        case IrOp::Shl:         return (a << 1) & 0xFFu;
+        case IrOp::Carry:       return a + b > 255u ? 1 : 0;
+        case IrOp::Greater:     return a > b ? 1 : 0;
+        case IrOp::NotGreater:  return a > b ? 0 : 1;
+        case IrOp::LowBit:      return a & 1u;
+        case IrOp::HighBit:     return (a >> 7) & 1u;
+        case IrOp::AddIndex:    return (a + b) & 0xFFFFu;
+        case IrOp::FontAddress: return FONTSET_START_ADDRESS + 5 * (a & 0xFu);
+        default:                return 0;
+    }
+}
+
+void forward_slots(IrBlock &block) {
+    std::vector<uint16_t> replacement(block.code.size());
+    bool known[IR_SLOT_COUNT] = {};
+    uint16_t value[IR_SLOT_COUNT];
+
+    for (size_t i = 0; i < block.code.size(); ++i) {
+        IrInst &inst = block.code[i];
+        replacement[i] = static_cast<uint16_t>(i);
+        int operands = ir_operand_count(inst.op);
+        if (operands > 0) {
+            inst.a = replacement[inst.a];
+        }
+        if (operands > 1) {
+            inst.b = replacement[inst.b];
+        }
+
+        switch (inst.op) {
+            case IrOp::Get:
+                if (known[inst.imm]) {
+                    replacement[i] = value[inst.imm];
+                    inst.op = IrOp::Nop;
+                } else {
+                    known[inst.imm] = true;
+                    value[inst.imm] = static_cast<uint16_t>(i);
+                }
+                break;
+
+            case IrOp::Set:
+                known[inst.imm] = true;
+                value[inst.imm] = inst.a;
+                break;
+
+            case IrOp::Interp:
+                for (int slot = 0; slot < IR_SLOT_COUNT; ++slot) {
+                    if (inst.writes & slot_bit(slot)) {
+                        known[slot] = false;
+                    }
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+void propagate_constants(IrBlock &block) {
+    std::vector<IrInst> &code = block.code;
+
+    for (size_t i = 0; i < code.size(); ++i) {
+        IrInst &inst = code[i];
+        int operands = ir_operand_count(inst.op);
+        if (operands == 0 || inst.op == IrOp::Set || inst.op == IrOp::Key) {
+            continue;
+        }
+        bool constant = code[inst.a].op == IrOp::Const && (operands == 1 || code[inst.b].op == IrOp::Const);
+
+        if (inst.op == IrOp::ExitIfEqual || inst.op == IrOp::ExitIfNotEqual) {
+            bool same = inst.a == inst.b;
+            if (!constant && !same) {
+                continue;
+            }
+            bool equal = same || code[inst.a].imm == code[inst.b].imm;
+            if (equal != (inst.op == IrOp::ExitIfEqual)) {
+                inst.op = IrOp::Nop;
+                continue;
+            }
+            // Always taken, the rest of the block never runs
+            block.instructions = static_cast<int>(inst.imm2);
+            inst.op = IrOp::Jump;
+            inst.imm2 = IR_IDLE_NEVER;
+            code.resize(i + 1);
+            break;
+        } else if (constant) {
+            uint32_t result = ir_evaluate(inst, code[inst.a].imm, operands > 1 ? code[inst.b].imm : 0);
+            inst.op = IrOp::Const;
+            inst.imm = result;
+        }
+    }
+}
+
+// Same value: the same instruction, or equal constants
+static bool same_value(const IrBlock &block, uint16_t a, uint16_t b) {
+    return a == b || (block.code[a].op == IrOp::Const && block.code[b].op == IrOp::Const &&
+                      block.code[a].imm == block.code[b].imm);
+}
+
+void remove_redundant_stores(IrBlock &block) {
+    bool known[IR_SLOT_COUNT] = {};
+    uint16_t value[IR_SLOT_COUNT];
+
+    for (size_t i = 0; i < block.code.size(); ++i) {
+        IrInst &inst = block.code[i];
+        switch (inst.op) {
+            case IrOp::Get:
+                known[inst.imm] = true;
+                value[inst.imm] = static_cast<uint16_t>(i);
+                break;
+
+            case IrOp::Set:
+                if (known[inst.imm] && same_value(block, value[inst.imm], inst.a)) {
+                    inst.op = IrOp::Nop;
+                } else {
+                    known[inst.imm] = true;
+                    value[inst.imm] = inst.a;
+                }
+                break;
+
+            case IrOp::Interp:
+                for (int slot = 0; slot < IR_SLOT_COUNT; ++slot) {
+                    if (inst.writes & slot_bit(slot)) {
+                        known[slot] = false;
+                    }
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+// Backwards liveness over the slots. Everything is live where the block can be left.
+void eliminate_dead_stores(IrBlock &block) {
+    uint32_t live = IR_ALL_SLOTS;
+
+    for (size_t i = block.code.size(); i-- > 0;) {
+        IrInst &inst = block.code[i];
+        if (ir_is_terminator(inst.op) || inst.op == IrOp::ExitIfEqual || inst.op == IrOp::ExitIfNotEqual) {
+            live = IR_ALL_SLOTS;
+        } else if (inst.op == IrOp::Set) {
+            if (!(live & slot_bit(inst.imm))) {
+                inst.op = IrOp::Nop;
+            } else {
+                live &= ~slot_bit(inst.imm);
+            }
+        } else if (inst.op == IrOp::Get) {
+            live |= slot_bit(inst.imm);
+        } else if (inst.op == IrOp::Interp) {
+            live = (live & ~inst.writes) | inst.reads;
+        }
+    }
+}
+
+void eliminate_dead_code(IrBlock &block) {
+    std::vector<IrInst> &code = block.code;
+    std::vector<bool> used(code.size(), false);
+
+    // Effects and terminators are always kept, values only if something kept uses them
+    for (size_t i = code.size(); i-- > 0;) {
+        const IrInst &inst = code[i];
+        if (inst.op == IrOp::Nop || (ir_has_value(inst.op) && !used[i])) {
+            continue;
+        }
+        used[i] = true;
+        int operands = ir_operand_count(inst.op);
+        if (operands > 0) {
+            used[inst.a] = true;
+        }
+        if (operands > 1) {
+            used[inst.b] = true;
+        }
+    }
+
+    std::vector<uint16_t> renumbered(code.size());
+    size_t kept = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+        if (!used[i] || code[i].op == IrOp::Nop) {
+            continue;
+        }
+        IrInst inst = code[i];
+        int operands = ir_operand_count(inst.op);
+        if (operands > 0) {
+            inst.a = renumbered[inst.a];
+        }
+        if (operands > 1) {
+            inst.b = renumbered[inst.b];
+        }
+        renumbered[i] = static_cast<uint16_t>(kept);
+        code[kept++] = inst;
+    }
+    code.resize(kept);
+}
+
+void optimize_ir_block(IrBlock &block) {
+    forward_slots(block);
+    propagate_constants(block);
+    remove_redundant_stores(block);
+    eliminate_dead_stores(block);
+    eliminate_dead_code(block);
+}
+
+static const char *IR_OP_NAMES[] = {
+    "Nop", "Const", "Get", "Add", "Sub", "And", "Or", "Xor", "Shr", "Shl", "Carry", "Greater", "NotGreater",
+    "LowBit", "HighBit", "AddIndex", "FontAddress", "Key", "Set", "Interp", "Call", "ExitIfEqual",
+    "ExitIfNotEqual", "Jump", "Return", "Exit"
+};
+
+static std::string slot_name(uint32_t slot) {
+    static const char *SPECIAL[] = { "I", "DT", "ST" };
+    char name[4];
+    if (slot >= IR_SLOT_I) {
+        return SPECIAL[slot - IR_SLOT_I];
+    }
+    std::snprintf(name, sizeof(name), "V%X", slot);
+    return name;
+}
+
+std::string ir_to_string(const IrBlock &block) {
+    std::string text;
+    char line[96];
+
+    for (size_t i = 0; i < block.code.size(); ++i) {
+        const IrInst &inst = block.code[i];
+        const char *name = IR_OP_NAMES[static_cast<int>(inst.op)];
+        unsigned index = static_cast<unsigned>(i);
+
+        switch (inst.op) {
+            case IrOp::Const:
+                std::snprintf(line, sizeof(line), "v%u = Const 0x%X", index, inst.imm);
+                break;
+            case IrOp::Get:
+                std::snprintf(line, sizeof(line), "v%u = Get %s", index, slot_name(inst.imm).c_str());
+                break;
+            case IrOp::Set:
+                std::snprintf(line, sizeof(line), "Set %s, v%u", slot_name(inst.imm).c_str(), inst.a);
+                break;
+            case IrOp::Interp:
+                std::snprintf(line, sizeof(line), "Interp %04X at 0x%03X", inst.imm2, inst.imm);
+                break;
+            case IrOp::Jump:
+                std::snprintf(line, sizeof(line), "Jump 0x%03X%s", inst.imm,
+                              inst.imm2 == IR_IDLE_ALWAYS ? " (idle)"
+                              : inst.imm2 == IR_IDLE_TIMER_WAIT ? " (idle on timer wait)" : "");
+                break;
+            case IrOp::ExitIfEqual:
+            case IrOp::ExitIfNotEqual:
+                std::snprintf(line, sizeof(line), "%s v%u, v%u to 0x%03X after %u", name, inst.a, inst.b, inst.imm,
+                              inst.imm2);
+                break;
+            case IrOp::Call:
+                std::snprintf(line, sizeof(line), "Call returning to 0x%03X", inst.imm);
+                break;
+            case IrOp::Nop:
+            case IrOp::Return:
+            case IrOp::Exit:
+                std::snprintf(line, sizeof(line), "%s", name);
+                break;
+            default:
+                if (ir_operand_count(inst.op) == 1) {
+                    std::snprintf(line, sizeof(line), "v%u = %s v%u", index, name, inst.a);
+                } else {
+                    std::snprintf(line, sizeof(line), "v%u = %s v%u, v%u", index, name, inst.a, inst.b);
+                }
+                break;
+        }
+        text += line;
+        text += '\n';
+    }
+    return text;
+}
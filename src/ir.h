@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "memory.h"
+#include "quirks.h"
+
+// Small SSA-style IR for CHIP-8 code blocks, shared by the block compiler (Interpreter::Jit) and the ROM to C++
+// compiler (tools/chip8_aot.cpp), so optimizations are written once.
+//
+// A block is a superblock: it follows jumps and calls, and skips leave it through side exits, so it runs along
+// the path where no instruction is skipped. Most CHIP-8 basic blocks are only one or two instructions long.
+//
+// Every instruction that produces a value defines it exactly once, and operands name values by the index of
+// the instruction that defined them. Machine state lives in slots (V0 to VF, I and the timers): Get reads a
+// slot and Set writes it, so the unoptimized IR is a literal translation of each instruction's handler. The
+// passes then forward stored values to later reads, fold constants and drop stores nobody reads.
+// Instructions the IR doesn't model run through the reference interpreter at their address (Interp).
+
+constexpr int IR_SLOT_VF = 15;
+constexpr int IR_SLOT_I = 16;
+constexpr int IR_SLOT_DELAY = 17;
+constexpr int IR_SLOT_SOUND = 18;
+constexpr int IR_SLOT_COUNT = 19;
+constexpr uint32_t IR_ALL_SLOTS = (1u << IR_SLOT_COUNT) - 1;
+
+// A block ends after this many CHIP-8 instructions
+constexpr int IR_MAX_BLOCK_INSTRUCTIONS = 32;
+
+enum class IrOp : uint8_t {
+    Nop,          // Removed by a pass, dropped by eliminate_dead_code()
+
+    // Values, a and b are operands. Results are 8-bit, except for the I slot and the values stored to it.
+    Const,        // imm
+    Get,          // Slot imm
+    Add,          // a + b
+    Sub,          // a - b
+    And,          // a & b
+    Or,           // a | b
+    Xor,          // a ^ b
+    Shr,          // a >> 1
+    Shl,          // a << 1
+    Carry,        // 1 if a + b > 255
+    Greater,      // 1 if a > b
+    NotGreater,   // 1 if a <= b
+    LowBit,       // a & 1
+    HighBit,      // a >> 7
+    AddIndex,     // 16-bit a + b
+    FontAddress,  // Address of the small font sprite for the digit in a
+    Key,          // State of key a & 0xF, 1 if held. Not a constant even if a is.
+
+    // Effects
+    Set,          // Slot imm = a
+    Interp,       // Runs the instruction at address imm (opcode imm2) with the reference interpreter. reads and
+                  // writes are the slots it may read and the slots it always writes.
+    Call,         // Pushes return address imm
+    ExitIfEqual,  // Leaves the block for imm if a == b, after imm2 instructions (a skip)
+    ExitIfNotEqual,
+
+    // Terminators, exactly one at the end of a block
+    Jump,         // Continue at imm. imm2 is an IrIdle, for the idle detection of 1NNN (see Chip8::idle).
+    Return,       // Continue at the address popped from the stack
+    Exit          // Continue wherever the last Interp left pc
+};
+
+// How a Jump sets Chip8::idle
+enum IrIdle : uint32_t {
+    IR_IDLE_NEVER = 0,
+    IR_IDLE_ALWAYS = 1,      // Jump to itself
+    IR_IDLE_TIMER_WAIT = 2   // Jump back over two instructions, idle if Chip8::is_timer_wait(imm)
+};
+
+struct IrInst {
+    IrOp op;
+    uint16_t a;
+    uint16_t b;
+    uint32_t imm;
+    uint32_t imm2;
+    uint32_t reads;
+    uint32_t writes;
+};
+
+// Bytes first to last - 1 were decoded into the block
+struct IrRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+struct IrBlock {
+    uint16_t start;
+    int instructions;   // CHIP-8 instructions executed when the block runs to its end, side exits run fewer
+    std::vector<IrRange> ranges;  // Including the instruction after each skip, which decides the skip length
+    std::vector<IrInst> code;
+};
+
+// Decodes the block starting at address with the profile's quirks
+IrBlock build_ir_block(const Memory &memory, uint32_t address, QuirkProfile profile);
+
+// Optimization passes, in the order optimize_ir_block() runs them. Each one leaves the block valid.
+void forward_slots(IrBlock &block);            // Gets of a slot written earlier in the block use the stored value
+void propagate_constants(IrBlock &block);      // Folds operations on constants and exits on them (6XNN)
+void remove_redundant_stores(IrBlock &block);  // Drops stores of the value a slot already holds (repeated ANNN)
+void eliminate_dead_stores(IrBlock &block);    // Drops stores overwritten before anything reads them (VF flags)
+void eliminate_dead_code(IrBlock &block);      // Drops unused values and removed instructions, renumbers the rest
+void optimize_ir_block(IrBlock &block);
+
+bool ir_is_terminator(IrOp op);
+bool ir_has_value(IrOp op);
+int ir_operand_count(IrOp op);  // Value operands used, a and then b
+
+// Evaluates a value instruction on its operands, except Get and Key which depend on the machine
+uint32_t ir_evaluate(const IrInst &inst, uint32_t a, uint32_t b);
+
+// One instruction per line, "v3 = Add v1, v2"
+std::string ir_to_string(const IrBlock &block);
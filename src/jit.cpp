@@ -0,0 +1,361 @@
+#include "jit.h"
+#include <algorithm>
+#include "chip8.h"
+
+// Largest value array a block can need: 8XY5/8XY7 translate to 8 IR instructions
+static const int MAX_BLOCK_VALUES = IR_MAX_BLOCK_INSTRUCTIONS * 8 + 8;
+
+static JitInst make_inst(JitOp op, int slot, size_t dest, const IrInst &inst) {
+    JitInst lowered = { op, static_cast<uint8_t>(slot), static_cast<uint16_t>(dest), inst.a, inst.b, inst.imm,
+                        inst.imm2 };
+    return lowered;
+}
+
+// True if nothing between the two instructions writes the slot, so the machine still holds the value read at from
+static bool slot_unchanged(const IrBlock &block, uint32_t slot, size_t from, size_t to) {
+    for (size_t i = from + 1; i < to; ++i) {
+        const IrInst &inst = block.code[i];
+        if ((inst.op == IrOp::Set && inst.imm == slot) ||
+            (inst.op == IrOp::Interp && (inst.writes & (1u << slot)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A register read that can be folded into its only user at index user
+static bool foldable_get(const IrBlock &block, const std::vector<int> &uses, uint16_t value, size_t user) {
+    const IrInst &get = block.code[value];
+    return get.op == IrOp::Get && get.imm < IR_SLOT_I && uses[value] == 1 &&
+           slot_unchanged(block, get.imm, value, user);
+}
+
+JitBlock compile_ir_block(const IrBlock &block, const Chip8 &chip8) {
+    const std::vector<IrInst> &code = block.code;
+    std::vector<int> uses(code.size(), 0);
+    std::vector<bool> folded(code.size(), false);
+
+    for (size_t i = 0; i < code.size(); ++i) {
+        int operands = ir_operand_count(code[i].op);
+        if (operands > 0) {
+            ++uses[code[i].a];
+        }
+        if (operands > 1) {
+            ++uses[code[i].b];
+        }
+    }
+
+    JitBlock lowered;
+    lowered.start = block.start;
+    lowered.instructions = block.instructions;
+
+    // Emitted in reverse, so a store can fold the values it uses before they are visited
+    std::vector<JitInst> reversed;
+    reversed.reserve(code.size());
+    for (size_t i = code.size(); i-- > 0;) {
+        const IrInst &inst = code[i];
+        if (folded[i] || (ir_has_value(inst.op) && uses[i] == 0)) {
+            continue;
+        }
+
+        switch (inst.op) {
+            case IrOp::Const:
+                reversed.push_back(make_inst(JitOp::Const, 0, i, inst));
+                break;
+
+            case IrOp::Get:
+                if (inst.imm < IR_SLOT_I) {
+                    reversed.push_back(make_inst(JitOp::GetV, inst.imm, i, inst));
+                } else {
+                    JitOp op = inst.imm == IR_SLOT_I ? JitOp::GetI : JitOp::GetDelay;
+                    reversed.push_back(make_inst(op, 0, i, inst));
+                }
+                break;
+
+            case IrOp::Set: {
+                const IrInst &value = code[inst.a];
+                bool single_use = uses[inst.a] == 1;
+                if (single_use && value.op == IrOp::Const && inst.imm <= IR_SLOT_I) {
+                    // 6XNN, ANNN
+                    folded[inst.a] = true;
+                    JitInst set = make_inst(inst.imm == IR_SLOT_I ? JitOp::SetIConst : JitOp::SetVConst, inst.imm,
+                                            0, inst);
+                    set.imm = value.imm;
+                    reversed.push_back(set);
+                } else if (single_use && value.op == IrOp::Add && inst.imm < IR_SLOT_I &&
+                           code[value.a].imm == inst.imm && foldable_get(block, uses, value.a, i) &&
+                           code[value.b].op == IrOp::Const && uses[value.b] == 1) {
+                    // 7XNN
+                    folded[inst.a] = true;
+                    folded[value.a] = true;
+                    folded[value.b] = true;
+                    JitInst add = make_inst(JitOp::AddVConst, inst.imm, 0, inst);
+                    add.imm = code[value.b].imm;
+                    reversed.push_back(add);
+                } else {
+                    static const JitOp SETS[] = { JitOp::SetI, JitOp::SetDelay, JitOp::SetSound };
+                    JitOp op = inst.imm < IR_SLOT_I ? JitOp::SetV : SETS[inst.imm - IR_SLOT_I];
+                    reversed.push_back(make_inst(op, inst.imm < IR_SLOT_I ? inst.imm : 0, 0, inst));
+                }
+                break;
+            }
+
+            case IrOp::Interp: {
+                DecodedOp op;
+                op.opcode = static_cast<uint16_t>(inst.imm2);
+                op.next_opcode = 0;
+                op.kind = classify_opcode(op.opcode);
+                op.fusion = Fusion::None;
+                op.handler = chip8.handler(op.kind);
+                JitInst interp = make_inst(JitOp::Interp, 0, 0, inst);
+                interp.b = static_cast<uint16_t>(lowered.interpreted.size());
+                lowered.interpreted.push_back(op);
+                reversed.push_back(interp);
+                break;
+            }
+
+            case IrOp::Call:
+                reversed.push_back(make_inst(JitOp::Call, 0, 0, inst));
+                break;
+
+            case IrOp::ExitIfEqual:
+            case IrOp::ExitIfNotEqual: {
+                bool equal = inst.op == IrOp::ExitIfEqual;
+                const IrInst &key = code[inst.a];
+                if (key.op == IrOp::Key && uses[inst.a] == 1 && foldable_get(block, uses, key.a, inst.a) &&
+                    code[inst.b].op == IrOp::Const && code[inst.b].imm == 1 && uses[inst.b] == 1) {
+                    // EX9E, EXA1
+                    folded[inst.a] = true;
+                    folded[key.a] = true;
+                    folded[inst.b] = true;
+                    reversed.push_back(make_inst(equal ? JitOp::ExitIfKeyDown : JitOp::ExitIfKeyUp,
+                                                 code[key.a].imm, 0, inst));
+                } else if (foldable_get(block, uses, inst.a, i) && code[inst.b].op == IrOp::Const && uses[inst.b] == 1) {
+                    // 3XNN, 4XNN
+                    folded[inst.a] = true;
+                    folded[inst.b] = true;
+                    JitInst exit = make_inst(equal ? JitOp::ExitIfVEqualConst : JitOp::ExitIfVNotEqualConst,
+                                             code[inst.a].imm, 0, inst);
+                    exit.b = static_cast<uint16_t>(code[inst.b].imm);
+                    reversed.push_back(exit);
+                } else {
+                    reversed.push_back(make_inst(equal ? JitOp::ExitIfEqual : JitOp::ExitIfNotEqual, 0, 0, inst));
+                }
+                break;
+            }
+
+            case IrOp::Jump:
+                reversed.push_back(make_inst(JitOp::Jump, 0, 0, inst));
+                break;
+
+            case IrOp::Return:
+                reversed.push_back(make_inst(JitOp::Return, 0, 0, inst));
+                break;
+
+            case IrOp::Exit:
+                reversed.push_back(make_inst(JitOp::Exit, 0, 0, inst));
+                break;
+
+            case IrOp::Nop:
+                break;
+
+            default: {
+                // Add to Key are in the same order in both enums
+                int offset = static_cast<int>(inst.op) - static_cast<int>(IrOp::Add);
+                JitOp op = static_cast<JitOp>(static_cast<int>(JitOp::Add) + offset);
+                reversed.push_back(make_inst(op, 0, i, inst));
+                break;
+            }
+        }
+    }
+
+    lowered.code.assign(reversed.rbegin(), reversed.rend());
+    return lowered;
+}
+
+BlockCache::BlockCache() {
+    mask = 0;
+    first_code = 1;
+    last_code = 0;
+    stale = false;
+}
+
+// The tables are kept, only the entries of the compiled blocks are cleared
+void BlockCache::reset() {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        block_index[blocks[i].start & mask] = -1;
+    }
+    if (first_code <= last_code) {
+        std::fill(code_bytes.begin() + first_code, code_bytes.begin() + last_code + 1, 0);
+    }
+    blocks.clear();
+    first_code = 1;
+    last_code = 0;
+    stale = false;
+}
+
+void BlockCache::allocate(uint32_t memory_size) {
+    reset();
+    if (block_index.size() < memory_size) {
+        block_index.assign(memory_size, -1);
+        code_bytes.assign(memory_size, 0);
+    }
+    mask = memory_size - 1;
+}
+
+size_t BlockCache::allocated_bytes() const {
+    size_t bytes = block_index.capacity() * sizeof(int32_t) + code_bytes.capacity();
+    bytes += blocks.capacity() * sizeof(JitBlock);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        bytes += blocks[i].code.capacity() * sizeof(JitInst) + blocks[i].interpreted.capacity() * sizeof(DecodedOp);
+    }
+    return bytes;
+}
+
+const JitBlock &BlockCache::compile(const Chip8 &chip8, uint32_t address) {
+    IrBlock ir = build_ir_block(chip8.memory, address, chip8.quirks);
+    optimize_ir_block(ir);
+    for (size_t i = 0; i < ir.ranges.size(); ++i) {
+        for (uint32_t byte = ir.ranges[i].first; byte < ir.ranges[i].last; ++byte) {
+            uint32_t index = byte & mask;
+            code_bytes[index] = 1;
+            first_code = first_code > last_code ? index : std::min(first_code, index);
+            last_code = std::max(last_code, index);
+        }
+    }
+
+    block_index[address & mask] = static_cast<int32_t>(blocks.size());
+    blocks.push_back(compile_ir_block(ir, chip8));
+    return blocks.back();
+}
+
+int BlockCache::run(Chip8 &chip8, int budget) {
+    int executed = 0;
+
+    while (executed < budget && !chip8.exited && !chip8.idle) {
+        if (stale) {
+            // Code was overwritten
+            reset();
+        }
+
+        int32_t cached = block_index[chip8.pc & mask];
+        const JitBlock &block = cached >= 0 ? blocks[cached] : compile(chip8, chip8.pc);
+        // Blocks run whole, and pc beyond the end of memory is left to the interpreter
+        if (block.instructions > budget - executed || block.start != chip8.pc) {
+            break;
+        }
+        executed += execute(chip8, block);
+    }
+    return executed;
+}
+
+int BlockCache::execute(Chip8 &chip8, const JitBlock &block) {
+    uint16_t values[MAX_BLOCK_VALUES];
+    uint8_t *registers = chip8.registers;
+
+    for (const JitInst *inst = block.code.data(); ; ++inst) {
+#define A values[inst->a]
+#define B values[inst->b]
+        switch (inst->op) {
+            case JitOp::Const:       values[inst->dest] = inst->imm; break;
+            case JitOp::GetV:        values[inst->dest] = registers[inst->slot]; break;
+            case JitOp::GetI:        values[inst->dest] = chip8.index; break;
+            case JitOp::GetDelay:    values[inst->dest] = chip8.delay_timer; break;
+            case JitOp::SetV:        registers[inst->slot] = static_cast<uint8_t>(A); break;
+            case JitOp::SetI:        chip8.index = A; break;
+            case JitOp::SetDelay:    chip8.delay_timer = static_cast<uint8_t>(A); break;
+            case JitOp::SetSound:    chip8.sound_timer = static_cast<uint8_t>(A); break;
+            case JitOp::SetVConst:   registers[inst->slot] = static_cast<uint8_t>(inst->imm); break;
+            case JitOp::AddVConst:   registers[inst->slot] += static_cast<uint8_t>(inst->imm); break;
+            case JitOp::SetIConst:   chip8.index = static_cast<uint16_t>(inst->imm); break;
+            case JitOp::Add:         values[inst->dest] = (A + B) & 0xFFu; break;
+            case JitOp::Sub:         values[inst->dest] = (A - B) & 0xFFu; break;
+            case JitOp::And:         values[inst->dest] = A & B; break;
+            case JitOp::Or:          values[inst->dest] = A | B; break;
+            case JitOp::Xor:         values[inst->dest] = A ^ B; break;
+            case JitOp::Shr:         values[inst->dest] = A >> 1; break;
+            case JitOp::Shl:         values[inst->dest] = (A << 1) & 0xFFu; break;
+            case JitOp::Carry:       values[inst->dest] = A + B > 255u ? 1 : 0; break;
+            case JitOp::Greater:     values[inst->dest] = A > B ? 1 : 0; break;
+            case JitOp::NotGreater:  values[inst->dest] = A > B ? 0 : 1; break;
+            case JitOp::LowBit:      values[inst->dest] = A & 1u; break;
+            case JitOp::HighBit:     values[inst->dest] = (A >> 7) & 1u; break;
+            case JitOp::AddIndex:    values[inst->dest] = (A + B) & 0xFFFFu; break;
+            case JitOp::FontAddress: values[inst->dest] = FONTSET_START_ADDRESS + 5 * (A & 0xFu); break;
+            case JitOp::Key:         values[inst->dest] = chip8.keypad[A & 0xFu]; break;
+
+            case JitOp::Interp: {
+                const DecodedOp &op = block.interpreted[inst->b];
+                chip8.opcode = op.opcode;
+                chip8.pc = static_cast<uint16_t>(inst->imm + 2);
+                op.handler(chip8, op);
+                break;
+            }
+
+            case JitOp::Call:
+                chip8.stack[chip8.sp] = static_cast<uint16_t>(inst->imm);
+                chip8.sp = (chip8.sp + 1) & 0xFu;
+                break;
+
+            case JitOp::ExitIfEqual:
+                if (A == B) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::ExitIfNotEqual:
+                if (A != B) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::ExitIfVEqualConst:
+                if (registers[inst->slot] == inst->b) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::ExitIfVNotEqualConst:
+                if (registers[inst->slot] != inst->b) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::ExitIfKeyDown:
+                if (chip8.keypad[registers[inst->slot] & 0xFu] == 1) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::ExitIfKeyUp:
+                if (chip8.keypad[registers[inst->slot] & 0xFu] != 1) {
+                    chip8.pc = static_cast<uint16_t>(inst->imm);
+                    return static_cast<int>(inst->imm2);
+                }
+                break;
+
+            case JitOp::Jump:
+                chip8.pc = static_cast<uint16_t>(inst->imm);
+                if (inst->imm2 == IR_IDLE_ALWAYS ||
+                    (inst->imm2 == IR_IDLE_TIMER_WAIT && chip8.is_timer_wait(chip8.pc))) {
+                    chip8.idle = true;
+                }
+                return block.instructions;
+
+            case JitOp::Return:
+                chip8.sp = (chip8.sp - 1) & 0xFu;
+                chip8.pc = chip8.stack[chip8.sp];
+                return block.instructions;
+
+            case JitOp::Exit:
+                return block.instructions;
+        }
+#undef A
+#undef B
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "ir.h"
+#include "predecode.h"
+
+class Chip8;
+
+// Operations of a compiled block. Mostly the IR's, with the slot resolved and the most common instructions
+// (6XNN, 7XNN, ANNN, 3XNN, 4XNN, EX9E, EXA1) folded into single operations on the machine state.
+enum class JitOp : uint8_t {
+    Const, GetV, GetI, GetDelay,
+    SetV, SetI, SetDelay, SetSound,
+    SetVConst, AddVConst, SetIConst,
+    Add, Sub, And, Or, Xor, Shr, Shl, Carry, Greater, NotGreater, LowBit, HighBit, AddIndex, FontAddress, Key,
+    Interp, Call,
+    ExitIfEqual, ExitIfNotEqual,
+    ExitIfVEqualConst, ExitIfVNotEqualConst,  // Register slot against constant b
+    ExitIfKeyDown, ExitIfKeyUp,               // Key in register slot
+    Jump, Return, Exit
+};
+
+struct JitInst {
+    JitOp op;
+    uint8_t slot;      // Register of the operations on V
+    uint16_t dest;     // Value written by value operations
+    uint16_t a;
+    uint16_t b;
+    uint32_t imm;
+    uint32_t imm2;
+};
+
+struct JitBlock {
+    uint16_t start;
+    int instructions;  // CHIP-8 instructions on the longest path through the block
+    std::vector<JitInst> code;
+    std::vector<DecodedOp> interpreted;  // Instructions run by Interp, indexed by its b
+};
+
+// Lowers an optimized IR block, chip8 provides the handlers of the instructions left to the interpreter
+JitBlock compile_ir_block(const IrBlock &block, const Chip8 &chip8);
+
+// Cache of compiled blocks for Interpreter::Jit, compiled the first time pc reaches their start address.
+// This is not a native code generator: blocks are optimized once in the IR and then run as a flat list of
+// operations, so there is no fetch or decode per instruction, and VF flags and constant loads nobody reads are
+// never computed. Instructions the IR doesn't model (drawing, random numbers, memory) call the predecoder's
+// handlers.
+// Memory writes must be reported with invalidate(). A write to a byte a block was compiled from drops the cache
+// before the next block runs (blocks end after every store, so the running one is never affected).
+class BlockCache {
+    public:
+        BlockCache();
+
+        // Drops all blocks. The tables are allocated on first use and only grow, a smaller memory uses the start.
+        void reset();
+        bool fits(uint32_t memory_size) const { return !block_index.empty() && mask + 1 == memory_size; }
+        void allocate(uint32_t memory_size);
+
+        void invalidate(uint32_t address) {
+            if (!code_bytes.empty() && code_bytes[address & mask]) {
+                stale = true;
+            }
+        }
+
+        // Runs whole blocks while they fit in the budget, stopping early like Chip8::run_instructions().
+        // Returns the number of instructions executed, the caller runs whatever is left of the budget.
+        int run(Chip8 &chip8, int budget);
+
+        size_t block_count() const { return blocks.size(); }
+        size_t allocated_bytes() const;  // Tables and compiled blocks
+
+    private:
+        std::vector<JitBlock> blocks;
+        std::vector<int32_t> block_index;  // Per start address, -1 if not compiled
+        std::vector<uint8_t> code_bytes;   // Non-zero for bytes a block was compiled from
+        uint32_t mask;
+        uint32_t first_code;  // Range of the non-zero code_bytes, empty if first > last
+        uint32_t last_code;
+        bool stale;
+
+        const JitBlock &compile(const Chip8 &chip8, uint32_t address);
+        int execute(Chip8 &chip8, const JitBlock &block);  // Returns the number of instructions run
+};
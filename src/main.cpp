@@ -1,85 +1,436 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include "chip8.cpp"
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <algorithm>
+#include "chip8.h"
+#include "rom_db.h"
+#include "blender.h"
+#include "config.h"
+#include "coverage.h"
+#include "frame_pacer.h"
+#include "gdb_stub.h"
+#include "heatmap.h"
+#include "quirk_infer.h"
+#include "triple_buffer.h"
 #include <SDL.h>
 
-//Screen dimension constants
-const int SCREEN_WIDTH = 64;
-const int SCREEN_HEIGHT = 32;
+// Timers tick and the screen is presented at 60 Hz
+const float FRAME_DELAY = 1000.0f / 60;
+
+// While fast-forwarding only every Nth frame is handed to the main thread
+const int FAST_FORWARD_FRAME_SKIP = 8;
+
+// Frames between the access count snapshots shown in the heatmap window
+const int HEATMAP_SNAPSHOT_FRAMES = 10;
 
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *texture;
 SDL_Event event;
 
-bool initialize_window();
-bool accept_input(uint8_t *);
-void update_frame(void const *, int);
+// Heatmap window, nullptr unless --heatmap-window
+SDL_Window *heatmap_window = nullptr;
+SDL_Renderer *heatmap_renderer = nullptr;
+SDL_Texture *heatmap_texture = nullptr;
+
+// Set when the window needs repainting even though the display hasn't changed (e.g. uncovered)
+bool redraw_window = true;
+
+// Shared between the main thread (SDL events and presentation) and the emulation thread
+TripleBuffer<Display> frames;
+TripleBuffer<AccessCounts> access_snapshots;  // Copies of the access counts for the heatmap window
+std::atomic<uint16_t> key_state(0); // Bit N is set while CHIP-8 key N is held
+std::atomic<uint16_t> released_keys(0); // Bit N is set when CHIP-8 key N was released, cleared by the emulation
+std::atomic<bool> stop_emulation(false);
+std::atomic<bool> emulation_exited(false);
+std::atomic<bool> fast_forward(false); // Run unthrottled, set while the fast-forward key (Tab) is held
+
+bool initialize_window(const char *title, int scale);
+bool initialize_heatmap_window(uint32_t memory_size);
+void update_heatmap(uint32_t memory_size);
+bool accept_input(uint8_t *, const char *);
+int run_frame(Chip8 *, const Config &, Timeline *);
+void press_key(Chip8 *, Timeline *, uint8_t, bool);
+void run_emulation(Chip8 *, const Config &, GdbStub *, Timeline *);
+void run_headless(Chip8 *, const Config &, GdbStub *, Timeline *);
+void print_profile(const Chip8 *);
+void save_run_coverage(const Chip8 *, const Config &);
+void save_run_heatmap(const Chip8 *, const Config &);
+void report_stop(const Chip8 *);
+QuirkProfile lookup_or_infer_quirks(const std::shared_ptr<const RomImage> &, const std::string &);
+bool update_frame(FrameBlender &, uint64_t, const uint32_t *);
 void log_SDL_error(const std::string &s = "");    
 void close();
  
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Insufficient argument. Usage: " << argv[0] << " <ROM>\n";
+    Config config;
+    std::string error;
+    if (!parse_command_line(argc, argv, config, error)) {
+        std::cerr << error << "\nUsage: " << argv[0] << " " << CONFIG_USAGE;
         std::exit(EXIT_FAILURE);
     }
 
-    char const *rom_path = argv[1];
+    std::shared_ptr<const RomImage> rom = RomImage::from_file(config.rom_path.c_str());
+    if (rom == nullptr) {
+        std::cerr << "Could not read ROM: " << config.rom_path << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    // Known ROMs get their quirks, speed, keys and colours from the database. Settings given on the command
+    // line or in a config file take precedence.
+    const RomInfo *rom_info = find_rom_info(rom->hash);
+    if (!config.has_profile && rom_info == nullptr) {
+        // Unknown ROMs get a profile inferred from their code, cached by hash so the trial runs only once
+        config.profile = lookup_or_infer_quirks(rom, config.quirk_cache);
+    } else if (!config.has_profile) {
+        config.profile = rom_info->profile;
+    }
+    if (rom_info == nullptr) {
+        rom_info = &DEFAULT_ROM_INFO;
+    }
+    if (config.cycles_per_frame == 0) {
+        config.cycles_per_frame = rom_info->cycles_per_frame;
+    }
+    if (config.palette < 0) {
+        config.palette = rom_info->palette;
+    }
 
     Chip8 *chip8 = new Chip8();
     chip8->init();
-    chip8->load_rom(rom_path);
+    chip8->set_quirks(config.profile);
+    if (config.has_seed) {
+        chip8->randGen.seed(config.seed);
+    }
+    if (!chip8->load_rom(rom)) {
+        std::cerr << "ROM is too large (" << rom->rom_size << " bytes, " << chip8->max_rom_size()
+                  << " available for " << quirk_profile_name(config.profile) << ")\n";
+        std::exit(EXIT_FAILURE);
+    }
+    chip8->cycles_per_frame = config.cycles_per_frame;
+    chip8->interpreter = config.interpreter;
+    chip8->profiling = config.profile_opcodes || !config.heatmap.empty() || config.heatmap_window;
+    chip8->set_coverage(!config.coverage.empty());
+
+    // The debugger connects before the first instruction runs. The session is recorded for it to go back in.
+    GdbStub *gdb = nullptr;
+    Timeline *timeline = nullptr;
+    if (!config.gdb.empty()) {
+        gdb = new GdbStub(*chip8);
+        timeline = new Timeline(*chip8);
+        gdb->set_timeline(timeline);
+        std::cerr << "Waiting for GDB on " << config.gdb << "\n";
+        if (!gdb->listen(config.gdb, error)) {
+            std::cerr << error << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
 
-    // In milliseconds. Should be defined by user in argc. Hard code it for now.
-    int cycle_delay = 50;
+    if (config.headless_frames > 0) {
+        run_headless(chip8, config, gdb, timeline);
+        delete gdb;
+        delete timeline;
+        report_stop(chip8);
+        if (config.profile_opcodes) {
+            print_profile(chip8);
+        }
+        save_run_coverage(chip8, config);
+        save_run_heatmap(chip8, config);
+        return 0;
+    }
+
+    const char *keymap = KEYMAPS[rom_info->keymap];
+    const uint32_t *palette = PALETTES[config.palette];
 
-    int video_pitch = sizeof(chip8->display[0]) * SCREEN_WIDTH;
+    // Phosphor blending fades pixels out over a few frames to hide XOR sprite flicker
+    FrameBlender blender(config.blend);
+
+    initialize_window(rom_info->title, config.scale);
+    if (config.heatmap_window) {
+        initialize_heatmap_window(chip8->memory.size());
+    }
 
-    initialize_window();
+    // Emulation runs on its own thread so a slow (vsynced) present never delays it
+    std::thread emulation(run_emulation, chip8, std::cref(config), gdb, timeline);
 
-	auto last_cycle_time = std::chrono::high_resolution_clock::now();
+    uint8_t keys[16] = {0};
+    Display shown;
     bool quit = false;
 
     while (!quit) {
-        quit = accept_input(chip8->keypad);
+        quit = accept_input(keys, keymap) || emulation_exited.load();
 
-        auto current_time = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(current_time - last_cycle_time).count();
-
-        if (dt > cycle_delay) {
-            last_cycle_time = current_time;
-            chip8->emulate_cycle();
-            update_frame(chip8->display, video_pitch);
+        uint16_t pressed = 0;
+        for (int key = 0; key < 16; ++key) {
+            pressed |= keys[key] << key;
+        }
+        key_state.store(pressed, std::memory_order_relaxed);
+
+        // Present the newest completed frame, frames the emulation finished in the meantime are skipped
+        bool presented = false;
+        if (frames.acquire()) {
+            shown.copy_from(frames.front());
+            presented = update_frame(blender, blender.update(shown), palette);
+        } else if (redraw_window) {
+            presented = update_frame(blender, 0, palette);
+        }
+        if (heatmap_window != nullptr && access_snapshots.acquire()) {
+            update_heatmap(chip8->memory.size());
+        }
+        if (!presented) {
+            SDL_Delay(1);
         }
     }
 
+    stop_emulation.store(true);
+    emulation.join();
+    delete gdb;
+    delete timeline;
+
     close();
+    report_stop(chip8);
+    if (config.profile_opcodes) {
+        print_profile(chip8);
+    }
+    save_run_coverage(chip8, config);
+    save_run_heatmap(chip8, config);
     return 0;
 }
 
+// Runs one frame and ticks the timers. Returns the number of instructions executed.
+// Traced frames run one instruction at a time, printing each one before it runs. Recorded frames aren't traced.
+int run_frame(Chip8 *chip8, const Config &config, Timeline *timeline) {
+    if (timeline != nullptr) {
+        return static_cast<int>(timeline->run_frames(1).instructions);
+    }
+    if (!config.trace) {
+        return static_cast<int>(chip8->run_frames(1).instructions);
+    }
+
+    RunResult result = chip8->run_until([](const Chip8 &c) {
+        std::fprintf(stderr, "%04X: %04X I=%04X\n", c.pc, c.memory.read(c.pc) << 8 | c.memory.read(c.pc + 1), c.index);
+        return false;
+    }, chip8->cycles_per_frame);
+    chip8->tick_timers();
+    return static_cast<int>(result.instructions);
+}
+
+// Keys go through the timeline while one records, so replays see them
+void press_key(Chip8 *chip8, Timeline *timeline, uint8_t key, bool pressed) {
+    if (timeline != nullptr) {
+        timeline->key_event(key, pressed);
+    } else {
+        chip8->key_event(key, pressed);
+    }
+}
+
+// Runs the ROM at 60 frames per second and publishes every completed frame for the main thread.
+// When fast-forwarding (turbo, or the key held) frames run back to back and only every Nth one is published.
+// While a debugger has the machine stopped only the debugger is served, and the display is published as it goes.
+void run_emulation(Chip8 *chip8, const Config &config, GdbStub *gdb, Timeline *timeline) {
+    auto frame_duration = std::chrono::duration_cast<FramePacer::Clock::duration>(
+        std::chrono::duration<float, std::milli>(FRAME_DELAY));
+    FramePacer pacer(frame_duration, FAST_FORWARD_FRAME_SKIP, FramePacer::Clock::now());
+
+    while (!stop_emulation.load(std::memory_order_relaxed) && !chip8->exited) {
+        if (gdb != nullptr && gdb->stopped()) {
+            gdb->poll(10);
+            frames.back() = chip8->display;
+            frames.publish();
+            pacer.restart(FramePacer::Clock::now());
+            continue;
+        }
+
+        bool unthrottled = config.turbo || fast_forward.load(std::memory_order_relaxed);
+
+        // A key tapped between two frames is replayed as a press and a release, so FX0A still sees it
+        uint16_t pressed = key_state.load(std::memory_order_relaxed);
+        uint16_t released = released_keys.exchange(0, std::memory_order_relaxed);
+        for (int key = 0; key < 16; ++key) {
+            if ((released >> key) & 1u) {
+                press_key(chip8, timeline, key, true);
+                press_key(chip8, timeline, key, false);
+            }
+            press_key(chip8, timeline, key, (pressed >> key) & 1u);
+        }
+
+        run_frame(chip8, config, timeline);
+        if (gdb != nullptr) {
+            gdb->check_stop();
+            gdb->poll(0);
+        }
+
+        if (pacer.frame_done(unthrottled, FramePacer::Clock::now())) {
+            frames.back() = chip8->display;
+            frames.publish();
+        }
+        if (config.heatmap_window && pacer.frame_count() % HEATMAP_SNAPSHOT_FRAMES == 0) {
+            access_snapshots.back() = chip8->access_counts;
+            access_snapshots.publish();
+        }
+
+        if (!unthrottled) {
+            std::this_thread::sleep_until(pacer.next_frame());
+        }
+    }
+    emulation_exited.store(true);
+}
+
+// Runs the ROM as fast as possible without a window and reports the achieved speed.
+// Nobody presses keys, so a ROM waiting for one just runs empty frames until the end.
+// Under a debugger frames run one at a time, so an interrupt is seen within a frame.
+void run_headless(Chip8 *chip8, const Config &config, GdbStub *gdb, Timeline *timeline) {
+    auto start = std::chrono::steady_clock::now();
+    long frame = 0;
+    long long cycles = 0;
+
+    while (frame < config.headless_frames && !chip8->exited) {
+        if (gdb != nullptr && gdb->stopped()) {
+            gdb->poll(-1);
+            continue;
+        }
+        if (config.trace && timeline == nullptr) {
+            cycles += run_frame(chip8, config, timeline);
+            ++frame;
+        } else {
+            RunResult result = timeline != nullptr ? timeline->run_frames(1)
+                                                   : chip8->run_frames(config.headless_frames - frame);
+            cycles += result.instructions;
+            frame += result.frames;
+        }
+        if (gdb != nullptr) {
+            gdb->check_stop();
+            gdb->poll(0);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long long idle_cycles = static_cast<long long>(frame) * config.cycles_per_frame - cycles;
+    std::cout << "Ran " << frame << " frames (" << cycles << " cycles, " << idle_cycles << " skipped idle) in "
+              << seconds << " s: " << static_cast<long long>(cycles / std::max(seconds, 1e-9)) << " cycles/s\n";
+}
+
+void report_stop(const Chip8 *chip8) {
+    if (chip8->illegal_opcode) {
+        uint16_t opcode = chip8->memory.read(chip8->pc) << 8 | chip8->memory.read(chip8->pc + 1);
+        std::fprintf(stderr, "Stopped at illegal opcode %04X at %04X\n", opcode, chip8->pc);
+    }
+}
+
+// Profile of a ROM that isn't in the database: from the cache, or inferred and then cached
+QuirkProfile lookup_or_infer_quirks(const std::shared_ptr<const RomImage> &rom, const std::string &cache_path) {
+    QuirkProfile profile;
+    if (find_cached_quirks(cache_path, rom->hash, profile)) {
+        return profile;
+    }
+    QuirkInference inference = infer_quirks(rom, QUIRK_TRIAL_FRAMES);
+    std::cerr << "Unknown ROM, using " << quirk_profile_name(inference.profile) << " quirks\n";
+    for (const std::string &reason : inference.reasons) {
+        std::cerr << "  " << reason << "\n";
+    }
+    cache_quirks(cache_path, rom->hash, inference.profile);
+    return inference.profile;
+}
+
+void print_profile(const Chip8 *chip8) {
+    uint64_t total = 0;
+    for (int i = 0; i < 16; ++i) {
+        total += chip8->opcode_counts[i];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    std::printf("Instructions executed: %llu\n", static_cast<unsigned long long>(total));
+    for (int i = 0; i < 16; ++i) {
+        if (chip8->opcode_counts[i] != 0) {
+            std::printf("  %Xxxx      %12llu %6.2f%%\n", i, static_cast<unsigned long long>(chip8->opcode_counts[i]),
+                        100.0 * chip8->opcode_counts[i] / total);
+        }
+    }
+
+    // Share of all instructions that ran as part of each superinstruction
+    std::printf("Superinstructions:\n");
+    for (int i = 1; i < FUSION_COUNT; ++i) {
+        uint64_t count = chip8->fusion_counts[i];
+        std::printf("  %s %12llu %6.2f%%\n", fusion_name(static_cast<Fusion>(i)),
+                    static_cast<unsigned long long>(count), 100.0 * 2 * count / total);
+    }
+
+    // How much memory copy-on-write pages of each size would copy for the bytes the ROM wrote
+    const std::vector<uint32_t> &writes = chip8->access_counts.writes;
+    uint32_t written = 0;
+    for (uint32_t address = 0; address < writes.size(); ++address) {
+        written += writes[address] != 0;
+    }
+    if (written == 0) {
+        return;
+    }
+    std::printf("Bytes written: %u\n", written);
+    for (uint32_t page_size = 64; page_size <= 4096; page_size *= 4) {
+        uint32_t pages = 0;
+        for (uint32_t page = 0; page < writes.size(); page += page_size) {
+            pages += std::any_of(writes.begin() + page, writes.begin() + page + page_size,
+                                 [](uint32_t count) { return count != 0; });
+        }
+        std::printf("  %4u byte pages %6u %8u bytes copied\n", page_size, pages, pages * page_size);
+    }
+}
+
+void save_run_coverage(const Chip8 *chip8, const Config &config) {
+    if (config.coverage.empty()) {
+        return;
+    }
+    RomCoverage coverage;
+    coverage.rom_hash = chip8->rom_hash;
+    coverage.runs = 1;
+    coverage.code.merge(chip8->code_coverage);
+    coverage.data.merge(chip8->data_coverage);
+    std::string error;
+    if (!save_coverage(config.coverage, coverage, error)) {
+        std::cerr << error << "\n";
+    }
+}
+
+void save_run_heatmap(const Chip8 *chip8, const Config &config) {
+    if (config.heatmap.empty()) {
+        return;
+    }
+    Heatmap heatmap;
+    render_heatmap(chip8->access_counts, chip8->memory.size(), heatmap);
+    std::string error;
+    if (!save_heatmap(config.heatmap, heatmap, heatmap_scale(heatmap), error)) {
+        std::cerr << error << "\n";
+    }
+}
+
 // abstract the implementation into a class (OOP!)
-bool initialize_window() {
+// The window is the lo-res 64x32 screen times scale, hi-res frames are drawn at half the scale to fit
+bool initialize_window(const char *title, int scale) {
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         log_SDL_error("SDL_Init has failed");
         return false;
     }
 
-    // SCREEN_WIDTH and SCREEN_HEIGHT can be multipled by scale factor of X. Implement it in argc 
-    window = SDL_CreateWindow("Chip8 Emu", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH * 10, SCREEN_HEIGHT * 10, SDL_WINDOW_SHOWN);    
+    std::string window_title = std::string("Chip8 Emu - ") + title;
+    window = SDL_CreateWindow(window_title.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 64 * scale, 32 * scale, SDL_WINDOW_SHOWN);
     if (window == NULL) {
         log_SDL_error("Failed to create window");
         return false;
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // Presenting can wait for vsync, the emulation thread keeps its own pace
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (renderer == NULL) {
         log_SDL_error("Failed to create renderer");
         return false;
     }
 
-    // Texture will always be 64x32
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    // Texture is sized for hi-res (128x64), lo-res frames only use the top-left 64x32
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, Display::MAX_WIDTH, Display::MAX_HEIGHT);
     if (texture == NULL) {
         log_SDL_error("Failed to create texture");
         return false;
@@ -88,184 +439,153 @@ bool initialize_window() {
     return true;
 }
 
-void update_frame(void const *buffer, int pitch) {
+// A second window showing the latest access count snapshot, refreshed as snapshots arrive
+bool initialize_heatmap_window(uint32_t memory_size) {
+    Heatmap heatmap;
+    render_heatmap(AccessCounts(), memory_size, heatmap);
+    int scale = heatmap_scale(heatmap);
+    heatmap_window = SDL_CreateWindow("Chip8 Emu - Memory (red writes, green reads, blue fetches)",
+                                      SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, heatmap.width * scale,
+                                      heatmap.height * scale, SDL_WINDOW_SHOWN);
+    if (heatmap_window == NULL) {
+        log_SDL_error("Failed to create heatmap window");
+        return false;
+    }
+
+    // No vsync, so presenting it never holds up the main window
+    heatmap_renderer = SDL_CreateRenderer(heatmap_window, -1, SDL_RENDERER_ACCELERATED);
+    heatmap_texture = heatmap_renderer == NULL ? NULL
+                    : SDL_CreateTexture(heatmap_renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+                                        heatmap.width, heatmap.height);
+    if (heatmap_texture == NULL) {
+        log_SDL_error("Failed to create heatmap texture");
+        return false;
+    }
+    return true;
+}
+
+void update_heatmap(uint32_t memory_size) {
+    static Heatmap heatmap;
+    render_heatmap(access_snapshots.front(), memory_size, heatmap);
+    if (heatmap_texture == NULL ||
+        SDL_UpdateTexture(heatmap_texture, nullptr, heatmap.pixels.data(), heatmap.width * sizeof(uint32_t)) != 0) {
+        return;
+    }
+    SDL_RenderClear(heatmap_renderer);
+    SDL_RenderCopy(heatmap_renderer, heatmap_texture, nullptr, nullptr);
+    SDL_RenderPresent(heatmap_renderer);
+}
+
+// Uploads the blended rows that changed since the last frame and presents them.
+// Does nothing and returns false if nothing changed.
+bool update_frame(FrameBlender &blender, uint64_t dirty, const uint32_t *palette) {
+    static uint32_t pixels[Display::MAX_WIDTH * Display::MAX_HEIGHT];
+    const int pitch = Display::MAX_WIDTH * sizeof(pixels[0]);
+
+    if (dirty == 0 && !redraw_window) {
+        return false;
+    }
+    redraw_window = false;
+
     int res;
-    res = SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-    if (res != 0) {
-        log_SDL_error("SDL_UpdateTexture");
+
+    // Upload each run of consecutive dirty rows with a single SDL_UpdateTexture call
+    int y = 0;
+    while (y < blender.height()) {
+        if (!((dirty >> y) & 1u)) {
+            ++y;
+            continue;
+        }
+        int first = y;
+        while (y < blender.height() && ((dirty >> y) & 1u)) {
+            blender.to_rgba_row(&pixels[y * Display::MAX_WIDTH], y, palette);
+            ++y;
+        }
+        SDL_Rect rows = { 0, first, blender.width(), y - first };
+        res = SDL_UpdateTexture(texture, &rows, &pixels[first * Display::MAX_WIDTH], pitch);
+        if (res != 0) {
+            log_SDL_error("SDL_UpdateTexture");
+        }
     }
 
+    // Only the area of the current resolution is stretched over the window
+    SDL_Rect area = { 0, 0, blender.width(), blender.height() };
+
 	res = SDL_RenderClear(renderer);
     if (res != 0) {
         log_SDL_error("SDL_RenderClear");
     }
 
-	res = SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	res = SDL_RenderCopy(renderer, texture, &area, nullptr);
     if (res != 0) {
         log_SDL_error("SDL_RenderCopy");
     }
 
     SDL_RenderPresent(renderer);
-
+    return true;
 }
 
-// Param is array of uint8_t
-bool accept_input(uint8_t *keys) {
+// Param is array of uint8_t. keymap holds the host key for each of the 16 CHIP-8 keys
+bool accept_input(uint8_t *keys, const char *keymap) {
     bool quit = false;
-    SDL_PollEvent(&event);
 
-    switch(event.type) {
-        case SDL_QUIT: {
-            quit = true;
-        } break;
-
-        case SDL_KEYDOWN: {
-            switch(event.key.keysym.sym) {
-                case SDLK_ESCAPE: 
+    while (SDL_PollEvent(&event)) {
+        switch(event.type) {
+            case SDL_QUIT: {
+                quit = true;
+            } break;
+
+            case SDL_WINDOWEVENT: {
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    redraw_window = true;
+                }
+                // With the heatmap window open, closing a window doesn't quit by itself
+                if (event.window.event == SDL_WINDOWEVENT_CLOSE && heatmap_window != nullptr) {
+                    if (event.window.windowID == SDL_GetWindowID(heatmap_window)) {
+                        SDL_DestroyTexture(heatmap_texture);
+                        SDL_DestroyRenderer(heatmap_renderer);
+                        SDL_DestroyWindow(heatmap_window);
+                        heatmap_texture = nullptr;
+                        heatmap_renderer = nullptr;
+                        heatmap_window = nullptr;
+                    } else {
+                        quit = true;
+                    }
+                }
+            } break;
+
+            case SDL_KEYDOWN:
+            case SDL_KEYUP: {
+                SDL_Keycode key = event.key.keysym.sym;
+                if (key == SDLK_ESCAPE) {
                     quit = true;
-                break;
-
-                case SDLK_x: 
-                    keys[0] = 1;
-                break;
-
-                case SDLK_1:
-                    keys[1] = 1;
-                break;
-
-                case SDLK_2:
-                    keys[2] = 1;
-                break;
-
-                case SDLK_3:
-                    keys[3] = 1;
-                break;
-                
-                case SDLK_q :
-                    keys[4] = 1;
-                break;
-          
-                case SDLK_w :
-                    keys[5] = 1;
-                break;
-                                
-                case SDLK_e :
-                    keys[6] = 1;
-                break;
-                                
-                case SDLK_a :
-                    keys[7] = 1;
-                break;
-                                
-                case SDLK_s :
-                    keys[8] = 1;
-                break;
-                                
-                case SDLK_d :
-                    keys[9] = 1;
-                break;
-                                
-                case SDLK_z :
-                    keys[0xA] = 1;
-                break;
-                                
-                case SDLK_c :
-                    keys[0xB] = 1;
-                break;
-                                
-                case SDLK_4 :
-                    keys[0xC] = 1;
-                break;
-                                
-                case SDLK_r :
-                    keys[0xD] = 1;
-                break;
-                                                
-                case SDLK_f :
-                    keys[0xE] = 1;
-                break;
-                                                
-                case SDLK_v :
-                    keys[0xF] = 1;
-                break;
-            }
-        } break;
-
-        case SDL_KEYUP: {
-                case SDLK_ESCAPE: 
-                    quit = true;
-                break;
-
-                case SDLK_x: 
-                    keys[0] = 0;
-                break;
-
-                case SDLK_1:
-                    keys[1] = 0;
-                break;
-
-                case SDLK_2:
-                    keys[2] = 0;
-                break;
-
-                case SDLK_3:
-                    keys[3] = 0;
-                break;
-                
-                case SDLK_q :
-                    keys[4] = 0;
-                break;
-          
-                case SDLK_w :
-                    keys[5] = 0;
-                break;
-                                
-                case SDLK_e :
-                    keys[6] = 0;
-                break;
-                                
-                case SDLK_a :
-                    keys[7] = 0;
-                break;
-                                
-                case SDLK_s :
-                    keys[8] = 0;
-                break;
-                                
-                case SDLK_d :
-                    keys[9] = 0;
-                break;
-                                
-                case SDLK_z :
-                    keys[0xA] = 0;
-                break;
-                                
-                case SDLK_c :
-                    keys[0xB] = 0;
-                break;
-                                
-                case SDLK_4 :
-                    keys[0xC] = 0;
-                break;
-                                
-                case SDLK_r :
-                    keys[0xD] = 0;
-                break;
-                                                
-                case SDLK_f :
-                    keys[0xE] = 0;
-                break;
-                                                
-                case SDLK_v :
-                    keys[0xF] = 0;
-                break;
+                    break;
+                }
+                if (key == SDLK_TAB) {
+                    fast_forward.store(event.type == SDL_KEYDOWN);
+                    break;
+                }
+
+                for (int i = 0; i < 16; ++i) {
+                    if (key == static_cast<SDL_Keycode>(keymap[i])) {
+                        keys[i] = event.type == SDL_KEYDOWN ? 1 : 0;
+                        if (event.type == SDL_KEYUP) {
+                            released_keys.fetch_or(1u << i, std::memory_order_relaxed);
+                        }
+                    }
+                }
+            } break;
         }
-        break;
     }
     return quit;
 }
 
 void close() {
+    if (heatmap_window != nullptr) {
+        SDL_DestroyTexture(heatmap_texture);
+        SDL_DestroyRenderer(heatmap_renderer);
+        SDL_DestroyWindow(heatmap_window);
+    }
     SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
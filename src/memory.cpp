@@ -0,0 +1,125 @@
+#include "memory.h"
+#include "rom_db.h"
+#include <cstring>
+#include <fstream>
+
+RomImage::RomImage() : rom_size(0), hash(0) {
+    // Notice that only the upper half (high nibble) has value
+    uint8_t fontset[FONTSET_SIZE] = {
+	    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    // SUPER-CHIP 8x10 font. SUPER-CHIP only defines 0-9, A-F are the XO-CHIP (Octo) glyphs.
+    uint8_t big_fontset[BIG_FONTSET_SIZE] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    // XO-CHIP programs may read anywhere in the 64K address space
+    memset(bytes, 0, sizeof(bytes));
+
+    // Load the fonts into memory
+    memcpy(&bytes[FONTSET_START_ADDRESS], fontset, FONTSET_SIZE);
+    memcpy(&bytes[BIG_FONTSET_START_ADDRESS], big_fontset, BIG_FONTSET_SIZE);
+}
+
+std::shared_ptr<const RomImage> RomImage::from_file(const char *file_path) {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open()) {
+        return nullptr;
+    }
+
+    // Get size of ROM file
+    file.seekg(0, file.end);
+    std::streamoff rom_size = file.tellg();
+    if (rom_size < 0 || rom_size > MAX_MEMORY_SIZE - START_ADDRESS) {
+        return nullptr;
+    }
+
+    // Read the ROM straight into the image, starting from 0x200
+    std::shared_ptr<RomImage> image(new RomImage());
+    file.seekg(0, file.beg);
+    file.read(reinterpret_cast<char *>(&image->bytes[START_ADDRESS]), rom_size);
+    if (file.gcount() != rom_size) {
+        return nullptr;
+    }
+
+    image->rom_size = rom_size;
+    image->hash = hash_rom(&image->bytes[START_ADDRESS], rom_size);
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::from_buffer(const uint8_t *data, size_t size) {
+    if (size > MAX_MEMORY_SIZE - START_ADDRESS) {
+        return nullptr;
+    }
+
+    std::shared_ptr<RomImage> image(new RomImage());
+    memcpy(&image->bytes[START_ADDRESS], data, size);
+    image->rom_size = size;
+    image->hash = hash_rom(data, size);
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::blank() {
+    static std::shared_ptr<const RomImage> image(new RomImage());
+    return image;
+}
+
+Memory::Memory() : mask(0) {
+    attach(RomImage::blank(), 4096);
+}
+
+void Memory::attach(std::shared_ptr<const RomImage> image, uint32_t size) {
+    rom_image = image;
+    mask = size - 1;
+
+    uint32_t pages = size >> PAGE_SHIFT;
+    read_pages.resize(pages);
+    write_pages.assign(pages, nullptr);
+    for (uint32_t page = 0; page < pages; ++page) {
+        read_pages[page] = &rom_image->bytes[page << PAGE_SHIFT];
+    }
+    overlay.clear();
+    overlay_addresses.clear();
+}
+
+uint8_t *Memory::copy_page(uint32_t page) {
+    uint8_t *copy = new uint8_t[PAGE_SIZE];
+    memcpy(copy, read_pages[page], PAGE_SIZE);
+    overlay.emplace_back(copy);
+    overlay_addresses.push_back(page << PAGE_SHIFT);
+
+    read_pages[page] = copy;
+    write_pages[page] = copy;
+    return copy;
+}
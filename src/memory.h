@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+constexpr uint32_t START_ADDRESS = 0x200; // 0x000 to 0x1FF is reserved for system.
+constexpr uint32_t FONTSET_START_ADDRESS = 0x50;
+constexpr uint32_t FONTSET_SIZE = 80;
+constexpr uint32_t BIG_FONTSET_START_ADDRESS = 0xA0;
+constexpr uint32_t BIG_FONTSET_SIZE = 160;
+constexpr uint32_t MAX_MEMORY_SIZE = 65536; // XO-CHIP
+
+// Immutable 64K memory image: the fonts plus a ROM at 0x200.
+// Every instance running the same ROM can share one image, see Memory.
+class RomImage {
+    public:
+        uint8_t bytes[MAX_MEMORY_SIZE];
+        size_t rom_size;
+        uint64_t hash;
+
+        // Return nullptr if the file can't be read or the ROM doesn't fit in 64K above 0x200
+        static std::shared_ptr<const RomImage> from_file(const char *file_path);
+        static std::shared_ptr<const RomImage> from_buffer(const uint8_t *data, size_t size);
+
+        // Fonts only, shared by every instance that has no ROM loaded
+        static std::shared_ptr<const RomImage> blank();
+
+    private:
+        RomImage();
+};
+
+// Copy-on-write view of a RomImage.
+// Reads go through a page table that points into the shared image. The first write to a page copies it into a
+// small per-instance overlay, so instances of the same ROM only pay for the pages they modify (usually the
+// one or two pages written by FX33/FX55).
+class Memory {
+    public:
+        static constexpr uint32_t PAGE_SHIFT = 8;
+        static constexpr uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+
+        Memory();
+
+        // Maps the first size bytes (4K or 64K) of the image, dropping all writes made so far
+        void attach(std::shared_ptr<const RomImage> image, uint32_t size);
+
+        // Drops all writes made since the image was attached
+        void reset() { attach(rom_image, mask + 1u); }
+
+        // Addresses wrap around the mapped size
+        uint8_t read(uint32_t address) const {
+            address &= mask;
+            return read_pages[address >> PAGE_SHIFT][address & (PAGE_SIZE - 1)];
+        }
+
+        void write(uint32_t address, uint8_t value) {
+            address &= mask;
+            uint8_t *page = write_pages[address >> PAGE_SHIFT];
+            if (page == nullptr) {
+                page = copy_page(address >> PAGE_SHIFT);
+            }
+            page[address & (PAGE_SIZE - 1)] = value;
+        }
+
+        // True if the page holding address was written since the image was attached
+        bool modified(uint32_t address) const { return write_pages[(address & mask) >> PAGE_SHIFT] != nullptr; }
+
+        // The PAGE_SIZE bytes of the page holding address, in the shared image until the page is written
+        const uint8_t *page(uint32_t address) const { return read_pages[(address & mask) >> PAGE_SHIFT]; }
+
+        uint32_t size() const { return mask + 1u; }
+        const RomImage &image() const { return *rom_image; }
+        const std::shared_ptr<const RomImage> &image_ptr() const { return rom_image; }
+
+        // Number of pages copied into this instance's overlay, and the address of the i-th one
+        size_t overlay_pages() const { return overlay.size(); }
+        uint32_t overlay_page(size_t i) const { return overlay_addresses[i]; }
+
+        // Bytes allocated by this instance, the page tables and the overlay. The image is shared and not counted.
+        size_t allocated_bytes() const {
+            return read_pages.capacity() * sizeof(const uint8_t *) + write_pages.capacity() * sizeof(uint8_t *) +
+                   overlay.size() * PAGE_SIZE + overlay_addresses.capacity() * sizeof(uint32_t);
+        }
+
+    private:
+        std::shared_ptr<const RomImage> rom_image;
+        std::vector<const uint8_t *> read_pages;
+        std::vector<uint8_t *> write_pages; // nullptr until the page is copied
+        std::vector<std::unique_ptr<uint8_t[]>> overlay;
+        std::vector<uint32_t> overlay_addresses;
+        uint32_t mask;
+
+        uint8_t *copy_page(uint32_t page);
+};
@@ -0,0 +1,127 @@
+#include "predecode.h"
+
+static const char *FUSION_NAMES[FUSION_COUNT] = { "none", "ANNN+DXYN", "6XNN+6YNN", "7XNN+3XNN", "FX07+3XNN" };
+
+const char *fusion_name(Fusion fusion) {
+    return FUSION_NAMES[static_cast<int>(fusion)];
+}
+
+DecodedOp Predecoder::EMPTY_PAGE[Memory::PAGE_SIZE];
+
+void Predecoder::reset() {
+    for (uint32_t page : mapped) {
+        std::fill(pages[page], pages[page] + Memory::PAGE_SIZE, DecodedOp());
+        spare.push_back(pages[page]);
+        pages[page] = EMPTY_PAGE;
+    }
+    mapped.clear();
+}
+
+void Predecoder::allocate(uint32_t memory_size) {
+    reset();
+    pages.assign(memory_size >> Memory::PAGE_SHIFT, EMPTY_PAGE);
+    mask = memory_size - 1;
+}
+
+DecodedOp *Predecoder::map_page(uint32_t page) {
+    if (spare.empty()) {
+        storage.emplace_back(new DecodedOp[Memory::PAGE_SIZE]());
+        spare.push_back(storage.back().get());
+    }
+    pages[page] = spare.back();
+    spare.pop_back();
+    mapped.push_back(page);
+    return pages[page];
+}
+
+OpKind classify_opcode(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        // Matched whole, 0NNN machine code calls (0x02C3, 0x01E0) are ignored
+        case 0x0000:
+            if ((opcode & 0xFFF0) == 0x00C0) {
+                return OpKind::Op00CN;
+            }
+            if ((opcode & 0xFFF0) == 0x00D0) {
+                return OpKind::Op00DN;
+            }
+            switch (opcode) {
+                case 0x00E0: return OpKind::Op00E0;
+                case 0x00EE: return OpKind::Op00EE;
+                case 0x00FB: return OpKind::Op00FB;
+                case 0x00FC: return OpKind::Op00FC;
+                case 0x00FD: return OpKind::Op00FD;
+                case 0x00FE: return OpKind::Op00FE;
+                case 0x00FF: return OpKind::Op00FF;
+            }
+            return OpKind::Nop;
+
+        case 0x1000: return OpKind::Op1NNN;
+        case 0x2000: return OpKind::Op2NNN;
+        case 0x3000: return OpKind::Op3XNN;
+        case 0x4000: return OpKind::Op4XNN;
+
+        case 0x5000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OpKind::Op5XY0;
+                case 0x0002: return OpKind::Op5XY2;
+                case 0x0003: return OpKind::Op5XY3;
+            }
+            break;
+
+        case 0x6000: return OpKind::Op6XNN;
+        case 0x7000: return OpKind::Op7XNN;
+
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OpKind::Op8XY0;
+                case 0x0001: return OpKind::Op8XY1;
+                case 0x0002: return OpKind::Op8XY2;
+                case 0x0003: return OpKind::Op8XY3;
+                case 0x0004: return OpKind::Op8XY4;
+                case 0x0005: return OpKind::Op8XY5;
+                case 0x0006: return OpKind::Op8XY6;
+                case 0x0007: return OpKind::Op8XY7;
+                case 0x000E: return OpKind::Op8XYE;
+            }
+            break;
+
+        case 0x9000: return OpKind::Op9XY0;
+        case 0xA000: return OpKind::OpANNN;
+        case 0xB000: return OpKind::OpBNNN;
+        case 0xC000: return OpKind::OpCXNN;
+        case 0xD000: return OpKind::OpDXYN;
+
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: return OpKind::OpEX9E;
+                case 0x00A1: return OpKind::OpEXA1;
+            }
+            break;
+
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0000:
+                    if (opcode == 0xF000) {
+                        return OpKind::OpF000;
+                    }
+                    break;
+                case 0x0001: return OpKind::OpFN01;
+                case 0x0007: return OpKind::OpFX07;
+                case 0x000A: return OpKind::OpFX0A;
+                case 0x0015: return OpKind::OpFX15;
+                case 0x0018: return OpKind::OpFX18;
+                case 0x001E: return OpKind::OpFX1E;
+                case 0x0029: return OpKind::OpFX29;
+                case 0x0030: return OpKind::OpFX30;
+                case 0x0033: return OpKind::OpFX33;
+                case 0x0055: return OpKind::OpFX55;
+                case 0x0065: return OpKind::OpFX65;
+                case 0x0075: return OpKind::OpFX75;
+                case 0x0085: return OpKind::OpFX85;
+                case 0x0002: return OpKind::Nop;
+                case 0x003A: return OpKind::Nop;
+            }
+            break;
+    }
+    return OpKind::Illegal;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "memory.h"
+
+// Build with CHIP8_SUPERINSTRUCTIONS=0 to predecode single instructions only
+#ifndef CHIP8_SUPERINSTRUCTIONS
+#define CHIP8_SUPERINSTRUCTIONS 1
+#endif
+
+// The threaded interpreter needs labels as values (GCC and Clang)
+#ifndef CHIP8_THREADED
+#if defined(__GNUC__)
+#define CHIP8_THREADED 1
+#else
+#define CHIP8_THREADED 0
+#endif
+#endif
+
+// Interpreter loops for Chip8::run_instructions(). All of them run the same handlers.
+enum class Interpreter {
+    Switch,      // Fetch and decode every instruction with Chip8::execute(), the reference
+    Predecoded,  // Call cached handlers, with superinstructions
+    Threaded,    // Direct-threaded over the cached instructions (needs CHIP8_THREADED)
+    Jit          // Optimized basic blocks, see BlockCache
+};
+constexpr Interpreter DEFAULT_INTERPRETER = CHIP8_THREADED ? Interpreter::Threaded : Interpreter::Predecoded;
+
+class Chip8;
+struct DecodedOp;
+
+typedef void (*OpHandler)(Chip8 &chip8, const DecodedOp &op);
+
+// Every instruction the interpreters know. Nop is 0NNN and the XO-CHIP audio instructions, which are ignored,
+// Illegal is everything else. Breakpoint is patched into the decoded instructions by the debugger,
+// classify_opcode() never returns it.
+enum class OpKind : uint8_t {
+    Nop,
+    Illegal,
+    Op00E0, Op00EE, Op00CN, Op00DN, Op00FB, Op00FC, Op00FD, Op00FE, Op00FF,
+    Op1NNN, Op2NNN, Op3XNN, Op4XNN, Op5XY0, Op5XY2, Op5XY3, Op6XNN, Op7XNN,
+    Op8XY0, Op8XY1, Op8XY2, Op8XY3, Op8XY4, Op8XY5, Op8XY6, Op8XY7, Op8XYE,
+    Op9XY0, OpANNN, OpBNNN, OpCXNN, OpDXYN, OpEX9E, OpEXA1,
+    OpF000, OpFN01, OpFX07, OpFX0A, OpFX15, OpFX18, OpFX1E, OpFX29, OpFX30,
+    OpFX33, OpFX55, OpFX65, OpFX75, OpFX85,
+    Breakpoint
+};
+constexpr int OP_KIND_COUNT = static_cast<int>(OpKind::Breakpoint) + 1;
+
+// Same decoding as Chip8::execute()
+OpKind classify_opcode(uint16_t opcode);
+
+// Superinstructions: instruction pairs that are common in ROMs, run with a single dispatch
+enum class Fusion : uint8_t {
+    None,
+    LoadIndexDraw,  // ANNN; DXYN
+    LoadLoad,       // 6XNN; 6YNN
+    AddSkip,        // 7XNN; 3XNN
+    TimerSkip       // FX07; 3XNN
+};
+constexpr int FUSION_COUNT = 5;
+
+const char *fusion_name(Fusion fusion);
+
+// An instruction decoded once and cached, so running it again skips the fetch and the decode switch.
+// A fused entry covers this instruction and the next one.
+struct DecodedOp {
+    OpHandler handler;     // nullptr until decoded
+    uint16_t opcode;
+    uint16_t next_opcode;  // Second instruction of a superinstruction
+    OpKind kind;           // Of the first instruction, used by the threaded interpreter
+    Fusion fusion;
+};
+
+// Decoded instruction cache with one entry per address, filled as instructions are first run.
+// Entries are kept in pages of Memory::PAGE_SIZE, mapped on the first decode in the page, so an instance only
+// pays for the pages it runs code from (a few KB for most ROMs) instead of one entry per byte of memory.
+// Unmapped pages read as a shared page of empty entries, the lookup on the hot path never checks for them.
+// Memory writes must invalidate the entries that cover the written byte, see Chip8::write_memory().
+class Predecoder {
+    public:
+        Predecoder() : mask(0) {}
+
+        // Drops all entries. The page table is allocated on first use, so instances that never run don't pay for
+        // it. Only the pages mapped since the last reset are cleared, and kept for reuse.
+        void reset();
+        bool fits(uint32_t memory_size) const { return pages.size() == memory_size >> Memory::PAGE_SHIFT; }
+        void allocate(uint32_t memory_size);
+
+        // Read only, decode into writable() when the handler is nullptr
+        const DecodedOp &entry(uint32_t address) const {
+            address &= mask;
+            return pages[address >> Memory::PAGE_SHIFT][address & (Memory::PAGE_SIZE - 1)];
+        }
+
+        // The entry at address, mapping its page first
+        DecodedOp &writable(uint32_t address) {
+            address &= mask;
+            DecodedOp *page = pages[address >> Memory::PAGE_SHIFT];
+            if (page == EMPTY_PAGE) {
+                page = map_page(address >> Memory::PAGE_SHIFT);
+            }
+            return page[address & (Memory::PAGE_SIZE - 1)];
+        }
+
+        // An entry covers up to 4 bytes, so the entries starting at the 3 bytes before address are dropped too
+        void invalidate(uint32_t address) {
+            if (pages.empty()) {
+                return;
+            }
+            for (uint32_t i = 0; i < 4; ++i) {
+                uint32_t start = (address - i) & mask;
+                DecodedOp *page = pages[start >> Memory::PAGE_SHIFT];
+                if (page != EMPTY_PAGE) {
+                    page[start & (Memory::PAGE_SIZE - 1)].handler = nullptr;
+                }
+            }
+        }
+
+        // Bytes allocated by this instance: the page table and every page mapped since it was created
+        size_t allocated_bytes() const {
+            return pages.capacity() * sizeof(DecodedOp *) + storage.size() * Memory::PAGE_SIZE * sizeof(DecodedOp);
+        }
+
+        // Decodes the instruction at address with the quirks resolved at compile time
+        template <typename Quirks> static void decode(const Memory &memory, uint32_t address, DecodedOp &op);
+
+    private:
+        static DecodedOp EMPTY_PAGE[Memory::PAGE_SIZE];  // Never written
+
+        std::vector<DecodedOp *> pages;  // EMPTY_PAGE until mapped
+        std::vector<std::unique_ptr<DecodedOp[]>> storage;
+        std::vector<DecodedOp *> spare;  // Cleared pages not mapped since the last reset
+        std::vector<uint32_t> mapped;    // Page numbers mapped since the last reset
+        uint32_t mask;
+
+        DecodedOp *map_page(uint32_t page);
+};
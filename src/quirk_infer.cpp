@@ -0,0 +1,452 @@
+#include "quirk_infer.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include "chip8.h"
+#include "disasm.h"
+#include "predecode.h"
+#include "rom_db.h"
+
+// How far next_index_uses() follows the control flow after FX55/FX65
+static const size_t MAX_FOLLOWED_BLOCKS = 64;
+
+// Preferred first when the scores are equal
+static const QuirkProfile CANDIDATES[] = {
+    QuirkProfile::Chip8, QuirkProfile::CosmacVip, QuirkProfile::SuperChip, QuirkProfile::XoChip
+};
+
+struct QuirkSet {
+    bool on[INFERRED_QUIRK_COUNT];
+};
+
+template <typename Quirks>
+static QuirkSet quirk_set() {
+    QuirkSet set = { { Quirks::shift_uses_vy, Quirks::load_store_increments_i, Quirks::jump_uses_vx,
+                       Quirks::clip_sprites } };
+    return set;
+}
+
+static QuirkSet profile_quirks(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::SuperChip: return quirk_set<SuperChipQuirks>();
+        case QuirkProfile::XoChip:    return quirk_set<XoChipQuirks>();
+        case QuirkProfile::CosmacVip: return quirk_set<CosmacVipQuirks>();
+        default:                      return quirk_set<Chip8Quirks>();
+    }
+}
+
+// Number of instructions that gave some evidence, and the first of them
+struct Finding {
+    int count;
+    uint32_t first;
+
+    Finding() : count(0), first(0) {}
+
+    void add(uint32_t address) {
+        if (count++ == 0) {
+            first = address;
+        }
+    }
+};
+
+static uint16_t read_opcode(const Memory &memory, uint32_t address) {
+    return memory.read(address) << 8 | memory.read(address + 1);
+}
+
+static void add_reason(QuirkInference &inference, const char *format, ...) {
+    char text[160];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    inference.reasons.push_back(text);
+}
+
+static void report(QuirkInference &inference, const Finding &finding, const char *what) {
+    if (finding.count > 0) {
+        add_reason(inference, "%s (%d, first at %04X)", what, finding.count, finding.first);
+    }
+}
+
+static bool is_hires_instruction(OpKind kind, uint16_t opcode) {
+    switch (kind) {
+        case OpKind::Op00CN:
+        case OpKind::Op00FB:
+        case OpKind::Op00FC:
+        case OpKind::Op00FD:
+        case OpKind::Op00FE:
+        case OpKind::Op00FF:
+        case OpKind::OpFX30:
+        case OpKind::OpFX75:
+        case OpKind::OpFX85:
+            return true;
+        case OpKind::OpDXYN:
+            return (opcode & 0x000Fu) == 0;
+        default:
+            return false;
+    }
+}
+
+static bool is_xochip_instruction(OpKind kind, uint16_t opcode) {
+    switch (kind) {
+        case OpKind::Op00DN:
+        case OpKind::Op5XY2:
+        case OpKind::Op5XY3:
+        case OpKind::OpF000:
+        case OpKind::OpFN01:
+            return true;
+        case OpKind::Nop:
+            return (opcode & 0xF000u) == 0xF000u;  // Audio
+        default:
+            return false;
+    }
+}
+
+static bool uses_index(OpKind kind) {
+    switch (kind) {
+        case OpKind::OpANNN:
+        case OpKind::OpF000:
+        case OpKind::OpFX1E:
+        case OpKind::OpFX29:
+        case OpKind::OpFX30:
+        case OpKind::OpFX33:
+        case OpKind::OpFX55:
+        case OpKind::OpFX65:
+        case OpKind::OpDXYN:
+        case OpKind::Op5XY2:
+        case OpKind::Op5XY3:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Registers the instruction writes, as a bit mask
+static uint32_t written_registers(OpKind kind, uint16_t opcode) {
+    uint32_t x = (opcode & 0x0F00u) >> 8u;
+    switch (kind) {
+        case OpKind::Op6XNN:
+        case OpKind::Op7XNN:
+        case OpKind::OpCXNN:
+        case OpKind::OpFX07:
+        case OpKind::OpFX0A:
+            return 1u << x;
+        case OpKind::Op8XY0:
+        case OpKind::Op8XY1:
+        case OpKind::Op8XY2:
+        case OpKind::Op8XY3:
+        case OpKind::Op8XY4:
+        case OpKind::Op8XY5:
+        case OpKind::Op8XY6:
+        case OpKind::Op8XY7:
+        case OpKind::Op8XYE:
+            return 1u << x | 1u << 15;
+        case OpKind::OpFX65:
+        case OpKind::OpFX85:
+            return (2u << x) - 1;
+        default:
+            return 0;
+    }
+}
+
+// The first instructions that use I on the paths leaving the instruction at address
+static std::vector<OpKind> next_index_uses(const RomAnalysis &analysis, const Memory &memory, uint32_t address) {
+    std::vector<OpKind> uses;
+    std::vector<uint32_t> starts(1, address + 2);
+    std::set<uint32_t> visited;
+    while (!starts.empty() && visited.size() < MAX_FOLLOWED_BLOCKS) {
+        uint32_t at = starts.back();
+        starts.pop_back();
+        const CfgBlock *block = analysis.find_block(at);
+        if (block == nullptr) {
+            continue;
+        }
+
+        bool found = false;
+        while (at < block->end && !found) {
+            uint16_t opcode = read_opcode(memory, at);
+            OpKind kind = classify_opcode(opcode);
+            if (uses_index(kind)) {
+                uses.push_back(kind);
+                found = true;
+            }
+            at += instruction_size(opcode);
+        }
+        for (size_t i = 0; i < block->successors.size() && !found; ++i) {
+            if (visited.insert(block->successors[i].target).second) {
+                starts.push_back(block->successors[i].target);
+            }
+        }
+    }
+    return uses;
+}
+
+static void infer_statically(QuirkInference &inference, const Memory &memory, uint32_t rom_size) {
+    Finding machine_code, hires, xochip, shifts_vy, shifts_vx, sequential, restores, jumps_vx, jumps_v0;
+    RomAnalysis analysis = analyze_rom(memory, rom_size, QuirkProfile::XoChip);
+
+    for (const CfgBlock &block : analysis.blocks) {
+        uint32_t written = 0;  // Registers written in the block so far
+        for (uint32_t address = block.start; address < block.end;) {
+            uint16_t opcode = read_opcode(memory, address);
+            OpKind kind = classify_opcode(opcode);
+            uint32_t x = (opcode & 0x0F00u) >> 8u;
+            uint32_t y = (opcode & 0x00F0u) >> 4u;
+
+            if (opcode >= 0x0100u && opcode < 0x1000u) {
+                // 0NNN calls machine code, which the emulator decodes as 00CN, 00DN or ignores
+                machine_code.add(address);
+            } else if (is_hires_instruction(kind, opcode)) {
+                hires.add(address);
+            } else if (is_xochip_instruction(kind, opcode)) {
+                xochip.add(address);
+            } else if ((kind == OpKind::Op8XY6 || kind == OpKind::Op8XYE) && x != y) {
+                // A shift of VY into VX overwrites VX without reading it, so code written for it sets up VY first
+                bool set_vx = written & (1u << x);
+                bool set_vy = written & (1u << y);
+                if (set_vy && !set_vx) {
+                    shifts_vy.add(address);
+                } else if (set_vx && !set_vy) {
+                    shifts_vx.add(address);
+                }
+            } else if (kind == OpKind::OpFX55 || kind == OpKind::OpFX65) {
+                // Storing or loading again without reloading I expects I to have moved on, restoring what was
+                // just stored expects it to be where it was
+                for (OpKind next : next_index_uses(analysis, memory, address)) {
+                    if (next == kind) {
+                        sequential.add(address);
+                    } else if (next == OpKind::OpFX55 || next == OpKind::OpFX65) {
+                        restores.add(address);
+                    }
+                }
+            } else if (kind == OpKind::OpBNNN && x != 0) {
+                // With jump_uses_vx BXNN adds VX, so the register set up just before tells the variants apart
+                bool uses_v0 = written & 1u;
+                bool uses_vx = written & (1u << x);
+                if (uses_vx && !uses_v0) {
+                    jumps_vx.add(address);
+                } else if (uses_v0 && !uses_vx) {
+                    jumps_v0.add(address);
+                }
+            }
+            written |= written_registers(kind, opcode);
+            address += instruction_size(opcode);
+        }
+    }
+
+    inference.calls_machine_code = machine_code.count > 0;
+    inference.needs_hires = hires.count > 0;
+    inference.needs_xochip = xochip.count > 0 || rom_size > Chip8Quirks::memory_size - START_ADDRESS;
+    inference.votes[INFER_SHIFT_USES_VY] += shifts_vy.count - shifts_vx.count;
+    inference.votes[INFER_LOAD_STORE_INCREMENTS_I] += sequential.count - restores.count;
+    inference.votes[INFER_JUMP_USES_VX] += jumps_vx.count - jumps_v0.count;
+
+    report(inference, machine_code, "0NNN machine code calls, COSMAC VIP");
+    report(inference, hires, "SUPER-CHIP instructions");
+    report(inference, xochip, "XO-CHIP instructions");
+    if (rom_size > Chip8Quirks::memory_size - START_ADDRESS) {
+        add_reason(inference, "ROM is larger than 4K");
+    }
+    report(inference, shifts_vy, "8XY6/8XYE after setting VY, shift uses VY");
+    report(inference, shifts_vx, "8XY6/8XYE with X != Y after setting VX, shift uses VX");
+    report(inference, sequential, "FX55/FX65 followed by another without reloading I, I advances");
+    report(inference, restores, "FX55/FX65 followed by the opposite without reloading I, I stays");
+    report(inference, jumps_vx, "BXNN after setting VX, jump uses VX");
+    report(inference, jumps_v0, "BNNN after setting V0, jump uses V0");
+}
+
+// What a trial run with one profile showed
+struct Trial {
+    bool illegal;
+    uint32_t illegal_address;
+    bool hires;
+    long right_edge_draws;   // Sprites that cross the right edge
+    long bottom_edge_draws;  // Sprites that cross the bottom edge
+};
+
+static Trial run_trial(const std::shared_ptr<const RomImage> &rom, QuirkProfile profile, long frames) {
+    Trial trial = { false, 0, false, 0, 0 };
+    Chip8 chip8;
+    chip8.init();
+    chip8.set_quirks(profile);
+    if (!chip8.load_rom(rom)) {
+        trial.illegal = true;
+        return trial;
+    }
+    chip8.randGen.seed(1);
+    // One instruction per call, so the check sees every DXYN (superinstructions would run ANNN+DXYN at once)
+    chip8.interpreter = Interpreter::Switch;
+
+    // Counts the sprites with pixels past the right or bottom edge, which wrap or clip depending on the quirk
+    auto count_edge_draws = [&trial](const Chip8 &c) {
+        uint16_t opcode = c.memory.read(c.pc) << 8 | c.memory.read(c.pc + 1);
+        if ((opcode & 0xF000u) != 0xD000u) {
+            return false;
+        }
+        int height = (opcode & 0x000Fu) == 0 ? 16 : opcode & 0x000Fu;
+        int width = (opcode & 0x000Fu) == 0 ? 16 : 8;
+        int x = c.registers[(opcode & 0x0F00u) >> 8u] % c.display.width;
+        int y = c.registers[(opcode & 0x00F0u) >> 4u] % c.display.height;
+        uint32_t past_right = x + width > c.display.width ? (1u << (x + width - c.display.width)) - 1 : 0;
+        bool right = false;
+        bool bottom = false;
+        for (int row = 0; row < height; ++row) {
+            uint32_t bits = c.memory.read(c.index + row * (width / 8));
+            if (width == 16) {
+                bits = bits << 8 | c.memory.read(c.index + row * 2 + 1);
+            }
+            right = right || (bits & past_right);
+            bottom = bottom || (bits && y + row >= c.display.height);
+        }
+        trial.right_edge_draws += right ? 1 : 0;
+        trial.bottom_edge_draws += bottom ? 1 : 0;
+        return false;
+    };
+    for (long frame = 0; frame < frames && !chip8.exited; ++frame) {
+        // Press every key in turn so ROMs waiting for input get going
+        for (int key = 0; key < 16; ++key) {
+            chip8.key_event(key, key == (frame / 20) % 16 && frame % 20 < 10);
+        }
+        RunResult result = chip8.run_until(count_edge_draws, DEFAULT_ROM_INFO.cycles_per_frame);
+        chip8.tick_timers();
+        trial.hires = trial.hires || chip8.display.hires();
+        if (result.reason == StopReason::IllegalOpcode) {
+            trial.illegal = true;
+            trial.illegal_address = chip8.pc;
+            break;
+        }
+    }
+    return trial;
+}
+
+static bool allowed(const QuirkInference &inference, QuirkProfile profile) {
+    if (inference.needs_xochip) {
+        return profile == QuirkProfile::XoChip;
+    }
+    if (inference.needs_hires) {
+        return profile == QuirkProfile::SuperChip;
+    }
+    if (inference.calls_machine_code) {
+        return profile == QuirkProfile::CosmacVip;
+    }
+    // XO-CHIP is only chosen on evidence of its own instructions
+    return profile != QuirkProfile::XoChip;
+}
+
+static int score(const QuirkInference &inference, QuirkProfile profile) {
+    QuirkSet quirks = profile_quirks(profile);
+    int total = 0;
+    for (int i = 0; i < INFERRED_QUIRK_COUNT; ++i) {
+        total += quirks.on[i] ? inference.votes[i] : -inference.votes[i];
+    }
+    return total;
+}
+
+QuirkInference infer_quirks(const std::shared_ptr<const RomImage> &rom, long trial_frames) {
+    QuirkInference inference;
+    inference.profile = DEFAULT_ROM_INFO.profile;
+    inference.calls_machine_code = false;
+    for (int i = 0; i < INFERRED_QUIRK_COUNT; ++i) {
+        inference.votes[i] = 0;
+    }
+
+    Memory memory;
+    memory.attach(rom, XoChipQuirks::memory_size);
+    infer_statically(inference, memory, static_cast<uint32_t>(rom->rom_size));
+
+    bool failed[4] = { false, false, false, false };
+    if (trial_frames > 0) {
+        long right_edge_draws = 0;
+        long bottom_edge_draws = 0;
+        for (QuirkProfile profile : CANDIDATES) {
+            if (!allowed(inference, profile)) {
+                continue;
+            }
+            Trial trial = run_trial(rom, profile, trial_frames);
+            failed[static_cast<int>(profile)] = trial.illegal;
+            right_edge_draws = std::max(right_edge_draws, trial.right_edge_draws);
+            bottom_edge_draws = std::max(bottom_edge_draws, trial.bottom_edge_draws);
+            if (trial.illegal) {
+                add_reason(inference, "Reached an illegal opcode at %04X with %s quirks", trial.illegal_address,
+                           quirk_profile_name(profile));
+            }
+            if (trial.hires && !inference.needs_hires) {
+                inference.needs_hires = true;
+                add_reason(inference, "Switched to hi-res in the trial run");
+            }
+        }
+        // A sprite wrapped past the bottom lands in the top rows, usually the score, so it is meant to be clipped.
+        // One moving out on the right is as often meant to come back on the left (UFO, TANK), which tells nothing.
+        // Either way it is a single vote however many sprites were drawn, the code's evidence counts every instruction.
+        if (bottom_edge_draws > 0) {
+            inference.votes[INFER_CLIP_SPRITES] += 1;
+            add_reason(inference, "Drew %ld sprites across the bottom edge in the trial run, sprites clip",
+                       bottom_edge_draws);
+        } else if (right_edge_draws > 0) {
+            add_reason(inference, "Drew %ld sprites across the right edge in the trial run, not counted",
+                       right_edge_draws);
+        }
+    }
+
+    // The best scoring profile that ran, or the best one if none did
+    for (int pass = 0; pass < 2; ++pass) {
+        bool found = false;
+        int best = 0;
+        for (QuirkProfile profile : CANDIDATES) {
+            if (!allowed(inference, profile) || (pass == 0 && failed[static_cast<int>(profile)])) {
+                continue;
+            }
+            if (!found || score(inference, profile) > best) {
+                inference.profile = profile;
+                best = score(inference, profile);
+                found = true;
+            }
+        }
+        if (found) {
+            break;
+        }
+    }
+    return inference;
+}
+
+std::string default_quirk_cache_path() {
+#ifdef _WIN32
+    const char *directory = std::getenv("APPDATA");
+    return directory != nullptr ? std::string(directory) + "\\chip8_quirks.txt" : "";
+#else
+    const char *directory = std::getenv("HOME");
+    return directory != nullptr ? std::string(directory) + "/.chip8_quirks" : "";
+#endif
+}
+
+bool find_cached_quirks(const std::string &path, uint64_t hash, QuirkProfile &profile) {
+    if (path.empty()) {
+        return false;
+    }
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        char name[16];
+        unsigned long long cached_hash;
+        if (std::sscanf(line.c_str(), "%llx %15s", &cached_hash, name) == 2 && cached_hash == hash &&
+            parse_quirk_profile(name, profile)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool cache_quirks(const std::string &path, uint64_t hash, QuirkProfile profile) {
+    if (path.empty()) {
+        return false;
+    }
+    std::ofstream file(path, std::ios::app);
+    char line[40];
+    std::snprintf(line, sizeof(line), "%016llx %s\n", static_cast<unsigned long long>(hash),
+                  quirk_profile_name(profile));
+    file << line;
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "memory.h"
+#include "quirks.h"
+
+// Quirk profile inference for ROMs that are not in the database.
+// The reachable code (see analyze_rom()) is searched for instructions only some variants have and for code
+// that only makes sense with a quirk on. A short headless trial run then rules out profiles that reach an
+// illegal opcode, and counts sprites drawn across the bottom edge.
+
+// Frames run per candidate profile by infer_quirks()
+constexpr long QUIRK_TRIAL_FRAMES = 300;
+
+// Quirks with evidence, indexes into QuirkInference::votes
+enum InferredQuirk {
+    INFER_SHIFT_USES_VY,
+    INFER_LOAD_STORE_INCREMENTS_I,
+    INFER_JUMP_USES_VX,
+    INFER_CLIP_SPRITES,
+    INFERRED_QUIRK_COUNT
+};
+
+struct QuirkInference {
+    QuirkProfile profile;
+    bool calls_machine_code;            // Uses 0NNN, which only the COSMAC VIP runs
+    bool needs_hires;                   // Uses SUPER-CHIP instructions
+    bool needs_xochip;                  // Uses XO-CHIP instructions or memory above 4K
+    int votes[INFERRED_QUIRK_COUNT];    // Positive if the code expects the quirk, negative if it expects it off
+    std::vector<std::string> reasons;   // The evidence, one line each
+};
+
+// XO-CHIP instructions, SUPER-CHIP instructions and machine code calls decide the profile, in that order.
+// Otherwise the profile that agrees best with the votes wins, CHIP-8 on a tie. trial_frames = 0 skips the
+// trial run.
+QuirkInference infer_quirks(const std::shared_ptr<const RomImage> &rom, long trial_frames);
+
+// Inferred profiles are cached in a text file, one "<hash> <profile>" line per ROM, so the inference only runs
+// the first time a ROM is loaded. An empty path disables the cache.
+std::string default_quirk_cache_path();  // ~/.chip8_quirks, or %APPDATA%\chip8_quirks.txt on Windows
+bool find_cached_quirks(const std::string &path, uint64_t hash, QuirkProfile &profile);
+bool cache_quirks(const std::string &path, uint64_t hash, QuirkProfile profile);
@@ -0,0 +1,22 @@
+#include "quirks.h"
+#include <cstring>
+
+static const char *PROFILE_NAMES[] = { "chip8", "schip", "xochip", "vip" };
+
+const char *quirk_profile_name(QuirkProfile profile) {
+    return PROFILE_NAMES[static_cast<int>(profile)];
+}
+
+uint32_t quirk_memory_size(QuirkProfile profile) {
+    return profile == QuirkProfile::XoChip ? XoChipQuirks::memory_size : Chip8Quirks::memory_size;
+}
+
+bool parse_quirk_profile(const char *name, QuirkProfile &profile) {
+    for (int i = 0; i < 4; ++i) {
+        if (strcmp(name, PROFILE_NAMES[i]) == 0) {
+            profile = static_cast<QuirkProfile>(i);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Behaviour differences between CHIP-8 interpreters.
+// Each profile is a set of compile-time constants, the interpreter is instantiated once per profile so the
+// quirk checks in the opcode handlers fold away instead of being tested every cycle.
+enum class QuirkProfile {
+    Chip8,      // Common modern CHIP-8 (Cowgod's reference), the default
+    SuperChip,  // SUPER-CHIP 1.1 on the HP48
+    XoChip,     // XO-CHIP (Octo)
+    CosmacVip   // The original COSMAC VIP interpreter
+};
+
+struct Chip8Quirks {
+    static constexpr bool shift_uses_vy = false;           // 8XY6/8XYE shift VY into VX instead of shifting VX
+    static constexpr bool load_store_increments_i = false; // FX55/FX65 leave I pointing past the last register
+    static constexpr bool jump_uses_vx = false;            // BXNN jumps to XNN + VX instead of NNN + V0
+    static constexpr bool clip_sprites = false;            // DXYN clips sprites at the screen edges instead of wrapping
+    static constexpr bool logic_resets_vf = false;         // 8XY1/8XY2/8XY3 reset VF to 0
+    static constexpr bool large_sprites = false;           // DXY0 draws a 16x16 sprite instead of nothing
+    static constexpr uint32_t memory_size = 4096;          // Addressable memory, ROMs are loaded at 0x200
+};
+
+struct SuperChipQuirks {
+    static constexpr bool shift_uses_vy = false;
+    static constexpr bool load_store_increments_i = false;
+    static constexpr bool jump_uses_vx = true;
+    static constexpr bool clip_sprites = true;
+    static constexpr bool logic_resets_vf = false;
+    static constexpr bool large_sprites = true;
+    static constexpr uint32_t memory_size = 4096;
+};
+
+struct XoChipQuirks {
+    static constexpr bool shift_uses_vy = true;
+    static constexpr bool load_store_increments_i = true;
+    static constexpr bool jump_uses_vx = false;
+    static constexpr bool clip_sprites = false;
+    static constexpr bool logic_resets_vf = false;
+    static constexpr bool large_sprites = true;
+    static constexpr uint32_t memory_size = 65536;
+};
+
+struct CosmacVipQuirks {
+    static constexpr bool shift_uses_vy = true;
+    static constexpr bool load_store_increments_i = true;
+    static constexpr bool jump_uses_vx = false;
+    static constexpr bool clip_sprites = true;
+    static constexpr bool logic_resets_vf = true;
+    static constexpr bool large_sprites = false;
+    static constexpr uint32_t memory_size = 4096;
+};
+
+// Runtime view of the profile's memory_size
+uint32_t quirk_memory_size(QuirkProfile profile);
+
+// Profile names as used on the command line: chip8, schip, xochip, vip
+const char *quirk_profile_name(QuirkProfile profile);
+bool parse_quirk_profile(const char *name, QuirkProfile &profile);
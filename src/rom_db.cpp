@@ -0,0 +1,83 @@
+#include "rom_db.h"
+#include <algorithm>
+
+// 0: COSMAC VIP hex keypad laid out on the left of a QWERTY keyboard
+//      1 2 3 C        1 2 3 4
+//      4 5 6 D   =>   Q W E R
+//      7 8 9 E        A S D F
+//      A 0 B F        Z X C V
+// 1: WASD for games steered with 2/4/6/8 and fired with 5 (space)
+const char *const KEYMAPS[KEYMAP_COUNT] = {
+    "x123qweasdzc4rfv",
+    "xqwea dzsc1234rf",
+};
+
+// Off, plane 0, plane 1, both planes (RGBA8888)
+const uint32_t PALETTES[PALETTE_COUNT][Display::COLORS] = {
+    { 0x000000FF, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF }, // Monochrome
+    { 0x0F1F0FFF, 0x33FF66FF, 0x1A8033FF, 0x99FFB2FF }, // Green phosphor
+    { 0x1F1200FF, 0xFFB000FF, 0x805800FF, 0xFFD780FF }, // Amber
+};
+
+const RomInfo DEFAULT_ROM_INFO = { 0, "Unknown", QuirkProfile::Chip8, 11, 0, 0 };
+
+// Keep sorted by hash, this is checked at compile time below
+static constexpr RomInfo ROM_DATABASE[] = {
+    { 0x04eb2109dc29b1abull, "TETRIS", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x0f81c6a74dcd366eull, "PONG2", QuirkProfile::Chip8, 9, 0, 0 },
+    { 0x0fd332d0bc68c9f2ull, "BLINKY", QuirkProfile::SuperChip, 20, 0, 0 },
+    { 0x1bbb10c8e5cadbb5ull, "GUESS", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x1e209a80fd3d334aull, "Clock Program", QuirkProfile::CosmacVip, 9, 0, 2 },
+    { 0x25e96e1086ce43cbull, "MAZE", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x29bcab9b664d212bull, "BLITZ", QuirkProfile::CosmacVip, 11, 1, 0 },
+    { 0x32610a8a06c779ebull, "c8_test", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x36f264b8f72349a6ull, "PUZZLE", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x3e2c2d43b296b74cull, "TANK", QuirkProfile::Chip8, 11, 1, 1 },
+    { 0x3f58eb4fa83dcd98ull, "HIDDEN", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x43def5533f6d8d25ull, "MERLIN", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x56049e83866b207dull, "TICTAC", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0x624b3eed64313f42ull, "PONG", QuirkProfile::Chip8, 9, 0, 0 },
+    { 0x71cdb8b926f1b988ull, "MISSILE", QuirkProfile::Chip8, 11, 1, 1 },
+    { 0x8d8a02fa3a2ed293ull, "UFO", QuirkProfile::Chip8, 11, 1, 1 },
+    { 0x8e547ebb12c026b4ull, "INVADERS", QuirkProfile::Chip8, 15, 1, 1 },
+    { 0xa8e9391ebb18df6full, "KALEID", QuirkProfile::Chip8, 11, 0, 2 },
+    { 0xadf99268db3c3bc9ull, "CONNECT4", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0xb7e1d74b387bede6ull, "WIPEOFF", QuirkProfile::Chip8, 11, 1, 0 },
+    { 0xc86e8ff63fce668cull, "BRIX", QuirkProfile::Chip8, 11, 1, 0 },
+    { 0xcdaa32787deaa913ull, "VBRIX", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0xe59fd57fa44ecb40ull, "15PUZZLE", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0xeae1357f230d90c5ull, "VERS", QuirkProfile::Chip8, 11, 0, 0 },
+    { 0xec7ca0de3e110327ull, "SYZYGY", QuirkProfile::Chip8, 15, 0, 2 },
+};
+
+constexpr size_t ROM_DATABASE_SIZE = sizeof(ROM_DATABASE) / sizeof(ROM_DATABASE[0]);
+
+// Splits the range in halves, so the recursion is only log2(size) deep and the table can hold thousands of ROMs
+static constexpr bool sorted(size_t begin, size_t end);
+static constexpr bool sorted_halves(size_t begin, size_t middle, size_t end) {
+    return sorted(begin, middle) && ROM_DATABASE[middle - 1].hash < ROM_DATABASE[middle].hash && sorted(middle, end);
+}
+static constexpr bool sorted(size_t begin, size_t end) {
+    return end - begin < 2 || sorted_halves(begin, begin + (end - begin) / 2, end);
+}
+static_assert(sorted(0, ROM_DATABASE_SIZE), "ROM_DATABASE must be sorted by hash");
+
+uint64_t hash_rom(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+const RomInfo *find_rom_info(uint64_t hash) {
+    const RomInfo *end = ROM_DATABASE + ROM_DATABASE_SIZE;
+    const RomInfo *it = std::lower_bound(ROM_DATABASE, end, hash, [](const RomInfo &info, uint64_t value) {
+        return info.hash < value;
+    });
+    if (it == end || it->hash != hash) {
+        return nullptr;
+    }
+    return it;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "display.h"
+#include "quirks.h"
+
+// Per-ROM settings, looked up by a hash of the ROM file contents when it is loaded.
+struct RomInfo {
+    uint64_t hash;
+    const char *title;
+    QuirkProfile profile;
+    uint16_t cycles_per_frame; // Instructions executed per 60 Hz frame
+    uint8_t keymap;            // Index into KEYMAPS
+    uint8_t palette;           // Index into PALETTES
+};
+
+// Host keys for CHIP-8 keys 0 to F. Keys are given as characters, which match SDL keycodes for letters,
+// digits and space.
+constexpr int KEYMAP_COUNT = 2;
+extern const char *const KEYMAPS[KEYMAP_COUNT];
+
+constexpr int PALETTE_COUNT = 3;
+extern const uint32_t PALETTES[PALETTE_COUNT][Display::COLORS];
+
+// Settings used for ROMs that are not in the database
+extern const RomInfo DEFAULT_ROM_INFO;
+
+// 64-bit FNV-1a hash of the ROM contents
+uint64_t hash_rom(const uint8_t *data, size_t size);
+
+// Binary search of the database, which is sorted by hash at compile time. Returns nullptr for unknown ROMs.
+const RomInfo *find_rom_info(uint64_t hash);
@@ -0,0 +1,264 @@
+#include "timeline.h"
+#include <algorithm>
+
+Timeline::Timeline(Chip8 &chip8, uint32_t keyframe_interval) : chip8(chip8) {
+    this->keyframe_interval = std::max<uint32_t>(keyframe_interval, 1);
+    position = 0;
+    recorded_end = 0;
+    next_event = 0;
+    frames_since_keyframe = 0;
+    add_keyframe();
+}
+
+// A second snapshot of the same moment (the debugger changed something) replaces the first
+void Timeline::add_keyframe() {
+    if (!keyframes.empty() && keyframes.back().time == position && keyframes.back().next_event == next_event) {
+        keyframes.pop_back();
+    }
+    Keyframe keyframe;
+    keyframe.time = position;
+    keyframe.next_event = next_event;
+    chip8.save(keyframe.snapshot);
+    keyframes.push_back(keyframe);
+    frames_since_keyframe = 0;
+}
+
+// Forgets everything recorded after the current position, before the machine runs on from it
+void Timeline::truncate() {
+    if (next_event == events.size() && position == recorded_end) {
+        return;
+    }
+    events.resize(next_event);
+    while (keyframes.back().time > position ||
+           (keyframes.back().time == position && keyframes.back().next_event > next_event)) {
+        keyframes.pop_back();
+    }
+    recorded_end = position;
+
+    frames_since_keyframe = 0;
+    for (size_t i = keyframes.back().next_event; i < events.size(); ++i) {
+        frames_since_keyframe += events[i].kind == EventKind::Tick;
+    }
+}
+
+// Logs the timer tick that ended a frame
+void Timeline::log_tick() {
+    Event tick = { position, EventKind::Tick, 0 };
+    events.push_back(tick);
+    next_event = events.size();
+    if (++frames_since_keyframe >= keyframe_interval) {
+        add_keyframe();
+    }
+}
+
+// Calls that don't change the keypad (the frontend reports every key every frame) aren't logged
+void Timeline::key_event(uint8_t key, bool pressed) {
+    if (key > 0xF || (chip8.keypad[key] != 0) == pressed) {
+        return;
+    }
+    truncate();
+    chip8.key_event(key, pressed);
+    Event event = { position, pressed ? EventKind::KeyDown : EventKind::KeyUp, key };
+    events.push_back(event);
+    next_event = events.size();
+}
+
+RunResult Timeline::run_frames(uint64_t frames) {
+    RunResult total = { StopReason::FrameCompleted, 0, 0 };
+    truncate();
+
+    while (total.frames < frames) {
+        RunResult result = chip8.run_frames(1);
+        position += result.instructions;
+        total.instructions += result.instructions;
+        if (result.frames == 0) {
+            total.reason = result.reason;
+            break;
+        }
+        log_tick();
+        ++total.frames;
+        if (result.reason != StopReason::FrameCompleted) {
+            total.reason = result.reason;
+            break;
+        }
+    }
+    recorded_end = position;
+    return total;
+}
+
+// Ends the frame like run_frames() would: when it is full, or the instruction made the machine idle
+bool Timeline::step() {
+    truncate();
+    int executed = chip8.run_instructions(1);
+    position += executed;
+    chip8.frame_instructions += executed;
+    if (executed > 0 &&
+        (chip8.frame_instructions >= chip8.cycles_per_frame || (chip8.idle && !chip8.watchpoint_hit))) {
+        chip8.frame_instructions = 0;
+        chip8.tick_timers();
+        log_tick();
+    }
+    recorded_end = position;
+    return executed > 0;
+}
+
+void Timeline::state_changed() {
+    truncate();
+    add_keyframe();
+}
+
+// Index of the last keyframe at or before time
+size_t Timeline::keyframe_before(uint64_t time) const {
+    auto later = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+                                  [](uint64_t t, const Keyframe &keyframe) { return t < keyframe.time; });
+    return static_cast<size_t>(later - keyframes.begin()) - 1;
+}
+
+void Timeline::restore(size_t keyframe) {
+    chip8.restore(keyframes[keyframe].snapshot);
+    position = keyframes[keyframe].time;
+    next_event = keyframes[keyframe].next_event;
+}
+
+// Runs the restored machine on to time target, applying the logged events on the way (including the ones at
+// target). observe(pc, executed) is called after every run with the pc it started from, runs are single
+// instructions if single_steps. Breakpoints and watchpoints stop runs, the replay carries on past them.
+template <typename Observer>
+void Timeline::replay(uint64_t target, bool single_steps, Observer observe) {
+    const uint64_t MAX_BUDGET = 1 << 30;
+
+    for (;;) {
+        while (next_event < events.size() && events[next_event].time == position) {
+            const Event &event = events[next_event++];
+            if (event.kind == EventKind::Tick) {
+                chip8.frame_instructions = 0;
+                chip8.tick_timers();
+            } else {
+                chip8.key_event(event.key, event.kind == EventKind::KeyDown);
+            }
+        }
+        if (position >= target) {
+            break;
+        }
+
+        uint64_t until = target;
+        if (next_event < events.size()) {
+            until = std::min(until, events[next_event].time);
+        }
+        uint16_t pc = chip8.pc;
+        int executed = chip8.run_instructions(single_steps ? 1 : static_cast<int>(std::min(until - position,
+                                                                                           MAX_BUDGET)));
+        position += executed;
+        chip8.frame_instructions += executed;
+        observe(pc, executed);
+        if (executed == 0 && !chip8.breakpoint_hit) {
+            // Only a log that doesn't match the machine gets here
+            break;
+        }
+    }
+}
+
+void Timeline::seek(uint64_t time) {
+    time = std::min(time, recorded_end);
+    restore(keyframe_before(time));
+    replay(time, false, [](uint16_t, int) {});
+}
+
+bool Timeline::step_back() {
+    if (position == 0) {
+        return false;
+    }
+    seek(position - 1);
+    return true;
+}
+
+// Replays one keyframe interval at a time, newest first, until found(pc, executed, hit) reports a hit before
+// the starting time. start() is called after each keyframe is restored. The last hit of an interval wins.
+// The machine is left at the end of that interval.
+template <typename Start, typename Found>
+TimelineHit Timeline::search_back(bool single_steps, Start start, Found found) {
+    uint64_t origin = position;
+    uint64_t segment_end = origin;
+    TimelineHit hit = { false, 0, 0 };
+    if (origin == 0) {
+        return hit;
+    }
+
+    for (size_t keyframe = keyframe_before(origin - 1); ; --keyframe) {
+        restore(keyframe);
+        start();
+        replay(segment_end, single_steps, [&](uint16_t pc, int executed) {
+            TimelineHit candidate = { false, 0, 0 };
+            if (found(pc, executed, candidate) && candidate.time < origin) {
+                hit = candidate;
+            }
+        });
+        if (hit.found || keyframe == 0) {
+            break;
+        }
+        segment_end = keyframes[keyframe].time;
+    }
+    return hit;
+}
+
+bool Timeline::reverse_continue() {
+    uint64_t origin = position;
+    TimelineHit hit = search_back(false, [] {}, [this](uint16_t, int, TimelineHit &candidate) {
+        if (!chip8.breakpoint_hit && !chip8.watchpoint_hit) {
+            return false;
+        }
+        candidate.found = true;
+        candidate.time = position;
+        candidate.pc = chip8.pc;
+        return true;
+    });
+    seek(hit.found ? hit.time : origin);
+    return hit.found;
+}
+
+// A temporary write watchpoint finds the stores. They don't jump, so the store is the instruction before pc.
+TimelineHit Timeline::last_write(uint32_t address) {
+    uint64_t origin = position;
+    address &= chip8.memory.size() - 1;
+    bool temporary = !chip8.has_watchpoint(address, WATCH_WRITE);
+    if (temporary) {
+        chip8.set_watchpoint(address, 1, WATCH_WRITE);
+    }
+
+    TimelineHit hit = search_back(false, [] {}, [this, address](uint16_t, int, TimelineHit &candidate) {
+        if (!chip8.watchpoint_hit || !chip8.watch_was_write || chip8.watch_address != address) {
+            return false;
+        }
+        candidate.found = true;
+        candidate.time = position - 1;
+        candidate.pc = static_cast<uint16_t>(chip8.pc - 2);
+        return true;
+    });
+
+    if (temporary) {
+        chip8.clear_watchpoint(address, 1, WATCH_WRITE);
+    }
+    seek(origin);
+    return hit;
+}
+
+// Replays one instruction at a time, comparing the pixel after each one with the pixel before it
+TimelineHit Timeline::last_pixel_change(int x, int y, int plane) {
+    uint64_t origin = position;
+    bool lit = false;
+
+    TimelineHit hit = search_back(true, [&] { lit = chip8.display.pixel(x, y, plane); },
+                                  [&](uint16_t pc, int executed, TimelineHit &candidate) {
+        bool was_lit = lit;
+        lit = chip8.display.pixel(x, y, plane);
+        if (executed == 0 || lit == was_lit) {
+            return false;
+        }
+        candidate.found = true;
+        candidate.time = position - 1;
+        candidate.pc = pc;
+        return true;
+    });
+    seek(origin);
+    return hit;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "chip8.h"
+
+// Recorded session for time-travel debugging. Time is the number of instructions run since recording started.
+// The machine is deterministic given its inputs, so only the key events and the timer ticks are logged, plus a
+// keyframe snapshot every few frames. Going back to a time restores the nearest keyframe at or before it (binary
+// search) and replays the log from there with the normal interpreter, so a lookup costs at most one keyframe
+// interval of emulation however long the session is.
+//
+// While recording, the frontend runs the machine and presses keys through the timeline. Going back and then
+// running on drops the recorded future.
+constexpr uint32_t DEFAULT_KEYFRAME_INTERVAL = 60;  // Frames, one second
+
+// An instruction found by a query
+struct TimelineHit {
+    bool found;
+    uint64_t time;  // When it ran
+    uint16_t pc;    // Its address
+};
+
+class Timeline {
+    public:
+        // Starts recording from the machine's current state
+        explicit Timeline(Chip8 &chip8, uint32_t keyframe_interval = DEFAULT_KEYFRAME_INTERVAL);
+
+        uint64_t now() const { return position; }
+        uint64_t end() const { return recorded_end; }
+        size_t keyframe_count() const { return keyframes.size(); }
+
+        // Recording
+        void key_event(uint8_t key, bool pressed);
+        RunResult run_frames(uint64_t frames);
+        bool step();  // One instruction. Returns false if the machine can't run one (exited or waiting for a key).
+
+        // The debugger changed registers or memory. The past stays as it was, the change starts a new future.
+        void state_changed();
+
+        // Puts the machine in the state it had at time (at most end()), after the events logged at that time
+        void seek(uint64_t time);
+        bool step_back();
+
+        // Goes back to the last time before now at which the machine stopped on a breakpoint or watchpoint.
+        // Returns false (staying put) if there is none.
+        bool reverse_continue();
+
+        // The last instruction before now that wrote the byte, or changed the pixel of a plane. The machine is
+        // left where it was.
+        TimelineHit last_write(uint32_t address);
+        TimelineHit last_pixel_change(int x, int y, int plane = 0);
+
+    private:
+        enum class EventKind : uint8_t { Tick, KeyDown, KeyUp };
+
+        struct Event {
+            uint64_t time;
+            EventKind kind;
+            uint8_t key;
+        };
+
+        struct Keyframe {
+            uint64_t time;
+            size_t next_event;  // Events before it happened before the snapshot
+            Snapshot snapshot;
+        };
+
+        Chip8 &chip8;
+        uint32_t keyframe_interval;
+        std::vector<Event> events;
+        std::vector<Keyframe> keyframes;  // By time
+        uint64_t position;
+        uint64_t recorded_end;
+        size_t next_event;   // First event not applied yet
+        uint64_t frames_since_keyframe;
+
+        void add_keyframe();
+        void truncate();
+        void log_tick();
+        size_t keyframe_before(uint64_t time) const;
+        void restore(size_t keyframe);
+        template <typename Observer> void replay(uint64_t target, bool single_steps, Observer observe);
+        template <typename Start, typename Found>
+        TimelineHit search_back(bool single_steps, Start start, Found found);
+};
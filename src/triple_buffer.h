@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer / single consumer triple buffer.
+// The writer fills back() and publish()es it, the reader acquire()s the most recently published slot and reads
+// front(). Neither side ever waits: the writer always has a free slot, and the reader skips frames it was too
+// slow to see instead of holding the writer up.
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() : back_index(0), middle(1), front_index(2) {}
+
+        // Writer side
+        T &back() { return slots[back_index]; }
+
+        void publish() {
+            back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        // Reader side. Returns false if nothing new was published since the last call.
+        bool acquire() {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+                return false;
+            }
+            front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX_MASK;
+            return true;
+        }
+
+        const T &front() const { return slots[front_index]; }
+
+    private:
+        static constexpr uint8_t INDEX_MASK = 0x3;
+        static constexpr uint8_t FRESH = 0x4; // Set in middle when it holds a slot the reader hasn't seen
+
+        T slots[3];
+
+        // Each side owns one index, the middle slot is handed over with an atomic exchange
+        alignas(64) uint8_t back_index;
+        alignas(64) std::atomic<uint8_t> middle;
+        alignas(64) uint8_t front_index;
+};
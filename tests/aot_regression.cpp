@@ -0,0 +1,58 @@
+// Runs the ROM that was compiled with tools/chip8_aot next to the reference switch interpreter and checks that
+// they end every frame in the same state.
+// Usage: chip8_aot_regression [--frames=<n>] <ROM the linked code was generated from>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../src/aot.h"
+#include "lockstep.h"
+
+int main(int argc, char *argv[]) {
+    long frames = 3000;
+    const char *rom_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = std::atol(argv[i] + 9);
+        } else {
+            rom_path = argv[i];
+        }
+    }
+    std::shared_ptr<const RomImage> rom = rom_path != nullptr ? RomImage::from_file(rom_path) : nullptr;
+    if (rom == nullptr || rom->hash != AOT_ROM_HASH) {
+        std::printf("Give the ROM the code was generated from\n");
+        return EXIT_FAILURE;
+    }
+
+    Chip8 reference;
+    Chip8 compiled;
+    Chip8 *machines[] = { &reference, &compiled };
+    for (int i = 0; i < 2; ++i) {
+        machines[i]->init();
+        machines[i]->set_quirks(AOT_PROFILE);
+        machines[i]->load_rom(rom);
+        machines[i]->randGen.seed(1);
+        machines[i]->interpreter = Interpreter::Switch;
+    }
+
+    for (long frame = 0; frame < frames; ++frame) {
+        int budget = frame_budget(frame);
+        scripted_input(reference, frame);
+        scripted_input(compiled, frame);
+        int executed = reference.run_instructions(budget);
+        const char *difference = aot_run(compiled, budget) != executed ? "instruction count" : nullptr;
+        reference.tick_timers();
+        compiled.tick_timers();
+
+        if (difference == nullptr) {
+            difference = compare(reference, compiled);
+        }
+        if (difference != nullptr) {
+            std::printf("%s: compiled code differs in frame %ld (%s), pc %04X vs %04X\n", rom_path, frame, difference,
+                        compiled.pc, reference.pc);
+            return EXIT_FAILURE;
+        }
+    }
+    std::printf("%s: compiled code ran the same as the interpreter for %ld frames\n", rom_path, frames);
+    return EXIT_SUCCESS;
+}
@@ -1,8 +1,905 @@
+// The checks are asserts, keep them in builds that define NDEBUG
+#undef NDEBUG
 #include <assert.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "../src/display.h"
+#include "../src/chip8.h"
+#include "../src/rom_db.h"
+#include "../src/blender.h"
+#include "../src/config.h"
+#include "../src/ir.h"
+#include "../src/disasm.h"
+#include "../src/quirk_infer.h"
+#include "../src/gdb_stub.h"
+#include "../src/timeline.h"
+#include "../src/coverage.h"
+#include "../src/heatmap.h"
+#include "../src/triple_buffer.h"
+#include "../src/frame_pacer.h"
 
 // todo: Please find unit test framework :D
 void test() {
     uint8_t value = 0xFF;
     uint8_t msb = value & 0x80 >> 7u;
     assert(msb == 0b1);
-}
\ No newline at end of file
+}
+
+void test_display_hires_scroll() {
+    Display display;
+    display.set_hires(true);
+
+    // 8 pixel sprite row crossing the word boundary in the middle of the screen
+    assert(!display.draw_sprite_row(0, 60, 0, 0xFF, 8));
+    assert(display.pixel(60, 0) && display.pixel(67, 0) && !display.pixel(68, 0));
+
+    display.scroll_right(4);
+    assert(!display.pixel(60, 0) && display.pixel(64, 0) && display.pixel(71, 0));
+
+    display.scroll_down(3);
+    assert(!display.pixel(64, 0) && display.pixel(64, 3));
+
+    // Drawing the same row again switches the pixels off and reports a collision
+    assert(display.draw_sprite_row(0, 64, 3, 0xFF, 8));
+    assert(!display.pixel(64, 3));
+}
+
+void test_shift_quirks() {
+    static Chip8 chip8;
+
+    // V1 = 0x81, V2 = 0x04, 8126 (V1 >>= 1, or V1 = V2 >> 1 with shift_uses_vy)
+    uint8_t program[] = { 0x61, 0x81, 0x62, 0x04, 0x81, 0x26, 0x81, 0x2E };
+
+    chip8.init();
+    chip8.load_rom(program, sizeof(program));
+    for (int i = 0; i < 3; ++i) {
+        chip8.emulate_cycle();
+    }
+    assert(chip8.registers[1] == 0x40 && chip8.registers[0xF] == 1);
+    // 812E shifts V1 (0x40) left, VF gets its old MSB
+    chip8.emulate_cycle();
+    assert(chip8.registers[1] == 0x80 && chip8.registers[0xF] == 0);
+
+    chip8.init();
+    chip8.set_quirks(QuirkProfile::CosmacVip);
+    chip8.load_rom(program, sizeof(program));
+    for (int i = 0; i < 4; ++i) {
+        chip8.emulate_cycle();
+    }
+    // 812E shifts V2 (0x04) left, VF gets its old MSB
+    assert(chip8.registers[1] == 0x08 && chip8.registers[0xF] == 0);
+}
+
+void test_shared_rom_image() {
+    // A300: I = 0x300, 6042: V0 = 0x42, F055: store V0 at I
+    uint8_t program[] = { 0xA3, 0x00, 0x60, 0x42, 0xF0, 0x55 };
+    std::shared_ptr<const RomImage> image = RomImage::from_buffer(program, sizeof(program));
+
+    static Chip8 first;
+    static Chip8 second;
+    first.init();
+    second.init();
+    assert(first.load_rom(image) && second.load_rom(image));
+
+    for (int i = 0; i < 3; ++i) {
+        first.emulate_cycle();
+    }
+
+    // The write lands in the first instance's overlay, the image and the second instance are untouched
+    assert(first.memory.read(0x300) == 0x42 && first.memory.overlay_pages() == 1);
+    assert(second.memory.read(0x300) == 0 && second.memory.overlay_pages() == 0);
+    assert(image->bytes[0x300] == 0);
+}
+
+void test_display_dirty_rows() {
+    Display display;
+    display.take_dirty_rows();
+
+    display.draw_sprite_row(0, 10, 5, 0xF0, 8);
+    display.draw_sprite_row(0, 10, 7, 0x00, 8);
+    // Only the row that actually changed is reported, and only once
+    assert(display.take_dirty_rows() == (1ull << 5));
+    assert(display.take_dirty_rows() == 0);
+
+    display.scroll_down(1);
+    assert(display.take_dirty_rows() == 0xFFFFFFFFull);
+}
+
+void test_phosphor_blend() {
+    Display display;
+    FrameBlender blender(BlendMode::Phosphor);
+    const uint32_t palette[Display::COLORS] = { 0x000000FF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+    uint32_t row[64];
+
+    display.draw_sprite_row(0, 0, 0, 0x80, 8);
+    assert(blender.update(display) != 0);
+    blender.to_rgba_row(row, 0, palette);
+    assert(row[0] == 0xFFFFFFFF && row[1] == 0x000000FF);
+
+    // Erased pixel fades over the next frames instead of disappearing at once
+    display.draw_sprite_row(0, 0, 0, 0x80, 8);
+    assert(blender.update(display) == 1);
+    blender.to_rgba_row(row, 0, palette);
+    assert(row[0] != 0xFFFFFFFF && row[0] != 0x000000FF);
+
+    assert(blender.update(display) == 1);
+    assert(blender.update(display) == 1);
+    blender.to_rgba_row(row, 0, palette);
+    assert(row[0] == 0x000000FF);
+    assert(blender.update(display) == 0);
+}
+
+void test_command_line() {
+    Config config;
+    std::string error;
+    char arg0[] = "Chip8", rom[] = "PONG", profile[] = "schip", cycles[] = "--cycles=30", turbo[] = "--turbo";
+    char *argv[] = { arg0, cycles, rom, profile, turbo };
+
+    assert(parse_command_line(5, argv, config, error));
+    assert(config.rom_path == "PONG");
+    assert(config.has_profile && config.profile == QuirkProfile::SuperChip);
+    assert(config.cycles_per_frame == 30 && config.turbo);
+    // Left unset, resolved from the ROM database
+    assert(config.palette == -1 && !config.has_seed);
+
+    assert(apply_option("palette", "amber", config, error) && config.palette == 2);
+    assert(apply_option("trace", "off", config, error) && !config.trace);
+    assert(!apply_option("scale", "0", config, error));
+    assert(!apply_option("speed", "1", config, error));
+
+    // A config file that includes itself fails instead of recursing
+    const char *path = "test_command_line.cfg";
+    FILE *file = fopen(path, "w");
+    assert(file != nullptr && fputs("scale = 4\nconfig = test_command_line.cfg\n", file) >= 0);
+    fclose(file);
+    error.clear();
+    assert(!load_config_file(path, config, error));
+    assert(error.find("Config files include each other") != std::string::npos);
+    remove(path);
+}
+
+void test_idle_loops() {
+    // FX07; 3X00; 1NNN back to FX07 waits for the delay timer
+    const uint8_t timer_wait[] = { 0xF3, 0x07, 0x33, 0x00, 0x12, 0x00 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(timer_wait, sizeof(timer_wait)));
+    chip8.delay_timer = 2;
+    for (int i = 0; i < 3; ++i) {
+        assert(!chip8.idle);
+        chip8.emulate_cycle();
+    }
+    assert(chip8.idle && chip8.pc == 0x200);
+
+    // Once the timer runs out the loop falls through instead
+    chip8.idle = false;
+    chip8.delay_timer = 0;
+    for (int i = 0; i < 2; ++i) {
+        chip8.emulate_cycle();
+    }
+    assert(!chip8.idle && chip8.pc == 0x206);
+
+    // FX0A blocks until a key is released and stores the key's index
+    const uint8_t key_wait[] = { 0xF5, 0x0A };
+    chip8.init();
+    assert(chip8.load_rom(key_wait, sizeof(key_wait)));
+    chip8.emulate_cycle();
+    assert(chip8.idle && chip8.waiting_for_key && chip8.pc == 0x202);
+
+    chip8.key_event(0xB, false);
+    chip8.key_event(0x3, true);
+    assert(chip8.waiting_for_key);
+    chip8.key_event(0x3, false);
+    assert(!chip8.waiting_for_key && chip8.registers[5] == 0x3);
+}
+
+void test_predecoded_run() {
+    // 6XNN; 6YNN runs as one superinstruction but still counts as two instructions
+    const uint8_t rom[] = { 0x60, 0x11, 0x61, 0x22, 0x62, 0x33 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(rom, sizeof(rom)));
+    chip8.profiling = true;
+    assert(chip8.run_instructions(2) == 2);
+    assert(chip8.registers[0] == 0x11 && chip8.registers[1] == 0x22 && chip8.pc == 0x204);
+#if CHIP8_SUPERINSTRUCTIONS
+    assert(chip8.fusion_counts[static_cast<int>(Fusion::LoadLoad)] == 1);
+#endif
+
+    // A pair is split when the budget only has room for its first half
+    assert(chip8.run_instructions(1) == 1);
+    assert(chip8.registers[2] == 0x33 && chip8.pc == 0x206);
+
+    // Writing over a decoded instruction replaces it
+    chip8.pc = 0x200;
+    chip8.write_memory(0x201, 0x44);
+    assert(chip8.run_instructions(1) == 1);
+    assert(chip8.registers[0] == 0x44);
+}
+
+void test_run_api() {
+    // 6000; 7001; 1202 counts V0 up forever
+    const uint8_t counter[] = { 0x60, 0x00, 0x70, 0x01, 0x12, 0x02 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(counter, sizeof(counter)));
+
+    RunResult result = chip8.run_cycles(101);
+    assert(result.reason == StopReason::BudgetExhausted && result.instructions == 101);
+    assert(chip8.registers[0] == 50);
+
+    result = chip8.run_until([](const Chip8 &c) { return c.registers[0] == 60; }, 1000);
+    assert(result.reason == StopReason::Predicate && result.instructions == 19);
+
+    chip8.cycles_per_frame = 10;
+    result = chip8.run_frames(3);
+    assert(result.reason == StopReason::FrameCompleted && result.frames == 3 && result.instructions == 30);
+
+    // --cycles goes past 65535
+    chip8.cycles_per_frame = 100000;
+    result = chip8.run_frames(1);
+    assert(result.frames == 1 && result.instructions == 100000);
+
+    // 5XY1 doesn't exist in any variant
+    const uint8_t illegal[] = { 0x60, 0x01, 0x50, 0x01 };
+    chip8.init();
+    assert(chip8.load_rom(illegal, sizeof(illegal)));
+    result = chip8.run_cycles(10);
+    assert(result.reason == StopReason::IllegalOpcode && chip8.pc == 0x202);
+
+    const uint8_t key_wait[] = { 0xF0, 0x0A, 0x12, 0x02 };
+    chip8.init();
+    assert(chip8.load_rom(key_wait, sizeof(key_wait)));
+    result = chip8.run_frames(5);
+    assert(result.reason == StopReason::WaitingForKey && result.frames == 1);
+}
+
+static int count_ir(const IrBlock &block, IrOp op, uint32_t slot) {
+    int count = 0;
+    for (const IrInst &inst : block.code) {
+        count += inst.op == op && (op != IrOp::Set || inst.imm == slot);
+    }
+    return count;
+}
+
+void test_ir_passes() {
+    // 6005; 4005 never skips; 8124 and 8324 both set VF; A300 twice; 120C waits forever
+    const uint8_t program[] = { 0x60, 0x05, 0x40, 0x05, 0x81, 0x24, 0x83, 0x24, 0xA3, 0x00, 0xA3, 0x00, 0x12, 0x0C };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(program, sizeof(program)));
+
+    IrBlock block = build_ir_block(chip8.memory, 0x200, QuirkProfile::Chip8);
+    assert(block.instructions == 7 && count_ir(block, IrOp::ExitIfNotEqual, 0) == 1);
+    assert(count_ir(block, IrOp::Set, IR_SLOT_VF) == 2 && count_ir(block, IrOp::Set, IR_SLOT_I) == 2);
+
+    optimize_ir_block(block);
+    assert(count_ir(block, IrOp::ExitIfNotEqual, 0) == 0);
+    assert(count_ir(block, IrOp::Set, IR_SLOT_VF) == 1 && count_ir(block, IrOp::Set, IR_SLOT_I) == 1);
+    assert(block.code.back().op == IrOp::Jump && block.code.back().imm2 == IR_IDLE_ALWAYS);
+
+    // 3005 after 6005 always skips, so the block ends there
+    const uint8_t skip[] = { 0x60, 0x05, 0x30, 0x05, 0x61, 0x01, 0x12, 0x06 };
+    chip8.init();
+    assert(chip8.load_rom(skip, sizeof(skip)));
+    block = build_ir_block(chip8.memory, 0x200, QuirkProfile::Chip8);
+    optimize_ir_block(block);
+    assert(block.instructions == 2 && block.code.back().op == IrOp::Jump && block.code.back().imm == 0x206);
+
+    // Folded operations match the interpreter: 8XY5 with VX < VY borrows
+    const uint8_t subtract[] = { 0x60, 0x03, 0x61, 0x05, 0x80, 0x15, 0x12, 0x06 };
+    chip8.init();
+    assert(chip8.load_rom(subtract, sizeof(subtract)));
+    block = build_ir_block(chip8.memory, 0x200, QuirkProfile::Chip8);
+    optimize_ir_block(block);
+    chip8.run_cycles(3);
+    for (const IrInst &inst : block.code) {
+        if (inst.op == IrOp::Set && inst.imm < 16) {
+            const IrInst &value = block.code[inst.a];
+            assert(value.op == IrOp::Const && value.imm == chip8.registers[inst.imm]);
+        }
+    }
+}
+
+void test_rom_analysis() {
+    // A20C; 2208 calls a subroutine that leaves I alone; D015 draws the 5 bytes at 20C; 1206 waits forever
+    const uint8_t program[] = { 0xA2, 0x0C, 0x22, 0x08, 0xD0, 0x15, 0x12, 0x06, 0x60, 0x01, 0x00, 0xEE,
+                                0xF0, 0x90, 0x90, 0x90, 0xF0, 0x00 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(program, sizeof(program)));
+
+    RomAnalysis analysis = analyze_rom(chip8.memory, sizeof(program), QuirkProfile::Chip8);
+    assert(analysis.blocks.size() == 4);
+    assert(analysis.blocks[0].successors.size() == 2 && analysis.blocks[0].successors[0].kind == EdgeKind::Call);
+    assert(analysis.find_block(0x20A)->start == 0x208 && analysis.find_block(0x20A)->returns);
+    assert(analysis.find_block(0x20C) == nullptr);
+    assert((analysis.flags[0x208] & ADDRESS_CALL_TARGET) && (analysis.flags[0x206] & ADDRESS_JUMP_TARGET));
+    for (uint32_t address = 0x20C; address < 0x211; ++address) {
+        assert(analysis.flags[address] == ADDRESS_SPRITE);
+    }
+    assert(analysis.flags[0x211] == 0);
+
+    assert(disassemble(0xD015, 0) == "DRW V0, V1, 5" && disassemble(0xF000, 0x1234) == "LD I, 0x1234");
+    assert(disassemble(0x8126, 0) == "SHR V1, V2" && disassemble(0x5121, 0) == "DW 0x5121");
+}
+
+void test_quirk_inference() {
+    // 00FF switches to hi-res, so only SUPER-CHIP runs it
+    const uint8_t hires[] = { 0x00, 0xFF, 0x12, 0x02 };
+    QuirkInference inference = infer_quirks(RomImage::from_buffer(hires, sizeof(hires)), 0);
+    assert(inference.needs_hires && inference.profile == QuirkProfile::SuperChip);
+
+    // 6105; 8016 shifts V1 into V0, which only makes sense with shift_uses_vy
+    const uint8_t shift[] = { 0x61, 0x05, 0x80, 0x16, 0x12, 0x04 };
+    std::shared_ptr<const RomImage> rom = RomImage::from_buffer(shift, sizeof(shift));
+    inference = infer_quirks(rom, QUIRK_TRIAL_FRAMES);
+    assert(inference.votes[INFER_SHIFT_USES_VY] == 1 && inference.profile == QuirkProfile::CosmacVip);
+    assert(inference.reasons.size() == 1);
+
+    const char *cache = "test_quirk_cache.txt";
+    QuirkProfile profile = QuirkProfile::Chip8;
+    std::remove(cache);
+    assert(!find_cached_quirks(cache, rom->hash, profile));
+    assert(cache_quirks(cache, rom->hash - 1, QuirkProfile::XoChip));
+    assert(cache_quirks(cache, rom->hash, QuirkProfile::CosmacVip));
+    assert(find_cached_quirks(cache, rom->hash, profile) && profile == QuirkProfile::CosmacVip);
+    assert(!find_cached_quirks("", rom->hash, profile));
+    std::remove(cache);
+}
+
+void test_debugger() {
+    // 6000; 6105 (fused); 7001; A300; F055; 1204 counts V0 up and stores it at 0x300
+    const uint8_t rom[] = { 0x60, 0x00, 0x61, 0x05, 0x70, 0x01, 0xA3, 0x00, 0xF0, 0x55, 0x12, 0x04 };
+    const Interpreter interpreters[] = {
+        Interpreter::Switch, Interpreter::Predecoded, Interpreter::Threaded, Interpreter::Jit
+    };
+    for (Interpreter interpreter : interpreters) {
+        Chip8 chip8;
+        chip8.init();
+        chip8.interpreter = interpreter;
+        assert(chip8.load_rom(rom, sizeof(rom)));
+
+        // The second half of a superinstruction stops too
+        chip8.set_breakpoint(0x202);
+        RunResult result = chip8.run_cycles(100);
+        assert(result.reason == StopReason::Breakpoint && result.instructions == 1 && chip8.pc == 0x202);
+        assert(chip8.registers[1] == 0);
+        chip8.clear_breakpoint(0x202);
+
+        // Continuing runs the instruction under the breakpoint, then goes round the loop once
+        chip8.set_breakpoint(0x208);
+        result = chip8.run_cycles(100);
+        assert(result.reason == StopReason::Breakpoint && result.instructions == 3 && chip8.registers[1] == 5);
+        result = chip8.run_cycles(100);
+        assert(result.reason == StopReason::Breakpoint && result.instructions == 4 && chip8.registers[0] == 2);
+        result = chip8.run_until([](const Chip8 &) { return false; }, 100);
+        assert(result.reason == StopReason::Breakpoint && result.instructions == 4 && chip8.pc == 0x208);
+
+        // A frame cut short by a breakpoint is finished by the next call
+        chip8.cycles_per_frame = 6;
+        result = chip8.run_frames(1);
+        assert(result.reason == StopReason::Breakpoint && result.frames == 0 && result.instructions == 4);
+        result = chip8.run_frames(1);
+        assert(result.reason == StopReason::FrameCompleted && result.frames == 1 && result.instructions == 2);
+        chip8.clear_breakpoint(0x208);
+
+        // Watchpoints stop after the instruction
+        chip8.set_watchpoint(0x300, 1, WATCH_WRITE);
+        result = chip8.run_cycles(100);
+        assert(result.reason == StopReason::Watchpoint && result.instructions == 3 && chip8.pc == 0x20A);
+        assert(chip8.watch_address == 0x300 && chip8.watch_was_write && chip8.memory.read(0x300) == 5);
+        chip8.clear_debug_points();
+        assert(!chip8.debugging() && chip8.run_cycles(100).reason == StopReason::BudgetExhausted);
+
+        // Sprite fetches are reads
+        const uint8_t draw[] = { 0xA2, 0x06, 0xD0, 0x02, 0x12, 0x04, 0xFF, 0x81 };
+        chip8.init();
+        assert(chip8.load_rom(draw, sizeof(draw)));
+        chip8.set_watchpoint(0x207, 1, WATCH_READ);
+        result = chip8.run_cycles(100);
+        assert(result.reason == StopReason::Watchpoint && chip8.watch_address == 0x207 && !chip8.watch_was_write);
+        assert(chip8.pc == 0x204 && chip8.display.pixel(0, 1));
+    }
+}
+
+void test_gdb_stub() {
+    // 6000; 7001; A300; F055; 1202
+    const uint8_t rom[] = { 0x60, 0x00, 0x70, 0x01, 0xA3, 0x00, 0xF0, 0x55, 0x12, 0x02 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(rom, sizeof(rom)));
+    GdbStub stub(chip8);
+    std::string reply;
+
+    assert(stub.handle_packet("?", reply) && reply == "T05");
+    assert(stub.handle_packet("g", reply) && reply.size() == 2 * (16 + 2 + 2 + 3) && reply.substr(36, 4) == "0200");
+    assert(stub.handle_packet("P5=2a", reply) && reply == "OK" && chip8.registers[5] == 0x2A);
+    assert(stub.handle_packet("p11", reply) && reply == "0200");
+    assert(stub.handle_packet("m200,4", reply) && reply == "60007001");
+    assert(stub.handle_packet("m2000,1", reply) && reply == "E01");
+    assert(stub.handle_packet("M300,2:abcd", reply) && reply == "OK" && chip8.memory.read(0x301) == 0xCD);
+
+    // Steps don't stop on the breakpoint they start from
+    assert(stub.handle_packet("Z0,206,2", reply) && reply == "OK" && chip8.has_breakpoint(0x206));
+    assert(stub.handle_packet("s", reply) && reply == "T05" && chip8.pc == 0x202);
+    assert(!stub.handle_packet("c", reply));
+    chip8.run_frames(1);
+    assert(chip8.breakpoint_hit && chip8.pc == 0x206);
+    assert(stub.handle_packet("s", reply) && reply == "T05" && chip8.pc == 0x208 && chip8.memory.read(0x300) == 1);
+
+    assert(stub.handle_packet("z0,206,2", reply) && reply == "OK" && !chip8.debugging());
+    // Watched ranges past the end of memory are rejected
+    assert(stub.handle_packet("Z2,0,ffffffff", reply) && reply == "E01");
+    assert(stub.handle_packet("z4,ff0,20", reply) && reply == "E01");
+    assert(stub.handle_packet("Z2,300,1", reply) && reply == "OK");
+    assert(!stub.handle_packet("vCont;c", reply));
+    chip8.run_frames(1);
+    assert(stub.handle_packet("?", reply) && reply == "T05watch:300;" && chip8.pc == 0x208);
+}
+
+void test_timeline() {
+    // 6000; A300; 7001; F055; D011; 1204: count in V0, store it at 300 and draw it at (V0, 0)
+    const uint8_t rom[] = { 0x60, 0x00, 0xA3, 0x00, 0x70, 0x01, 0xF0, 0x55, 0xD0, 0x11, 0x12, 0x04 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(rom, sizeof(rom)));
+    chip8.cycles_per_frame = 10;
+    chip8.delay_timer = 30;
+    Timeline timeline(chip8, 2);
+
+    RunResult result = timeline.run_frames(5);
+    assert(result.frames == 5 && timeline.now() == 50 && timeline.keyframe_count() == 3);
+    assert(chip8.registers[0] == 12 && chip8.delay_timer == 25);
+    Display later;
+    later.copy_from(chip8.display);
+
+    // Going back and forth replays the same machine
+    timeline.seek(20);
+    assert(timeline.now() == 20 && chip8.registers[0] == 5 && chip8.pc == 0x208 && chip8.delay_timer == 28);
+    timeline.seek(50);
+    later.take_dirty_rows();
+    later.copy_from(chip8.display);
+    assert(chip8.registers[0] == 12 && chip8.delay_timer == 25 && later.take_dirty_rows() == 0);
+
+    TimelineHit write = timeline.last_write(0x300);
+    assert(write.found && write.time == 47 && write.pc == 0x206 && timeline.now() == 50);
+    assert(!chip8.has_watchpoint(0x300, WATCH_WRITE));
+    assert(!timeline.last_write(0x301).found);
+
+    // The pixel is as it was after the change ever since
+    TimelineHit pixel = timeline.last_pixel_change(8, 0);
+    assert(pixel.found && pixel.pc == 0x208 && timeline.now() == 50);
+    bool lit = chip8.display.pixel(8, 0);
+    timeline.seek(pixel.time + 1);
+    assert(chip8.display.pixel(8, 0) == lit);
+    timeline.seek(pixel.time);
+    assert(chip8.display.pixel(8, 0) != lit);
+
+    timeline.seek(50);
+    chip8.set_breakpoint(0x206);
+    assert(timeline.reverse_continue() && timeline.now() == 47 && chip8.pc == 0x206);
+    assert(timeline.reverse_continue() && timeline.now() == 43);
+    assert(timeline.step_back() && timeline.now() == 42 && chip8.pc == 0x204);
+    chip8.clear_breakpoint(0x206);
+    assert(!timeline.reverse_continue() && timeline.now() == 42);
+
+    // Running on from the past drops the recorded future
+    assert(timeline.step() && timeline.now() == 43 && timeline.end() == 43 && chip8.registers[0] == 11);
+    chip8.registers[0] = 100;
+    timeline.state_changed();
+    timeline.run_frames(1);
+    timeline.seek(43);
+    assert(chip8.registers[0] == 100);
+
+    // The stub goes back through the timeline
+    GdbStub stub(chip8);
+    stub.set_timeline(&timeline);
+    std::string reply;
+    assert(stub.handle_packet("qSupported", reply) && reply.find("ReverseStep+") != std::string::npos);
+    assert(stub.handle_packet("bs", reply) && reply == "T05" && timeline.now() == 42);
+    assert(stub.handle_packet("qRcmd,7768656e", reply) && !reply.empty());
+    timeline.seek(0);
+    assert(stub.handle_packet("bc", reply) && reply == "T05replaylog:begin;");
+}
+
+void test_coverage() {
+    // 6008; B200 jumps to 0x208, past two words of zeros; A212; F165; D011; 120E. Sprite data at 0x212.
+    const uint8_t rom[] = { 0x60, 0x08, 0xB2, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA2, 0x12, 0xF1, 0x65, 0xD0, 0x11,
+                            0x12, 0x0E, 0x00, 0x00, 0xFF, 0x81, 0xC3 };
+    const Interpreter interpreters[] = {
+        Interpreter::Switch, Interpreter::Predecoded, Interpreter::Threaded, Interpreter::Jit
+    };
+    RomCoverage merged;
+    for (Interpreter interpreter : interpreters) {
+        Chip8 chip8;
+        chip8.init();
+        chip8.interpreter = interpreter;
+        assert(chip8.load_rom(rom, sizeof(rom)));
+        chip8.set_coverage(true);
+        chip8.run_frames(2);
+        assert(chip8.code_coverage.size() == 12 && chip8.code_coverage.test(0x203) && !chip8.code_coverage.test(0x204));
+        assert(chip8.code_coverage.test(0x208) && chip8.code_coverage.test(0x20F));
+        assert(chip8.data_coverage.test(0x212) && chip8.data_coverage.test(0x213) && !chip8.data_coverage.test(0x215));
+
+        RomCoverage run;
+        run.rom_hash = chip8.rom_hash;
+        run.runs = 1;
+        run.code.merge(chip8.code_coverage);
+        run.data.merge(chip8.data_coverage);
+        const char *path = "test_coverage.txt";
+        std::string error;
+        assert(save_coverage(path, run, error) && merge_coverage(path, merged, error));
+        std::remove(path);
+    }
+    assert(merged.runs == 4 && merged.code.size() == 12);
+
+    // The code after the computed jump is only found with the coverage
+    Memory memory;
+    memory.attach(RomImage::from_buffer(rom, sizeof(rom)), quirk_memory_size(QuirkProfile::Chip8));
+    RomAnalysis analysis = analyze_rom(memory, sizeof(rom), QuirkProfile::Chip8);
+    assert(!(analysis.flags[0x208] & ADDRESS_CODE));
+    analysis = analyze_rom(memory, sizeof(rom), QuirkProfile::Chip8, &merged.code);
+    assert((analysis.flags[0x208] & ADDRESS_CODE) && (analysis.flags[0x20E] & ADDRESS_CODE));
+    assert(!(analysis.flags[0x204] & ADDRESS_CODE) && analysis.find_block(0x20A) != nullptr);
+}
+
+void test_heatmap() {
+    // 6007; A300; F233 stores 3 digits; F165 loads 2 bytes; D011 draws the byte at I; 1206
+    const uint8_t rom[] = { 0x60, 0x07, 0xA3, 0x00, 0xF2, 0x33, 0xF1, 0x65, 0xD0, 0x11, 0x12, 0x06 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(rom, sizeof(rom)));
+    chip8.profiling = true;
+    assert(chip8.run_instructions(9) == 9);
+
+    const AccessCounts &counts = chip8.access_counts;
+    assert(counts.fetches[0x200] == 1 && counts.fetches[0x201] == 1 && counts.fetches[0x206] == 2);
+    assert(counts.fetches[0x20B] == 2 && counts.fetches[0x20C] == 0);
+    assert(counts.writes[0x300] == 1 && counts.writes[0x302] == 1 && counts.writes[0x303] == 0);
+    assert(counts.reads[0x300] >= 1);
+
+    // Log scale: once is about 60% of the way to twice
+    Heatmap heatmap;
+    render_heatmap(counts, chip8.memory.size(), heatmap);
+    assert(heatmap.width == 64 && heatmap.height == 64);
+    assert(heatmap.pixels[0x206] == 0x0000FFFF && heatmap.pixels[0x200] == 0x0000B8FF);
+    assert(heatmap.pixels[0x302] >> 24 == 0xFF && heatmap.pixels[0x100] == 0x000000FF);
+
+    const char *path = "test_heatmap.bmp";
+    std::string error;
+    assert(save_heatmap(path, heatmap, 2, error));
+    FILE *file = std::fopen(path, "rb");
+    assert(file != nullptr);
+    std::fseek(file, 0, SEEK_END);
+    assert(std::ftell(file) == 14 + 40 + 128 * 128 * 3);
+    std::fclose(file);
+    std::remove(path);
+}
+
+void test_key_skip_uses_low_nibble() {
+    // 611F; E19E skips on key F, the low nibble of V1; 00FD; E1A1 doesn't skip; 1208; 00FD
+    const uint8_t rom[] = { 0x61, 0x1F, 0xE1, 0x9E, 0x00, 0xFD, 0xE1, 0xA1, 0x12, 0x08, 0x00, 0xFD };
+    const Interpreter interpreters[] = {
+        Interpreter::Switch, Interpreter::Predecoded, Interpreter::Jit, DEFAULT_INTERPRETER
+    };
+    for (Interpreter interpreter : interpreters) {
+        Chip8 chip8;
+        chip8.init();
+        chip8.interpreter = interpreter;
+        assert(chip8.load_rom(rom, sizeof(rom)));
+        chip8.key_event(0xF, true);
+        chip8.run_instructions(4);
+        assert(!chip8.exited && chip8.pc == 0x208);
+    }
+}
+
+void test_stack_wraps_around() {
+    // 2200 calls itself; 00EE at 0x202 is never reached
+    const uint8_t rom[] = { 0x22, 0x00, 0x00, 0xEE };
+    const Interpreter interpreters[] = {
+        Interpreter::Switch, Interpreter::Predecoded, Interpreter::Jit, DEFAULT_INTERPRETER
+    };
+    for (Interpreter interpreter : interpreters) {
+        Chip8 chip8;
+        chip8.init();
+        chip8.interpreter = interpreter;
+        assert(chip8.load_rom(rom, sizeof(rom)));
+
+        // The 17th call wraps around the 16-level stack instead of writing over the timers after it
+        assert(chip8.run_instructions(17) == 17);
+        assert(chip8.pc == 0x200 && chip8.sp == 1 && chip8.stack[0] == 0x202);
+        assert(chip8.delay_timer == 0 && chip8.sound_timer == 0);
+
+        // Returning with an empty stack takes the top entry
+        chip8.pc = 0x202;
+        chip8.sp = 0;
+        chip8.stack[15] = 0x200;
+        assert(chip8.run_instructions(1) == 1);
+        assert(chip8.sp == 15 && chip8.pc == 0x200);
+    }
+}
+
+void test_machine_code_calls_are_ignored() {
+    assert(classify_opcode(0x02C3) == OpKind::Nop && classify_opcode(0x01E0) == OpKind::Nop);
+    assert(classify_opcode(0x03EE) == OpKind::Nop && classify_opcode(0x0AFF) == OpKind::Nop);
+    assert(classify_opcode(0x00C3) == OpKind::Op00CN && classify_opcode(0x00EE) == OpKind::Op00EE);
+
+    // 02C3 and 03EE would scroll and return if bits 8-11 were dropped, then 1204 loops
+    const uint8_t rom[] = { 0x02, 0xC3, 0x03, 0xEE, 0x12, 0x04 };
+    const Interpreter interpreters[] = { Interpreter::Switch, Interpreter::Predecoded };
+    for (Interpreter interpreter : interpreters) {
+        Chip8 chip8;
+        chip8.init();
+        chip8.interpreter = interpreter;
+        assert(chip8.load_rom(rom, sizeof(rom)));
+        chip8.display.draw_sprite_row(0, 0, 0, 0x80, 8);
+        chip8.run_instructions(3);
+        assert(chip8.pc == 0x204 && chip8.sp == 0 && chip8.display.pixel(0, 0));
+    }
+}
+
+void test_xo_chip() {
+    // F000 E000: I = 0xE000, V0-V2 saved with 5022 and cleared, loaded back with 5023, F201 selects plane 1.
+    // 3011 skips the whole 4 byte F000 0000, so 6301 runs next.
+    uint8_t program[] = {
+        0xF0, 0x00, 0xE0, 0x00, 0x60, 0x11, 0x61, 0x22, 0x62, 0x33, 0x50, 0x22, 0x60, 0x00, 0x61, 0x00,
+        0x62, 0x00, 0x50, 0x23, 0xF2, 0x01, 0x30, 0x11, 0xF0, 0x00, 0x00, 0x00, 0x63, 0x01
+    };
+    static Chip8 chip8;
+    chip8.init();
+    chip8.set_quirks(QuirkProfile::XoChip);
+    assert(chip8.load_rom(program, sizeof(program)));
+    assert(chip8.run_instructions(12) == 12);
+    assert(chip8.index == 0xE000 && chip8.memory.read(0xE001) == 0x22);
+    assert(chip8.registers[0] == 0x11 && chip8.registers[1] == 0x22 && chip8.registers[2] == 0x33);
+    assert(chip8.display.plane_mask == 2 && chip8.registers[3] == 1 && chip8.pc == 0x21E);
+
+    // F301 A050 D001: both planes draw one row, plane 0 from the font byte 0xF0 and plane 1 from the next (0x90)
+    uint8_t planes[] = { 0xF3, 0x01, 0xA0, 0x50, 0xD0, 0x01 };
+    chip8.init();
+    chip8.set_quirks(QuirkProfile::XoChip);
+    assert(chip8.load_rom(planes, sizeof(planes)));
+    assert(chip8.run_instructions(3) == 3);
+    assert(chip8.display.color(0, 0) == 3 && chip8.display.color(1, 0) == 1 && chip8.display.color(4, 0) == 0);
+}
+
+void test_init_keeps_quirks() {
+    // 6181 6204 8126: V1 = V2 >> 1 under the COSMAC VIP shift quirk, V1 >> 1 without it
+    uint8_t program[] = { 0x61, 0x81, 0x62, 0x04, 0x81, 0x26 };
+    static Chip8 chip8;
+    chip8.set_quirks(QuirkProfile::CosmacVip);
+    chip8.init();
+    assert(chip8.quirks == QuirkProfile::CosmacVip);
+    assert(chip8.load_rom(program, sizeof(program)));
+    assert(chip8.run_instructions(3) == 3);
+    assert(chip8.registers[1] == 0x02);
+
+    // The memory follows the kept profile, so a 64 KB XO-CHIP address space survives a reset
+    chip8.set_quirks(QuirkProfile::XoChip);
+    chip8.init();
+    assert(chip8.quirks == QuirkProfile::XoChip && chip8.memory.size() == MAX_MEMORY_SIZE);
+}
+
+void test_rom_lookup() {
+    // The first, a middle and the last entry of the database
+    const RomInfo *tetris = find_rom_info(0x04eb2109dc29b1abull);
+    assert(tetris != nullptr && strcmp(tetris->title, "TETRIS") == 0);
+    const RomInfo *blinky = find_rom_info(0x0fd332d0bc68c9f2ull);
+    assert(blinky != nullptr && blinky->profile == QuirkProfile::SuperChip && blinky->cycles_per_frame == 20);
+    const RomInfo *syzygy = find_rom_info(0xec7ca0de3e110327ull);
+    assert(syzygy != nullptr && strcmp(syzygy->title, "SYZYGY") == 0);
+
+    // Below the first, between two and above the last entry
+    assert(find_rom_info(0) == nullptr);
+    assert(find_rom_info(0x04eb2109dc29b1acull) == nullptr);
+    assert(find_rom_info(~0ull) == nullptr);
+
+    // 00E0 (CLS) hashed with FNV-1a is not a known ROM
+    const uint8_t program[] = { 0x00, 0xE0 };
+    assert(hash_rom(program, 0) == 0xcbf29ce484222325ull);
+    assert(find_rom_info(hash_rom(program, sizeof(program))) == nullptr);
+}
+
+void test_rom_loading() {
+    static uint8_t rom[MAX_MEMORY_SIZE];
+    for (size_t i = 0; i < sizeof(rom); ++i) {
+        rom[i] = static_cast<uint8_t>(i * 7);
+    }
+    static Chip8 chip8;
+    chip8.init();
+
+    // 3584 bytes fit above 0x200 in 4K, one more doesn't and leaves the loaded ROM in place
+    assert(chip8.max_rom_size() == 4096 - START_ADDRESS);
+    assert(chip8.load_rom(rom, 4096 - START_ADDRESS));
+    assert(chip8.memory.read(0xFFF) == rom[0xDFF]);
+    assert(!chip8.load_rom(rom + 1, 4096 - START_ADDRESS + 1));
+    assert(chip8.memory.read(START_ADDRESS + 1) == rom[1] && chip8.rom_hash == hash_rom(rom, 4096 - START_ADDRESS));
+
+    // XO-CHIP has the whole 64K, but nothing larger can be loaded
+    chip8.set_quirks(QuirkProfile::XoChip);
+    assert(chip8.load_rom(rom, 4096 - START_ADDRESS + 1));
+    assert(chip8.load_rom(rom, MAX_MEMORY_SIZE - START_ADDRESS));
+    assert(chip8.memory.read(0xFFFF) == rom[MAX_MEMORY_SIZE - START_ADDRESS - 1]);
+    assert(RomImage::from_buffer(rom, MAX_MEMORY_SIZE - START_ADDRESS + 1) == nullptr);
+
+    // A file is read into the same image as a buffer with the same contents
+    const char *path = "test_rom_loading.ch8";
+    FILE *file = fopen(path, "wb");
+    assert(file != nullptr && fwrite(rom, 1, 300, file) == 300);
+    fclose(file);
+    std::shared_ptr<const RomImage> image = RomImage::from_file(path);
+    remove(path);
+    assert(image != nullptr && image->rom_size == 300 && image->hash == hash_rom(rom, 300));
+    assert(memcmp(image->bytes, RomImage::from_buffer(rom, 300)->bytes, MAX_MEMORY_SIZE) == 0);
+    assert(RomImage::from_file(path) == nullptr);
+}
+
+void test_instance_footprint() {
+    // 6001 7001 1202 under XO-CHIP: 64K of memory, but the code is in a single page
+    uint8_t program[] = { 0x60, 0x01, 0x70, 0x01, 0x12, 0x02 };
+    std::shared_ptr<const RomImage> image = RomImage::from_buffer(program, sizeof(program));
+    const Interpreter interpreters[] = { Interpreter::Switch, Interpreter::Predecoded, DEFAULT_INTERPRETER };
+    size_t footprints[3];
+    for (int i = 0; i < 3; ++i) {
+        static Chip8 chip8;
+        chip8.set_quirks(QuirkProfile::XoChip);
+        chip8.init();
+        assert(chip8.load_rom(image));
+        chip8.interpreter = interpreters[i];
+        assert(chip8.run_instructions(1001) == 1001 && chip8.registers[0] == 0xF5);
+        footprints[i] = chip8.allocated_bytes();
+    }
+    // The decoded instructions take one page of entries and the page table, not one entry per byte of memory
+    size_t page_table = (MAX_MEMORY_SIZE >> Memory::PAGE_SHIFT) * sizeof(void *);
+    assert(footprints[1] - footprints[0] == page_table + Memory::PAGE_SIZE * sizeof(DecodedOp));
+    assert(footprints[2] == footprints[1] && footprints[2] < sizeof(Chip8) + 32 * 1024);
+}
+
+void test_triple_buffer() {
+    struct Frame {
+        uint32_t number;
+        uint32_t check;
+    };
+    static TripleBuffer<Frame> frames;
+    assert(!frames.acquire());
+
+    // The reader only sees the latest of the frames published since it last looked
+    for (uint32_t i = 1; i <= 3; ++i) {
+        frames.back().number = i;
+        frames.publish();
+    }
+    assert(frames.acquire() && frames.front().number == 3);
+    assert(!frames.acquire() && frames.front().number == 3);
+
+    // With the writer on another thread, frames arrive whole and in order
+    const uint32_t count = 200000;
+    std::thread writer([count]() {
+        for (uint32_t i = 4; i <= count; ++i) {
+            frames.back().number = i;
+            frames.back().check = i * 2654435761u;
+            frames.publish();
+        }
+    });
+    uint32_t last = 3;
+    while (last != count) {
+        if (frames.acquire()) {
+            const Frame &frame = frames.front();
+            assert(frame.number > last && frame.check == frame.number * 2654435761u);
+            last = frame.number;
+        }
+    }
+    writer.join();
+}
+
+void test_frame_pacing() {
+    typedef FramePacer::Clock Clock;
+    const Clock::duration frame = std::chrono::milliseconds(16);
+    const Clock::time_point start;
+    FramePacer pacer(frame, 8, start);
+
+    // Frames are due every 16 ms and all presented, however long they took to run
+    assert(pacer.frame_done(false, start + std::chrono::milliseconds(3)));
+    assert(pacer.frame_done(false, start + std::chrono::milliseconds(20)));
+    assert(pacer.next_frame() == start + 2 * frame);
+
+    // Fast-forward: frames are due right away, and only every 8th frame counted from the start is presented
+    int presented = 0;
+    for (int i = 0; i < 22; ++i) {
+        presented += pacer.frame_done(true, start + std::chrono::milliseconds(40 + i)) ? 1 : 0;
+    }
+    assert(presented == 3 && pacer.frame_count() == 24);
+    assert(pacer.next_frame() == start + std::chrono::milliseconds(61));
+
+    // Normal pace resumes from the end of fast-forward, without catching up on the skipped frames
+    assert(pacer.frame_done(false, start + std::chrono::milliseconds(62)));
+    assert(pacer.next_frame() == start + std::chrono::milliseconds(61) + frame);
+    pacer.restart(start + std::chrono::seconds(5));
+    assert(pacer.next_frame() == start + std::chrono::seconds(5));
+}
+
+void test_key_event_range() {
+    // F30A; 1202: wait for a key into V3
+    const uint8_t rom[] = { 0xF3, 0x0A, 0x12, 0x02 };
+    Chip8 chip8;
+    chip8.init();
+    assert(chip8.load_rom(rom, sizeof(rom)));
+    chip8.run_instructions(1);
+    assert(chip8.waiting_for_key);
+
+    // Keys past F are ignored rather than written past the keypad (into the display), and don't end the wait
+    chip8.key_event(0x10, true);
+    chip8.key_event(0x10, false);
+    Timeline timeline(chip8);
+    timeline.key_event(0xFF, true);
+    timeline.key_event(0xFF, false);
+    assert(chip8.waiting_for_key && chip8.display.rows[0][0][0] == 0);
+
+    timeline.key_event(0xF, true);
+    timeline.key_event(0xF, false);
+    assert(!chip8.waiting_for_key && chip8.registers[3] == 0xF);
+}
+
+void test_large_sprites() {
+    // A050; D010; 1204: a 16x16 sprite from the font, and F301 to draw it on both planes
+    const uint8_t program[] = { 0xA0, 0x50, 0xD0, 0x10, 0x12, 0x04 };
+    const uint8_t both_planes[] = { 0xF3, 0x01, 0xA0, 0x50, 0xD0, 0x10, 0x12, 0x06 };
+    const QuirkProfile profiles[] = { QuirkProfile::Chip8, QuirkProfile::CosmacVip, QuirkProfile::SuperChip,
+                                      QuirkProfile::XoChip, QuirkProfile::XoChip };
+    const uint32_t sprite_bytes[] = { 0, 0, 32, 32, 64 };
+    for (int i = 0; i < 5; ++i) {
+        bool planes = i == 4;
+        static Chip8 chip8;
+        chip8.set_quirks(profiles[i]);
+        chip8.init();
+        assert(planes ? chip8.load_rom(both_planes, sizeof(both_planes)) : chip8.load_rom(program, sizeof(program)));
+        chip8.run_instructions(planes ? 3 : 2);
+        // Only SUPER-CHIP and XO-CHIP draw anything
+        assert(chip8.display.pixel(0, 0) == (sprite_bytes[i] != 0));
+
+        // The disassembler marks what the draw reads
+        RomAnalysis analysis = analyze_rom(chip8.memory, planes ? sizeof(both_planes) : sizeof(program), profiles[i]);
+        for (uint32_t address = 0x50; address < 0x50 + sprite_bytes[i]; ++address) {
+            assert(analysis.flags[address] == ADDRESS_SPRITE);
+        }
+        assert(analysis.flags[0x50 + sprite_bytes[i]] == 0);
+    }
+}
+
+// A failing assert aborts, so ctest sees a non-zero exit
+int main() {
+    test();
+    test_display_hires_scroll();
+    test_shift_quirks();
+    test_shared_rom_image();
+    test_display_dirty_rows();
+    test_phosphor_blend();
+    test_command_line();
+    test_idle_loops();
+    test_predecoded_run();
+    test_run_api();
+    test_ir_passes();
+    test_rom_analysis();
+    test_quirk_inference();
+    test_debugger();
+    test_gdb_stub();
+    test_timeline();
+    test_coverage();
+    test_heatmap();
+    test_key_skip_uses_low_nibble();
+    test_stack_wraps_around();
+    test_machine_code_calls_are_ignored();
+    test_xo_chip();
+    test_init_keeps_quirks();
+    test_rom_lookup();
+    test_rom_loading();
+    test_instance_footprint();
+    test_triple_buffer();
+    test_frame_pacing();
+    test_key_event_range();
+    test_large_sprites();
+    std::printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,463 @@
+// Differential fuzzer: runs random ROMs and key presses under every interpreter loop in lockstep, compares the
+// whole machine with the reference switch interpreter after every block of instructions, and narrows a
+// difference down to the first instruction that shows it. Inputs that reach a new pair of consecutive instruction
+// kinds (per quirk profile) are kept in the corpus and mutated further.
+// Usage: chip8_fuzz [--runs=<n>] [--seed=<n>] [--crashes=<dir>] [<input>...]
+// Given inputs (saved crashes), runs just them. A crash is saved as crash-<hash> with the ROM next to it as
+// crash-<hash>.ch8, for chip8_disasm and chip8_aot.
+// Built with CHIP8_LIBFUZZER, LLVMFuzzerTestOneInput() is the entry point instead and libFuzzer generates the
+// inputs, guided by the coverage of the emulator itself.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/chip8.h"
+#include "../src/debug.h"
+#include "../src/disasm.h"
+#include "lockstep.h"
+
+// Same order as chip8_regression, the threaded interpreter is only built with CHIP8_THREADED
+static const Interpreter BACKENDS[] = {
+    Interpreter::Switch, Interpreter::Predecoded, Interpreter::Jit, Interpreter::Threaded
+};
+static const char *BACKEND_NAMES[] = { "switch", "predecoded", "jit", "threaded" };
+static const int BACKEND_COUNT = CHIP8_THREADED ? 4 : 3;
+
+static const QuirkProfile PROFILES[] = {
+    QuirkProfile::Chip8, QuirkProfile::SuperChip, QuirkProfile::XoChip, QuirkProfile::CosmacVip
+};
+static const int PROFILE_COUNT = 4;
+
+// Input layout: profile byte, input script, ROM. Script byte j % SCRIPT_BYTES drives block j: the low nibble is a
+// key, pressed in the first SCRIPT_BYTES blocks of every 2 * SCRIPT_BYTES and released in the others, the high
+// nibble + 1 is the instruction budget. Short budgets split the JIT's blocks and the superinstructions.
+static const size_t SCRIPT_BYTES = 8;
+static const size_t HEADER_BYTES = 1 + SCRIPT_BYTES;
+static const size_t MAX_ROM_BYTES = 512;
+static const int BLOCKS = 48;
+
+struct FuzzInput {
+    QuirkProfile profile;
+    const uint8_t *script;
+    std::shared_ptr<const RomImage> rom;
+};
+
+// Short inputs are padded with zeros, ROMs are at least one instruction
+static FuzzInput parse_input(const uint8_t *data, size_t size, std::vector<uint8_t> &storage) {
+    storage.assign(data, data + std::min(size, HEADER_BYTES + MAX_ROM_BYTES));
+    if (storage.size() < HEADER_BYTES + 2) {
+        storage.resize(HEADER_BYTES + 2, 0);
+    }
+    FuzzInput input;
+    input.profile = PROFILES[storage[0] % PROFILE_COUNT];
+    input.script = &storage[1];
+    input.rom = RomImage::from_buffer(&storage[HEADER_BYTES], storage.size() - HEADER_BYTES);
+    return input;
+}
+
+static int block_budget(const FuzzInput &input, int block) {
+    return 1 + (input.script[block % SCRIPT_BYTES] >> 4);
+}
+
+static void block_keys(Chip8 &chip8, const FuzzInput &input, int block) {
+    chip8.key_event(input.script[block % SCRIPT_BYTES] & 0xF, (block / SCRIPT_BYTES) % 2 == 0);
+}
+
+static void start(Chip8 &chip8, const FuzzInput &input, Interpreter interpreter) {
+    chip8.init();
+    chip8.set_quirks(input.profile);
+    chip8.load_rom(input.rom);
+    chip8.randGen.seed(1);
+    chip8.interpreter = interpreter;
+}
+
+static uint16_t opcode_at(const Chip8 &chip8, uint16_t address) {
+    return static_cast<uint16_t>(chip8.memory.read(address) << 8 | chip8.memory.read(address + 1));
+}
+
+struct Divergence {
+    int backend;
+    int block;
+    const char *difference;
+};
+
+class DifferentialRunner {
+    public:
+        // Returns false and fills divergence if a backend ended a block in another state than the reference.
+        // Every pair of consecutive instruction kinds the reference ran is set in features.
+        bool run(const FuzzInput &input, AddressBitmap &features, Divergence &divergence) {
+            // All displays start clear, after that only the rows a machine drew since the last block can differ
+            for (int i = 0; i < BACKEND_COUNT; ++i) {
+                start(machines[i], input, BACKENDS[i]);
+                machines[i].display.take_dirty_rows();
+            }
+            int edge_base = static_cast<int>(input.profile) * OP_KIND_COUNT * OP_KIND_COUNT;
+            int previous = static_cast<int>(OpKind::Nop);
+
+            for (int block = 0; block < BLOCKS; ++block) {
+                int budget = block_budget(input, block);
+                int executed[4];
+
+                // The reference runs one instruction at a time to see what it runs. The switch loop stops at the
+                // same points either way: budget, idle or exited.
+                Chip8 &reference = machines[0];
+                block_keys(reference, input, block);
+                executed[0] = 0;
+                while (executed[0] < budget) {
+                    if (reference.run_instructions(1) == 0) {
+                        break;
+                    }
+                    int kind = static_cast<int>(classify_opcode(reference.opcode));
+                    ++executed[0];
+                    features.set(edge_base + previous * OP_KIND_COUNT + kind);
+                    previous = kind;
+                    if (reference.idle || reference.exited) {
+                        break;
+                    }
+                }
+                reference.tick_timers();
+
+                for (int i = 1; i < BACKEND_COUNT; ++i) {
+                    block_keys(machines[i], input, block);
+                    executed[i] = machines[i].run_instructions(budget);
+                    machines[i].tick_timers();
+                }
+
+                uint64_t reference_rows = reference.display.take_dirty_rows();
+                for (int i = 1; i < BACKEND_COUNT; ++i) {
+                    uint64_t rows = reference_rows | machines[i].display.take_dirty_rows();
+                    const char *difference = executed[i] != executed[0] ? "instruction count"
+                                                                        : compare(machines[0], machines[i], rows);
+                    if (difference != nullptr) {
+                        divergence.backend = i;
+                        divergence.block = block;
+                        divergence.difference = difference;
+                        return false;
+                    }
+                }
+                if (machines[0].exited && machines[0].illegal_opcode) {
+                    break;
+                }
+            }
+            return true;
+        }
+
+        // Replays up to the block that diverged and finds the shortest budget for it that still diverges, then
+        // prints the instruction the reference ran last under that budget
+        void report(const FuzzInput &input, const Divergence &divergence) {
+            Chip8 &reference = machines[0];
+            Chip8 &backend = machines[divergence.backend];
+            int budget = block_budget(input, divergence.block);
+            long instructions = 0;
+
+            for (int limit = 1; limit <= budget; ++limit) {
+                start(reference, input, BACKENDS[0]);
+                start(backend, input, BACKENDS[divergence.backend]);
+                instructions = 0;
+                for (int block = 0; block < divergence.block; ++block) {
+                    block_keys(reference, input, block);
+                    block_keys(backend, input, block);
+                    instructions += reference.run_instructions(block_budget(input, block));
+                    backend.run_instructions(block_budget(input, block));
+                    reference.tick_timers();
+                    backend.tick_timers();
+                }
+
+                block_keys(reference, input, divergence.block);
+                block_keys(backend, input, divergence.block);
+                uint16_t pc = reference.pc;
+                int executed = 0;
+                // The reference steps so the last instruction is known
+                while (executed < limit) {
+                    uint16_t before = reference.pc;
+                    if (reference.run_instructions(1) == 0) {
+                        break;
+                    }
+                    pc = before;
+                    ++executed;
+                    if (reference.idle || reference.exited) {
+                        break;
+                    }
+                }
+                int backend_executed = backend.run_instructions(limit);
+                const char *difference = backend_executed != executed ? "instruction count"
+                                                                      : compare(reference, backend);
+                if (difference == nullptr && limit < budget) {
+                    continue;
+                }
+                if (difference == nullptr) {
+                    // Only the timer tick at the end of the block shows it
+                    reference.tick_timers();
+                    backend.tick_timers();
+                    difference = compare(reference, backend);
+                }
+
+                uint16_t opcode = opcode_at(reference, pc);
+                std::printf("%s differs from switch (%s) after instruction %ld, in block %d of %d instructions\n",
+                            BACKEND_NAMES[divergence.backend], difference != nullptr ? difference
+                            : divergence.difference, instructions + executed, divergence.block, limit);
+                std::printf("  last instruction: %04X  %04X  %s\n", pc, opcode,
+                            disassemble(opcode, opcode_at(reference, pc + 2)).c_str());
+                std::printf("  profile %s, pc %04X vs %04X, I %04X vs %04X, %d vs %d instructions\n",
+                            quirk_profile_name(input.profile), reference.pc, backend.pc, reference.index,
+                            backend.index, executed, backend_executed);
+                return;
+            }
+        }
+
+    private:
+        Chip8 machines[4];
+};
+
+#ifdef CHIP8_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static DifferentialRunner runner;
+    static AddressBitmap features;
+    std::vector<uint8_t> storage;
+    FuzzInput input = parse_input(data, size, storage);
+    Divergence divergence;
+    if (!runner.run(input, features, divergence)) {
+        runner.report(input, divergence);
+        std::abort();
+    }
+    return 0;
+}
+
+#else
+
+// Instruction templates: fixed bits and random bits. Addresses are filled in separately so jumps, calls and I
+// mostly stay inside the ROM.
+struct OpcodeTemplate {
+    uint16_t base;
+    uint16_t random;
+    bool address;
+};
+
+static const OpcodeTemplate TEMPLATES[] = {
+    { 0x00E0, 0x0000, false }, { 0x00EE, 0x0000, false }, { 0x00C0, 0x000F, false }, { 0x00D0, 0x000F, false },
+    { 0x00FB, 0x0000, false }, { 0x00FC, 0x0000, false }, { 0x00FD, 0x0000, false }, { 0x00FE, 0x0000, false },
+    { 0x00FF, 0x0000, false }, { 0x1000, 0x0000, true }, { 0x2000, 0x0000, true }, { 0x3000, 0x0FFF, false },
+    { 0x4000, 0x0FFF, false }, { 0x5000, 0x0FF0, false }, { 0x5002, 0x0FF0, false }, { 0x5003, 0x0FF0, false },
+    { 0x6000, 0x0FFF, false }, { 0x7000, 0x0FFF, false }, { 0x8000, 0x0FF0, false }, { 0x8001, 0x0FF0, false },
+    { 0x8002, 0x0FF0, false }, { 0x8003, 0x0FF0, false }, { 0x8004, 0x0FF0, false }, { 0x8005, 0x0FF0, false },
+    { 0x8006, 0x0FF0, false }, { 0x8007, 0x0FF0, false }, { 0x800E, 0x0FF0, false }, { 0x9000, 0x0FF0, false },
+    { 0xA000, 0x0000, true }, { 0xB000, 0x0000, true }, { 0xC000, 0x0FFF, false }, { 0xD000, 0x0FFF, false },
+    { 0xE09E, 0x0F00, false }, { 0xE0A1, 0x0F00, false }, { 0xF000, 0x0000, false }, { 0xF001, 0x0F00, false },
+    { 0xF007, 0x0F00, false }, { 0xF00A, 0x0F00, false }, { 0xF015, 0x0F00, false }, { 0xF018, 0x0F00, false },
+    { 0xF01E, 0x0F00, false }, { 0xF029, 0x0F00, false }, { 0xF030, 0x0F00, false }, { 0xF033, 0x0F00, false },
+    { 0xF055, 0x0F00, false }, { 0xF065, 0x0F00, false }, { 0xF075, 0x0F00, false }, { 0xF085, 0x0F00, false },
+};
+static const size_t TEMPLATE_COUNT = sizeof(TEMPLATES) / sizeof(TEMPLATES[0]);
+
+static const size_t MAX_CORPUS = 4096;
+
+class Fuzzer {
+    public:
+        explicit Fuzzer(uint32_t seed) : random(seed) {}
+
+        const std::vector<std::vector<uint8_t>> &entries() const { return corpus; }
+
+        std::vector<uint8_t> next() {
+            if (corpus.empty() || below(8) == 0) {
+                return generate();
+            }
+            std::vector<uint8_t> data = corpus[below(corpus.size())];
+            for (uint32_t mutations = 1 + below(4); mutations > 0; --mutations) {
+                mutate(data);
+            }
+            return data;
+        }
+
+        // Keeps inputs that reached something new
+        void keep(const std::vector<uint8_t> &data) {
+            if (corpus.size() < MAX_CORPUS) {
+                corpus.push_back(data);
+            } else {
+                corpus[below(corpus.size())] = data;
+            }
+        }
+
+    private:
+        std::mt19937 random;
+        std::vector<std::vector<uint8_t>> corpus;
+
+        uint32_t below(size_t n) { return static_cast<uint32_t>(random() % n); }
+
+        uint16_t instruction(size_t rom_size) {
+            const OpcodeTemplate &op = TEMPLATES[below(TEMPLATE_COUNT)];
+            uint16_t opcode = static_cast<uint16_t>(op.base | (random() & op.random));
+            if (op.address) {
+                // Mostly instructions of the ROM, sometimes any byte of the first 4K
+                uint32_t target = below(4) != 0 ? START_ADDRESS + 2 * below(std::max<size_t>(rom_size / 2, 1))
+                                                : below(0x1000);
+                opcode = static_cast<uint16_t>(opcode | (target & 0x0FFF));
+            }
+            return opcode;
+        }
+
+        static void put(std::vector<uint8_t> &data, size_t offset, uint16_t opcode) {
+            data[offset] = static_cast<uint8_t>(opcode >> 8);
+            data[offset + 1] = static_cast<uint8_t>(opcode);
+        }
+
+        std::vector<uint8_t> generate() {
+            size_t rom_size = 2 * (4 + below(60));
+            std::vector<uint8_t> data(HEADER_BYTES + rom_size);
+            for (size_t i = 0; i < HEADER_BYTES; ++i) {
+                data[i] = static_cast<uint8_t>(random());
+            }
+            for (size_t offset = HEADER_BYTES; offset < data.size(); offset += 2) {
+                put(data, offset, instruction(rom_size));
+            }
+            return data;
+        }
+
+        void mutate(std::vector<uint8_t> &data) {
+            size_t rom_size = data.size() - HEADER_BYTES;
+            size_t offset = HEADER_BYTES + 2 * below(rom_size / 2);
+            switch (below(7)) {
+                case 0:
+                    put(data, offset, instruction(rom_size));
+                    break;
+                case 1:
+                    data[below(data.size())] ^= static_cast<uint8_t>(1 << below(8));
+                    break;
+                case 2:
+                    if (rom_size + 2 <= MAX_ROM_BYTES) {
+                        data.insert(data.begin() + offset, 2, 0);
+                        put(data, offset, instruction(rom_size + 2));
+                    }
+                    break;
+                case 3:
+                    if (rom_size > 2) {
+                        data.erase(data.begin() + offset, data.begin() + offset + 2);
+                    }
+                    break;
+                case 4:
+                    data[1 + below(SCRIPT_BYTES)] = static_cast<uint8_t>(random());
+                    break;
+                case 5:
+                    data[0] = static_cast<uint8_t>(random());
+                    break;
+                default: {
+                    // Splice: this ROM up to offset, another entry's after it
+                    const std::vector<uint8_t> &other = corpus[below(corpus.size())];
+                    if (offset < other.size()) {
+                        data.resize(offset);
+                        data.insert(data.end(), other.begin() + offset, other.end());
+                    }
+                    break;
+                }
+            }
+        }
+};
+
+static bool read_file(const char *path, std::vector<uint8_t> &data) {
+    FILE *file = std::fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+    std::fclose(file);
+    return true;
+}
+
+static bool write_file(const std::string &path, const uint8_t *data, size_t size) {
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = std::fwrite(data, 1, size, file) == size;
+    return std::fclose(file) == 0 && written;
+}
+
+static void save_crash(const std::string &directory, const std::vector<uint8_t> &data, const FuzzInput &input) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "crash-%016llx", static_cast<unsigned long long>(input.rom->hash));
+    std::string path = directory + "/" + name;
+    if (write_file(path, data.data(), data.size()) &&
+        write_file(path + ".ch8", data.data() + HEADER_BYTES, data.size() - HEADER_BYTES)) {
+        std::printf("  saved %s and %s.ch8\n", path.c_str(), path.c_str());
+    } else {
+        std::fprintf(stderr, "could not write %s\n", path.c_str());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long runs = 200000;
+    uint32_t seed = 1;
+    std::string crashes = ".";
+    std::vector<const char *> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = std::atol(argv[i] + 7);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = static_cast<uint32_t>(std::strtoul(argv[i] + 7, nullptr, 0));
+        } else if (strncmp(argv[i], "--crashes=", 10) == 0) {
+            crashes = argv[i] + 10;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    DifferentialRunner runner;
+    AddressBitmap features;
+    Divergence divergence;
+    std::vector<uint8_t> storage;
+
+    if (!inputs.empty()) {
+        int failures = 0;
+        for (const char *path : inputs) {
+            std::vector<uint8_t> data;
+            if (!read_file(path, data)) {
+                std::printf("%s: could not read input\n", path);
+                ++failures;
+                continue;
+            }
+            FuzzInput input = parse_input(data.data(), data.size(), storage);
+            if (!runner.run(input, features, divergence)) {
+                std::printf("%s: ", path);
+                runner.report(input, divergence);
+                ++failures;
+            }
+        }
+        std::printf("%d of %d inputs ran the same under all %d interpreters\n",
+                    static_cast<int>(inputs.size()) - failures, static_cast<int>(inputs.size()), BACKEND_COUNT);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Fuzzer fuzzer(seed);
+    auto started = std::chrono::steady_clock::now();
+    long run = 0;
+    for (; run < runs; ++run) {
+        std::vector<uint8_t> data = fuzzer.next();
+        FuzzInput input = parse_input(data.data(), data.size(), storage);
+        uint32_t known = features.size();
+        if (!runner.run(input, features, divergence)) {
+            std::printf("run %ld: ", run);
+            runner.report(input, divergence);
+            save_crash(crashes, storage, input);
+            return EXIT_FAILURE;
+        }
+        if (features.size() > known) {
+            fuzzer.keep(storage);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::printf("%ld runs under all %d interpreters agreed, %u instruction pairs, %d corpus entries, "
+                "%.0f runs/s\n", run, BACKEND_COUNT, features.size(), static_cast<int>(fuzzer.entries().size()),
+                run / std::max(seconds, 1e-9));
+    return EXIT_SUCCESS;
+}
+
+#endif
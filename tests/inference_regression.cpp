@@ -0,0 +1,82 @@
+// Infers the quirk profile of every ROM that is in the database, as if it wasn't, and checks the result against
+// the database. A different profile still passes if the ROM runs the same under it for every frame, since the
+// inference can only go by what the ROM does.
+// Usage: chip8_inference_regression [--frames=<n>] <ROM>...
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../src/chip8.h"
+#include "../src/quirk_infer.h"
+#include "../src/rom_db.h"
+#include "lockstep.h"
+
+// Runs the ROM under both profiles with the same input, returns the frame they first differ in or -1
+static long first_difference(const std::shared_ptr<const RomImage> &rom, QuirkProfile a, QuirkProfile b,
+                             long frames) {
+    Chip8 machines[2];
+    const QuirkProfile profiles[] = { a, b };
+    for (int i = 0; i < 2; ++i) {
+        machines[i].set_quirks(profiles[i]);
+        machines[i].init();
+        machines[i].load_rom(rom);
+        machines[i].randGen.seed(1);
+    }
+    for (long frame = 0; frame < frames; ++frame) {
+        int executed[2];
+        for (int i = 0; i < 2; ++i) {
+            scripted_input(machines[i], frame);
+            executed[i] = machines[i].run_instructions(frame_budget(frame));
+            machines[i].tick_timers();
+        }
+        if (executed[0] != executed[1] || compare(machines[0], machines[1]) != nullptr) {
+            return frame;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    long frames = 3000;
+    int failures = 0;
+    int roms = 0;
+    int matched = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = std::atol(argv[i] + 9);
+            continue;
+        }
+        std::shared_ptr<const RomImage> rom = RomImage::from_file(argv[i]);
+        if (rom == nullptr) {
+            std::printf("%s: could not read ROM\n", argv[i]);
+            ++failures;
+            continue;
+        }
+        const RomInfo *rom_info = find_rom_info(rom->hash);
+        if (rom_info == nullptr) {
+            continue;
+        }
+        ++roms;
+
+        QuirkInference inference = infer_quirks(rom, QUIRK_TRIAL_FRAMES);
+        if (inference.profile == rom_info->profile) {
+            ++matched;
+            continue;
+        }
+        long frame = first_difference(rom, inference.profile, rom_info->profile, frames);
+        std::printf("%s: inferred %s, the database says %s", argv[i], quirk_profile_name(inference.profile),
+                    quirk_profile_name(rom_info->profile));
+        if (frame < 0) {
+            std::printf(", which run it the same for %ld frames\n", frames);
+            continue;
+        }
+        std::printf(", which differ in frame %ld\n", frame);
+        for (const std::string &reason : inference.reasons) {
+            std::printf("    %s\n", reason.c_str());
+        }
+        ++failures;
+    }
+
+    std::printf("%d of %d ROMs inferred as in the database\n", matched, roms);
+    return failures == 0 && roms > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
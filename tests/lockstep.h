@@ -0,0 +1,56 @@
+#pragma once
+
+// Shared by the tests that run two machines side by side and compare them after every frame
+#include <cstring>
+#include "../src/chip8.h"
+
+// Pages the machine copied are the only ones that can differ from the other machine's copy or the shared image
+static inline bool same_overlay_pages(const Chip8 &a, const Chip8 &b) {
+    for (size_t i = 0; i < a.memory.overlay_pages(); ++i) {
+        const uint8_t *page_a = a.memory.page(a.memory.overlay_page(i));
+        const uint8_t *page_b = b.memory.page(a.memory.overlay_page(i));
+        if (page_a != page_b && memcmp(page_a, page_b, Memory::PAGE_SIZE) != 0) return false;
+    }
+    return true;
+}
+
+// Returns the name of the first part of the state that differs, or nullptr. Only the display rows set in rows are
+// compared: callers that know which rows either machine changed since they last matched can pass just those.
+static inline const char *compare(const Chip8 &a, const Chip8 &b, uint64_t rows = ~uint64_t(0)) {
+    if (a.pc != b.pc) return "pc";
+    if (a.index != b.index) return "I";
+    if (memcmp(a.registers, b.registers, sizeof(a.registers)) != 0) return "registers";
+    if (a.sp != b.sp || memcmp(a.stack, b.stack, sizeof(a.stack)) != 0) return "stack";
+    if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) return "timers";
+    if (a.waiting_for_key != b.waiting_for_key || a.exited != b.exited || a.illegal_opcode != b.illegal_opcode) {
+        return "run state";
+    }
+    if (memcmp(a.rpl_flags, b.rpl_flags, sizeof(a.rpl_flags)) != 0) return "RPL flags";
+    if (a.display.width != b.display.width || a.display.plane_mask != b.display.plane_mask) return "display";
+    // Only the visible part, switching resolution clears the rest
+    int words = a.display.width / 64;
+    for (int plane = 0; plane < Display::PLANES; ++plane) {
+        for (int y = 0; y < a.display.height; ++y) {
+            if (!((rows >> y) & 1)) continue;
+            for (int word = 0; word < words; ++word) {
+                if (a.display.rows[plane][y][word] != b.display.rows[plane][y][word]) return "display";
+            }
+        }
+    }
+    // Both machines run the same ROM, so pages neither of them wrote are the same bytes of the same image
+    if (!same_overlay_pages(a, b) || !same_overlay_pages(b, a)) return "memory";
+    return nullptr;
+}
+
+// Presses and releases every key in turn, so ROMs waiting for input keep going
+static inline void scripted_input(Chip8 &chip8, long frame) {
+    int key = (frame / 20) % 16;
+    for (int i = 0; i < 16; ++i) {
+        chip8.key_event(i, i == key && frame % 20 < 10);
+    }
+}
+
+// Varies the budget so instructions land on both sides of frame boundaries
+static inline int frame_budget(long frame) {
+    return 7 + frame % 13;
+}
@@ -0,0 +1,78 @@
+// Runs ROMs under every interpreter loop in lockstep and checks that they end every frame in the same state as
+// the reference switch interpreter (Chip8::emulate_cycle()).
+// Usage: chip8_regression [--frames=<n>] <ROM>...
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "../src/chip8.h"
+#include "../src/rom_db.h"
+#include "lockstep.h"
+
+// The threaded interpreter is last, it is only built with CHIP8_THREADED
+static const Interpreter INTERPRETERS[] = {
+    Interpreter::Switch, Interpreter::Predecoded, Interpreter::Jit, Interpreter::Threaded
+};
+static const char *INTERPRETER_NAMES[] = { "switch", "predecoded", "jit", "threaded" };
+static const int INTERPRETER_COUNT = CHIP8_THREADED ? 4 : 3;
+
+static bool run_rom(const char *rom_path, long frames) {
+    std::shared_ptr<const RomImage> rom = RomImage::from_file(rom_path);
+    if (rom == nullptr) {
+        std::printf("%s: could not read ROM\n", rom_path);
+        return false;
+    }
+    const RomInfo *rom_info = find_rom_info(rom->hash);
+    QuirkProfile profile = rom_info != nullptr ? rom_info->profile : DEFAULT_ROM_INFO.profile;
+
+    Chip8 machines[4];
+    for (int i = 0; i < INTERPRETER_COUNT; ++i) {
+        machines[i].init();
+        machines[i].set_quirks(profile);
+        machines[i].load_rom(rom);
+        machines[i].randGen.seed(1);
+        machines[i].interpreter = INTERPRETERS[i];
+    }
+
+    for (long frame = 0; frame < frames; ++frame) {
+        int budget = frame_budget(frame);
+        int executed[4];
+        for (int i = 0; i < INTERPRETER_COUNT; ++i) {
+            scripted_input(machines[i], frame);
+            executed[i] = machines[i].run_instructions(budget);
+            machines[i].tick_timers();
+        }
+
+        for (int i = 1; i < INTERPRETER_COUNT; ++i) {
+            const char *difference = executed[i] != executed[0] ? "instruction count"
+                                                                : compare(machines[0], machines[i]);
+            if (difference != nullptr) {
+                std::printf("%s: %s differs from %s in frame %ld (%s), pc %04X vs %04X\n", rom_path,
+                            INTERPRETER_NAMES[i], INTERPRETER_NAMES[0], frame, difference, machines[i].pc,
+                            machines[0].pc);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    long frames = 3000;
+    int failures = 0;
+    int roms = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = std::atol(argv[i] + 9);
+            continue;
+        }
+        ++roms;
+        if (!run_rom(argv[i], frames)) {
+            ++failures;
+        }
+    }
+
+    std::printf("%d of %d ROMs ran the same under all %d interpreters\n", roms - failures, roms, INTERPRETER_COUNT);
+    return failures == 0 && roms > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,293 @@
+// Compiles a ROM to C++ ahead of time, using the same IR and optimization passes as the block compiler.
+// Blocks are found by following jumps, calls and skips from 0x200. The generated file implements src/aot.h and
+// falls back to the interpreter for code it didn't see (computed jumps) or that was overwritten.
+// Usage: chip8_aot [--quirks=<profile>] [--dump-ir] <ROM> <output.cpp>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "memory.h"
+#include "rom_db.h"
+
+// Upper bound on compiled blocks, ROMs are at most 3.5K (64K for XO-CHIP)
+static const size_t MAX_BLOCKS = 8192;
+
+static const char *const SLOT_NAMES[] = { "c.index", "c.delay_timer", "c.sound_timer" };
+
+static std::string slot(uint32_t index) {
+    char name[24];
+    if (index >= IR_SLOT_I) {
+        return SLOT_NAMES[index - IR_SLOT_I];
+    }
+    std::snprintf(name, sizeof(name), "c.registers[0x%X]", index);
+    return name;
+}
+
+static std::string value(uint16_t index) {
+    return "v" + std::to_string(index);
+}
+
+// C++ expression for a value instruction
+static std::string expression(const IrInst &inst) {
+    std::string a = value(inst.a);
+    std::string b = value(inst.b);
+    char text[48];
+
+    switch (inst.op) {
+        case IrOp::Const:       std::snprintf(text, sizeof(text), "0x%Xu", inst.imm); return text;
+        case IrOp::Get:         return slot(inst.imm);
+        case IrOp::Add:         return "(" + a + " + " + b + ") & 0xFFu";
+        case IrOp::Sub:         return "(" + a + " - " + b + ") & 0xFFu";
+        case IrOp::And:         return a + " & " + b;
+        case IrOp::Or:          return a + " | " + b;
+        case IrOp::Xor:         return a + " ^ " + b;
+        case IrOp::Shr:         return a + " >> 1";
+        case IrOp::Shl:         return "(" + a + " << 1) & 0xFFu";
+        case IrOp::Carry:       return a + " + " + b + " > 255u ? 1u : 0u";
+        case IrOp::Greater:     return a + " > " + b + " ? 1u : 0u";
+        case IrOp::NotGreater:  return a + " > " + b + " ? 0u : 1u";
+        case IrOp::LowBit:      return a + " & 1u";
+        case IrOp::HighBit:     return "(" + a + " >> 7) & 1u";
+        case IrOp::AddIndex:    return "(" + a + " + " + b + ") & 0xFFFFu";
+        case IrOp::FontAddress: return "FONTSET_START_ADDRESS + 5 * (" + a + " & 0xFu)";
+        case IrOp::Key:         return "c.keypad[" + a + " & 0xFu]";
+        default:                return "0";
+    }
+}
+
+static void emit_block(FILE *out, const IrBlock &block) {
+    std::string listing = ir_to_string(block);
+    std::fprintf(out, "// %d instructions\n//   ", block.instructions);
+    for (size_t i = 0; i < listing.size(); ++i) {
+        std::fputc(listing[i], out);
+        if (listing[i] == '\n' && i + 1 < listing.size()) {
+            std::fputs("//   ", out);
+        }
+    }
+
+    std::fprintf(out, "static int block_%04X(Chip8 &c) {\n", block.start);
+    for (size_t i = 0; i < block.code.size(); ++i) {
+        const IrInst &inst = block.code[i];
+        if (ir_has_value(inst.op)) {
+            std::fprintf(out, "    const uint32_t v%u = %s;\n", static_cast<unsigned>(i), expression(inst).c_str());
+            continue;
+        }
+
+        switch (inst.op) {
+            case IrOp::Set:
+                std::fprintf(out, "    %s = static_cast<uint%d_t>(v%u);\n", slot(inst.imm).c_str(),
+                             inst.imm == IR_SLOT_I ? 16 : 8, inst.a);
+                break;
+
+            case IrOp::Interp:
+                std::fprintf(out, "    c.pc = 0x%X;\n    c.emulate_cycle();\n", inst.imm);
+                break;
+
+            case IrOp::Call:
+                std::fprintf(out, "    c.stack[c.sp] = 0x%X;\n    c.sp = (c.sp + 1) & 0xFu;\n", inst.imm);
+                break;
+
+            case IrOp::ExitIfEqual:
+            case IrOp::ExitIfNotEqual:
+                std::fprintf(out, "    if (v%u %s v%u) {\n        c.pc = 0x%X;\n        return %u;\n    }\n", inst.a,
+                             inst.op == IrOp::ExitIfEqual ? "==" : "!=", inst.b, inst.imm, inst.imm2);
+                break;
+
+            case IrOp::Jump:
+                std::fprintf(out, "    c.pc = 0x%X;\n", inst.imm);
+                if (inst.imm2 == IR_IDLE_ALWAYS) {
+                    std::fprintf(out, "    c.idle = true;\n");
+                } else if (inst.imm2 == IR_IDLE_TIMER_WAIT) {
+                    std::fprintf(out, "    if (c.is_timer_wait(0x%X)) {\n        c.idle = true;\n    }\n", inst.imm);
+                }
+                std::fprintf(out, "    return %d;\n", block.instructions);
+                break;
+
+            case IrOp::Return:
+                std::fprintf(out, "    c.sp = (c.sp - 1) & 0xFu;\n    c.pc = c.stack[c.sp];\n    return %d;\n",
+                             block.instructions);
+                break;
+
+            case IrOp::Exit:
+                std::fprintf(out, "    return %d;\n", block.instructions);
+                break;
+
+            default:
+                break;
+        }
+    }
+    std::fprintf(out, "}\n\n");
+}
+
+// Copies of the bytes each block was compiled from, checked before running it once the ROM wrote to their page
+static void emit_code_bytes(FILE *out, const Memory &memory, const IrBlock &block) {
+    for (size_t i = 0; i < block.ranges.size(); ++i) {
+        std::fprintf(out, "static const uint8_t code_%04X_%u[] = {", block.start, static_cast<unsigned>(i));
+        for (uint32_t address = block.ranges[i].first; address < block.ranges[i].last; ++address) {
+            std::fprintf(out, "%s0x%02X", address == block.ranges[i].first ? " " : ", ", memory.read(address));
+        }
+        std::fprintf(out, " };\n");
+    }
+    std::fprintf(out, "static const AotCode code_%04X[] = {\n", block.start);
+    for (size_t i = 0; i < block.ranges.size(); ++i) {
+        std::fprintf(out, "    { 0x%X, %u, code_%04X_%u },\n", block.ranges[i].first,
+                     block.ranges[i].last - block.ranges[i].first, block.start, static_cast<unsigned>(i));
+    }
+    std::fprintf(out, "};\n\n");
+}
+
+static const char *const PRELUDE =
+    "#include \"aot.h\"\n"
+    "\n"
+    "struct AotCode {\n"
+    "    uint32_t address;\n"
+    "    uint32_t size;\n"
+    "    const uint8_t *bytes;\n"
+    "};\n"
+    "\n"
+    "template <size_t N>\n"
+    "static bool unchanged(const Chip8 &c, const AotCode (&code)[N]) {\n"
+    "    for (size_t i = 0; i < N; ++i) {\n"
+    "        uint32_t last = code[i].address + code[i].size - 1;\n"
+    "        if (!c.memory.modified(code[i].address) && !c.memory.modified(last)) {\n"
+    "            continue;\n"
+    "        }\n"
+    "        for (uint32_t j = 0; j < code[i].size; ++j) {\n"
+    "            if (c.memory.read(code[i].address + j) != code[i].bytes[j]) {\n"
+    "                return false;\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    return true;\n"
+    "}\n"
+    "\n";
+
+int main(int argc, char *argv[]) {
+    const char *rom_path = nullptr;
+    const char *output_path = nullptr;
+    bool has_profile = false;
+    bool dump_ir = false;
+    QuirkProfile profile = QuirkProfile::Chip8;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            if (!parse_quirk_profile(argv[i] + 9, profile)) {
+                std::fprintf(stderr, "Unknown quirk profile: %s\n", argv[i] + 9);
+                return 1;
+            }
+            has_profile = true;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            dump_ir = true;
+        } else if (rom_path == nullptr) {
+            rom_path = argv[i];
+        } else {
+            output_path = argv[i];
+        }
+    }
+    if (rom_path == nullptr || output_path == nullptr) {
+        std::fprintf(stderr, "Usage: %s [--quirks=<profile>] [--dump-ir] <ROM> <output.cpp>\n", argv[0]);
+        return 1;
+    }
+
+    std::shared_ptr<const RomImage> rom = RomImage::from_file(rom_path);
+    if (rom == nullptr) {
+        std::fprintf(stderr, "Could not read ROM: %s\n", rom_path);
+        return 1;
+    }
+    if (!has_profile) {
+        const RomInfo *rom_info = find_rom_info(rom->hash);
+        profile = rom_info != nullptr ? rom_info->profile : DEFAULT_ROM_INFO.profile;
+    }
+    if (rom->rom_size > quirk_memory_size(profile) - START_ADDRESS) {
+        std::fprintf(stderr, "ROM is too large for %s\n", quirk_profile_name(profile));
+        return 1;
+    }
+    Memory memory;
+    memory.attach(rom, quirk_memory_size(profile));
+    uint32_t rom_end = START_ADDRESS + static_cast<uint32_t>(rom->rom_size);
+
+    // Every address a block can leave for, starting with the entry point. Computed jumps are left to the
+    // interpreter.
+    std::map<uint32_t, IrBlock> blocks;
+    std::vector<uint32_t> worklist(1, START_ADDRESS);
+    while (!worklist.empty() && blocks.size() < MAX_BLOCKS) {
+        uint32_t address = worklist.back();
+        worklist.pop_back();
+        if (address < START_ADDRESS || address + 1 >= rom_end || blocks.count(address) != 0) {
+            continue;
+        }
+
+        IrBlock block = build_ir_block(memory, address, profile);
+        optimize_ir_block(block);
+        for (size_t i = 0; i < block.code.size(); ++i) {
+            const IrInst &inst = block.code[i];
+            if (inst.op == IrOp::ExitIfEqual || inst.op == IrOp::ExitIfNotEqual || inst.op == IrOp::Jump ||
+                inst.op == IrOp::Call) {
+                worklist.push_back(inst.imm);
+            } else if (inst.op == IrOp::Interp) {
+                // After FX0A, and harmless for instructions that don't continue there
+                worklist.push_back(inst.imm + 2);
+            }
+        }
+        blocks[address] = block;
+    }
+
+    if (dump_ir) {
+        for (std::map<uint32_t, IrBlock>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+            std::printf("%04X:\n%s\n", i->first, ir_to_string(i->second).c_str());
+        }
+    }
+
+    FILE *out = std::fopen(output_path, "w");
+    if (out == nullptr) {
+        std::fprintf(stderr, "Could not write %s\n", output_path);
+        return 1;
+    }
+
+    std::fprintf(out, "// Generated by chip8_aot from %s, do not edit.\n", rom_path);
+    std::fputs(PRELUDE, out);
+    std::fprintf(out, "const uint64_t AOT_ROM_HASH = 0x%016llXull;\n", static_cast<unsigned long long>(rom->hash));
+    static const char *const PROFILE_NAMES[] = { "Chip8", "SuperChip", "XoChip", "CosmacVip" };
+    std::fprintf(out, "const QuirkProfile AOT_PROFILE = QuirkProfile::%s;\n\n",
+                 PROFILE_NAMES[static_cast<int>(profile)]);
+
+    for (std::map<uint32_t, IrBlock>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+        emit_code_bytes(out, memory, i->second);
+        emit_block(out, i->second);
+    }
+
+    std::fprintf(out,
+                 "int aot_run(Chip8 &c, int budget) {\n"
+                 "    int executed = 0;\n"
+                 "    c.idle = c.waiting_for_key;\n"
+                 "    while (executed < budget && !c.exited && !c.idle) {\n"
+                 "        int left = budget - executed;\n"
+                 "        int ran = 0;\n"
+                 "        switch (c.pc) {\n");
+    for (std::map<uint32_t, IrBlock>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+        std::fprintf(out,
+                     "            case 0x%04X:\n"
+                     "                if (left >= %d && unchanged(c, code_%04X)) {\n"
+                     "                    ran = block_%04X(c);\n"
+                     "                }\n"
+                     "                break;\n",
+                     i->first, i->second.instructions, i->first, i->first);
+    }
+    std::fprintf(out,
+                 "        }\n"
+                 "        if (ran == 0) {\n"
+                 "            c.emulate_cycle();\n"
+                 "            ran = 1;\n"
+                 "        }\n"
+                 "        executed += ran;\n"
+                 "    }\n"
+                 "    return executed;\n"
+                 "}\n");
+    std::fclose(out);
+
+    std::printf("%s: %u blocks, %s quirks\n", output_path, static_cast<unsigned>(blocks.size()),
+                quirk_profile_name(profile));
+    return 0;
+}
@@ -0,0 +1,352 @@
+// Disassembles a ROM: code found by following jumps, calls and skips from 0x200, sprite data found from the
+// ANNN loads that reach a DXYN, and everything else as bytes. Optionally writes the control-flow graph in
+// Graphviz DOT or JSON. Coverage files of runs (the emulator's --coverage) are merged, followed as extra code and
+// shown in a column of the listing.
+// Usage: chip8_disasm [--quirks=<profile>] [--dot=<file>] [--json=<file>] [--coverage=<file>]... <ROM>
+//                     [<listing.txt>]
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "coverage.h"
+#include "disasm.h"
+#include "memory.h"
+#include "rom_db.h"
+
+// Bytes per DB line of data that isn't a sprite
+static const uint32_t DATA_BYTES_PER_LINE = 8;
+
+static uint16_t read_opcode(const Memory &memory, uint32_t address) {
+    return memory.read(address) << 8 | memory.read(address + 1);
+}
+
+static std::string instruction_text(const Memory &memory, uint32_t address) {
+    return disassemble(read_opcode(memory, address), read_opcode(memory, address + 2));
+}
+
+// Address of the last instruction of a block, where its edges leave from
+static uint32_t last_instruction(const Memory &memory, const CfgBlock &block) {
+    uint32_t address = block.start;
+    while (address + instruction_size(read_opcode(memory, address)) < block.end) {
+        address += instruction_size(read_opcode(memory, address));
+    }
+    return address;
+}
+
+static std::string json_string(const char *text) {
+    std::string quoted = "\"";
+    for (const char *c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            quoted += '\\';
+        }
+        quoted += *c;
+    }
+    return quoted + "\"";
+}
+
+// Contiguous ranges of addresses in the ROM that have flag
+static void write_json_ranges(FILE *out, const RomAnalysis &analysis, uint8_t flag) {
+    bool first = true;
+    for (uint32_t address = START_ADDRESS; address < analysis.rom_end; ++address) {
+        if (!(analysis.flags[address] & flag)) {
+            continue;
+        }
+        uint32_t end = address;
+        while (end < analysis.rom_end && (analysis.flags[end] & flag)) {
+            ++end;
+        }
+        std::fprintf(out, "%s\n    { \"start\": %u, \"end\": %u }", first ? "" : ",", address, end);
+        first = false;
+        address = end;
+    }
+    std::fprintf(out, first ? "]" : "\n  ]");
+}
+
+static void write_json(FILE *out, const Memory &memory, const RomAnalysis &analysis, const char *rom_path,
+                       QuirkProfile profile) {
+    std::fprintf(out, "{\n  \"rom\": %s,\n  \"quirks\": \"%s\",\n  \"blocks\": [", json_string(rom_path).c_str(),
+                 quirk_profile_name(profile));
+    for (size_t i = 0; i < analysis.blocks.size(); ++i) {
+        const CfgBlock &block = analysis.blocks[i];
+        std::fprintf(out, "%s\n    {\n      \"start\": %u,\n      \"end\": %u,\n      \"returns\": %s,\n"
+                     "      \"indirect\": %s,\n      \"instructions\": [", i == 0 ? "" : ",", block.start, block.end,
+                     block.returns ? "true" : "false", block.indirect ? "true" : "false");
+        for (uint32_t address = block.start; address < block.end;) {
+            uint16_t opcode = read_opcode(memory, address);
+            std::fprintf(out, "%s\n        { \"address\": %u, \"opcode\": %u, \"text\": \"%s\" }",
+                         address == block.start ? "" : ",", address, opcode, instruction_text(memory, address).c_str());
+            address += instruction_size(opcode);
+        }
+        std::fprintf(out, "\n      ],\n      \"successors\": [");
+        for (size_t j = 0; j < block.successors.size(); ++j) {
+            std::fprintf(out, "%s{ \"target\": %u, \"kind\": \"%s\" }", j == 0 ? " " : ", ", block.successors[j].target,
+                         edge_kind_name(block.successors[j].kind));
+        }
+        std::fprintf(out, "%s]\n    }", block.successors.empty() ? "" : " ");
+    }
+    std::fprintf(out, "%s],\n  \"sprites\": [", analysis.blocks.empty() ? "" : "\n  ");
+    write_json_ranges(out, analysis, ADDRESS_SPRITE);
+    std::fprintf(out, ",\n  \"data\": [");
+    write_json_ranges(out, analysis, ADDRESS_DATA);
+    std::fprintf(out, "\n}\n");
+}
+
+// One node per block, labelled with its instructions. Calls are dashed, their return continues at the dotted
+// fallthrough edge.
+static void write_dot(FILE *out, const Memory &memory, const RomAnalysis &analysis) {
+    std::fprintf(out, "digraph rom {\n    node [shape=box, fontname=\"monospace\"];\n");
+    for (const CfgBlock &block : analysis.blocks) {
+        std::fprintf(out, "    b%04X [label=\"", block.start);
+        for (uint32_t address = block.start; address < block.end;) {
+            std::fprintf(out, "%04X: %s\\l", address, instruction_text(memory, address).c_str());
+            address += instruction_size(read_opcode(memory, address));
+        }
+        std::fprintf(out, "\"];\n");
+    }
+    for (const CfgBlock &block : analysis.blocks) {
+        bool calls = !block.successors.empty() && block.successors[0].kind == EdgeKind::Call;
+        for (const CfgEdge &edge : block.successors) {
+            const char *style = edge.kind == EdgeKind::Call ? ", style=dashed"
+                              : calls && edge.kind == EdgeKind::Fallthrough ? ", style=dotted" : "";
+            std::fprintf(out, "    b%04X -> b%04X [label=\"%s\"%s];\n", block.start, edge.target,
+                         edge_kind_name(edge.kind), style);
+        }
+    }
+    std::fprintf(out, "}\n");
+}
+
+// Sources of the jumps and calls to every target, for the comments above the labels
+static std::map<uint32_t, std::vector<uint32_t>> find_references(const Memory &memory, const RomAnalysis &analysis) {
+    std::map<uint32_t, std::vector<uint32_t>> references;
+    for (const CfgBlock &block : analysis.blocks) {
+        for (const CfgEdge &edge : block.successors) {
+            if (edge.kind == EdgeKind::Jump || edge.kind == EdgeKind::Call || edge.kind == EdgeKind::Indirect) {
+                references[edge.target].push_back(last_instruction(memory, block));
+            }
+        }
+    }
+    return references;
+}
+
+// True after the last instruction of a block that doesn't fall through (JP, RET, BNNN, EXIT)
+static bool ends_flow(const RomAnalysis &analysis, uint32_t address, uint32_t next) {
+    const CfgBlock *block = analysis.find_block(address);
+    if (block == nullptr || block->end != next) {
+        return false;
+    }
+    for (const CfgEdge &edge : block->successors) {
+        if (edge.kind == EdgeKind::Fallthrough) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Coverage column of a listing line: + ran, - code that never ran, r read as data (any of length bytes)
+static const char *coverage_mark(const RomCoverage *coverage, const RomAnalysis &analysis, uint32_t address,
+                                 uint32_t length) {
+    if (coverage == nullptr) {
+        return "";
+    }
+    if (analysis.flags[address] & ADDRESS_CODE) {
+        return coverage->code.test(address) ? "+ " : "- ";
+    }
+    for (uint32_t i = 0; i < length; ++i) {
+        if (coverage->data.test(address + i)) {
+            return "r ";
+        }
+    }
+    return "  ";
+}
+
+static void write_coverage_summary(FILE *out, const RomCoverage &coverage, const RomAnalysis &analysis) {
+    uint32_t instructions = 0, ran = 0, read = 0;
+    for (uint32_t address = START_ADDRESS; address < analysis.rom_end; ++address) {
+        if (analysis.flags[address] & ADDRESS_CODE) {
+            ++instructions;
+            ran += coverage.code.test(address);
+        }
+        read += coverage.data.test(address);
+    }
+    std::fprintf(out, "; Coverage of %u runs: %u of %u instructions ran (%.1f%%), %u bytes read as data\n",
+                 coverage.runs, ran, instructions, instructions == 0 ? 0.0 : 100.0 * ran / instructions, read);
+}
+
+static void write_listing(FILE *out, const Memory &memory, const RomAnalysis &analysis, const char *rom_path,
+                          QuirkProfile profile, const RomCoverage *coverage) {
+    uint32_t counts[3] = { 0, 0, 0 };
+    for (uint32_t address = START_ADDRESS; address < analysis.rom_end; ++address) {
+        uint8_t flags = analysis.flags[address];
+        ++counts[flags & (ADDRESS_CODE | ADDRESS_OPERAND) ? 0 : flags & ADDRESS_SPRITE ? 1 : 2];
+    }
+    std::fprintf(out, "; %s, %s quirks\n; %u blocks, %u bytes of code, %u bytes of sprites, %u other bytes\n",
+                 rom_path, quirk_profile_name(profile), static_cast<unsigned>(analysis.blocks.size()), counts[0],
+                 counts[1], counts[2]);
+    if (coverage != nullptr) {
+        write_coverage_summary(out, *coverage, analysis);
+    }
+    std::fprintf(out, "\n");
+
+    std::map<uint32_t, std::vector<uint32_t>> references = find_references(memory, analysis);
+    bool separated = true;
+    for (uint32_t address = START_ADDRESS; address < analysis.rom_end;) {
+        uint8_t flags = analysis.flags[address];
+
+        if (flags & ADDRESS_CODE) {
+            if (flags & (ADDRESS_JUMP_TARGET | ADDRESS_CALL_TARGET)) {
+                const std::vector<uint32_t> &sources = references[address];
+                const char *kind = flags & ADDRESS_CALL_TARGET ? "called from" : "from";
+                std::fprintf(out, "%s; %s", separated ? "" : "\n", kind);
+                for (size_t i = 0; i < sources.size(); ++i) {
+                    std::fprintf(out, "%s %04X", i == 0 ? "" : ",", sources[i]);
+                }
+                std::fprintf(out, "\n%s_%04X:\n", flags & ADDRESS_CALL_TARGET ? "sub" : "loc", address);
+            }
+            uint16_t opcode = read_opcode(memory, address);
+            uint32_t next = address + instruction_size(opcode);
+            std::string text = instruction_text(memory, address);
+            uint32_t index = opcode == 0xF000 ? read_opcode(memory, address + 2) : opcode & 0x0FFFu;
+            if ((opcode & 0xF000u) == 0xA000u || opcode == 0xF000) {
+                text += analysis.flags[index & (analysis.flags.size() - 1)] & ADDRESS_SPRITE ? "  ; sprite" : "";
+            }
+            const char *mark = coverage_mark(coverage, analysis, address, 1);
+            if (opcode == 0xF000) {
+                std::fprintf(out, "%s%04X  %04X %04X  %s\n", mark, address, opcode, index, text.c_str());
+            } else {
+                std::fprintf(out, "%s%04X  %04X       %s\n", mark, address, opcode, text.c_str());
+            }
+            separated = ends_flow(analysis, address, next);
+            if (separated) {
+                std::fprintf(out, "\n");
+            }
+            address = next;
+        } else if (flags & ADDRESS_OPERAND) {
+            // Second byte of an instruction also decoded at an odd address
+            ++address;
+        } else if (flags & ADDRESS_SPRITE) {
+            uint8_t byte = memory.read(address);
+            char pixels[9];
+            for (int bit = 0; bit < 8; ++bit) {
+                pixels[bit] = byte & (0x80 >> bit) ? '#' : '.';
+            }
+            pixels[8] = '\0';
+            std::fprintf(out, "%s%04X  %02X         DB 0x%02X  ; %s\n", coverage_mark(coverage, analysis, address, 1),
+                         address, byte, byte, pixels);
+            separated = false;
+            ++address;
+        } else {
+            uint32_t start = address;
+            std::string bytes;
+            char byte[8];
+            while (address < analysis.rom_end && address - start < DATA_BYTES_PER_LINE &&
+                   !(analysis.flags[address] & (ADDRESS_CODE | ADDRESS_OPERAND | ADDRESS_SPRITE))) {
+                std::snprintf(byte, sizeof(byte), "%s0x%02X", address == start ? "" : ", ", memory.read(address));
+                bytes += byte;
+                ++address;
+            }
+            std::fprintf(out, "%s%04X             DB %s", coverage_mark(coverage, analysis, start, address - start),
+                         start, bytes.c_str());
+            std::fprintf(out, flags & ADDRESS_DATA ? "  ; data\n" : "\n");
+            separated = false;
+        }
+    }
+}
+
+static FILE *open_output(const char *path) {
+    FILE *out = std::fopen(path, "w");
+    if (out == nullptr) {
+        std::fprintf(stderr, "Could not write %s\n", path);
+    }
+    return out;
+}
+
+int main(int argc, char *argv[]) {
+    const char *rom_path = nullptr;
+    const char *listing_path = nullptr;
+    const char *dot_path = nullptr;
+    const char *json_path = nullptr;
+    bool has_profile = false;
+    QuirkProfile profile = QuirkProfile::Chip8;
+    RomCoverage coverage;
+    std::string error;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--quirks=", 9) == 0) {
+            if (!parse_quirk_profile(argv[i] + 9, profile)) {
+                std::fprintf(stderr, "Unknown quirk profile: %s\n", argv[i] + 9);
+                return 1;
+            }
+            has_profile = true;
+        } else if (strncmp(argv[i], "--dot=", 6) == 0) {
+            dot_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--coverage=", 11) == 0) {
+            if (!merge_coverage(argv[i] + 11, coverage, error)) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+        } else if (rom_path == nullptr) {
+            rom_path = argv[i];
+        } else {
+            listing_path = argv[i];
+        }
+    }
+    if (rom_path == nullptr) {
+        std::fprintf(stderr, "Usage: %s [--quirks=<profile>] [--dot=<file>] [--json=<file>] [--coverage=<file>]... "
+                     "<ROM> [<listing.txt>]\n", argv[0]);
+        return 1;
+    }
+
+    std::shared_ptr<const RomImage> rom = RomImage::from_file(rom_path);
+    if (rom == nullptr) {
+        std::fprintf(stderr, "Could not read ROM: %s\n", rom_path);
+        return 1;
+    }
+    if (coverage.runs > 0 && coverage.rom_hash != rom->hash) {
+        std::fprintf(stderr, "The coverage is of another ROM\n");
+        return 1;
+    }
+    const RomCoverage *runs = coverage.runs > 0 ? &coverage : nullptr;
+    if (!has_profile) {
+        const RomInfo *rom_info = find_rom_info(rom->hash);
+        profile = rom_info != nullptr ? rom_info->profile : DEFAULT_ROM_INFO.profile;
+    }
+    if (rom->rom_size > quirk_memory_size(profile) - START_ADDRESS) {
+        std::fprintf(stderr, "ROM is too large for %s\n", quirk_profile_name(profile));
+        return 1;
+    }
+
+    Memory memory;
+    memory.attach(rom, quirk_memory_size(profile));
+    RomAnalysis analysis = analyze_rom(memory, static_cast<uint32_t>(rom->rom_size), profile,
+                                       runs != nullptr ? &runs->code : nullptr);
+
+    FILE *listing = listing_path != nullptr ? open_output(listing_path) : stdout;
+    if (listing == nullptr) {
+        return 1;
+    }
+    write_listing(listing, memory, analysis, rom_path, profile, runs);
+    if (listing != stdout) {
+        std::fclose(listing);
+    }
+
+    if (dot_path != nullptr) {
+        FILE *out = open_output(dot_path);
+        if (out == nullptr) {
+            return 1;
+        }
+        write_dot(out, memory, analysis);
+        std::fclose(out);
+    }
+    if (json_path != nullptr) {
+        FILE *out = open_output(json_path);
+        if (out == nullptr) {
+            return 1;
+        }
+        write_json(out, memory, analysis, rom_path, profile);
+        std::fclose(out);
+    }
+    return 0;
+}